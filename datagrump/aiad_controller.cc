@@ -0,0 +1,107 @@
+#include <iostream>
+
+#include "aiad_controller.hh"
+
+using namespace std;
+
+AIADController::AIADController( const bool debug, const Parameters & parameters )
+  : Controller( debug ),
+    probe_gain( parameter( parameters, "probe-gain", 2.0 ) ),
+    backoff_gain( parameter( parameters, "backoff-gain", 3.0 ) ),
+    burst_us( duration_parameter_us( parameters, "burst-ms", 70 ) ),
+    window_weight( parameter( parameters, "window-weight", 0.45 ) ),
+    burst_weight( parameter( parameters, "burst-weight", 0.45 ) ),
+    rtt_gate_us( duration_parameter_us( parameters, "rtt-gate-ms", 200 ) ),
+    /* a little faster than one window per RTT, so the window can still fill */
+    pacing_gain( parameter( parameters, "pacing-gain", 1.25 ) ),
+    the_window_size(1.0),
+    num_packets_received(0),
+    first_of_burst(0),
+    burst_count(1),
+    num_packets_sent(0),
+    last_queue_occ(-1),
+    smoothed_rtt_us(0.0)
+{}
+
+/* Get current window size, in datagrams */
+unsigned int AIADController::do_window_size( void )
+{
+  return max((int)the_window_size, 1);
+}
+
+/* A datagram was sent */
+void AIADController::do_datagram_was_sent( const uint64_t, const uint64_t )
+{
+  num_packets_sent++;
+}
+
+void AIADController::delay_aiad_unsmoothedRTT(const uint64_t sequence_number_acked,
+             const uint64_t send_timestamp_acked,
+             const uint64_t recv_timestamp_acked,
+             const uint64_t timestamp_ack_received )
+{
+  uint64_t newRoundTripTime = timestamp_ack_received - send_timestamp_acked;
+  num_packets_received++;
+
+  if (smoothed_rtt_us == 0.0) {
+    smoothed_rtt_us = newRoundTripTime;
+  } else {
+    smoothed_rtt_us = 0.875 * smoothed_rtt_us + 0.125 * newRoundTripTime;
+  }
+
+  int newBufferOcc = num_packets_sent - num_packets_received;
+  if (num_packets_received == 1) {
+    // first packet, so start a new burst.
+    first_of_burst = recv_timestamp_acked;
+    if (newRoundTripTime <= rtt_gate_us) {
+      the_window_size += probe_gain/do_window_size();
+    }
+  } else {
+    if (last_queue_occ < newBufferOcc - 1) {
+      the_window_size -= backoff_gain/do_window_size();
+    } else {
+      // keep probing the network during the burst period
+      the_window_size += probe_gain/do_window_size();
+    }
+    if (recv_timestamp_acked <= first_of_burst + burst_us) {
+      burst_count++;
+    } else {
+      // end of burst
+      // set the new window size to be a a little bit less than the measured value to avoid
+      // overflowing the queue. Smooth the change out with the old window size.
+      double new_window_size = window_weight * the_window_size + burst_weight * burst_count;
+      the_window_size = new_window_size;
+
+      burst_count = 1;
+      first_of_burst = recv_timestamp_acked;
+    }
+  }
+  last_queue_occ = newBufferOcc;
+  if (debug()) {
+    cerr << sequence_number_acked << "\n";
+  }
+}
+
+/* An ack was received */
+void AIADController::do_ack_received( const uint64_t sequence_number_acked,
+				      const uint64_t send_timestamp_acked,
+				      const uint64_t recv_timestamp_acked,
+				      const uint64_t timestamp_ack_received )
+{
+  delay_aiad_unsmoothedRTT(sequence_number_acked, send_timestamp_acked, recv_timestamp_acked, timestamp_ack_received);
+}
+
+/* Pace one window per smoothed RTT (a little faster, to leave room to grow) */
+double AIADController::do_pacing_rate( void )
+{
+  if (smoothed_rtt_us == 0.0) {
+    return 0.0; /* no RTT sample yet */
+  }
+
+  return pacing_gain * do_window_size() * 1000000.0 / max(smoothed_rtt_us, 1.0);
+}
+
+void AIADController::do_timeout( const uint64_t )
+{
+  the_window_size -= 1.5/do_window_size();
+}
@@ -0,0 +1,52 @@
+#ifndef AIAD_CONTROLLER_HH
+#define AIAD_CONTROLLER_HH
+
+#include "controller.hh"
+
+/* Delay-driven AIAD: probes additively on every ack, backs off additively
+   when the queue grows, and resets the window to the number of datagrams
+   that arrived in each 70 ms burst. The constants can all be tuned by
+   name (see the constructor) */
+
+class AIADController : public Controller
+{
+private:
+  /* tunable constants */
+  double probe_gain;        /* window growth per ack, over the window */
+  double backoff_gain;      /* window shrinkage per ack when the queue grows */
+  uint64_t burst_us;        /* how long each burst is counted for */
+  double window_weight;     /* at the end of a burst, the new window is */
+  double burst_weight;      /*   this much of the old plus this much of the count */
+  uint64_t rtt_gate_us;     /* the first ack only grows the window under this RTT */
+  double pacing_gain;       /* pace this much faster than a window per RTT */
+
+  double the_window_size;
+  uint64_t num_packets_received;
+  uint64_t first_of_burst;
+  uint64_t burst_count;
+
+  uint64_t num_packets_sent;
+  int last_queue_occ;
+  double smoothed_rtt_us;
+
+  void delay_aiad_unsmoothedRTT(const uint64_t sequence_number_acked,
+             const uint64_t send_timestamp_acked,
+             const uint64_t recv_timestamp_acked,
+             const uint64_t timestamp_ack_received );
+
+protected:
+  unsigned int do_window_size( void ) override;
+  void do_datagram_was_sent( const uint64_t sequence_number,
+			     const uint64_t send_timestamp ) override;
+  void do_ack_received( const uint64_t sequence_number_acked,
+			const uint64_t send_timestamp_acked,
+			const uint64_t recv_timestamp_acked,
+			const uint64_t timestamp_ack_received ) override;
+  double do_pacing_rate( void ) override;
+  void do_timeout( const uint64_t abandoned ) override;
+
+public:
+  AIADController( const bool debug, const Parameters & parameters = Parameters() );
+};
+
+#endif /* AIAD_CONTROLLER_HH */
@@ -0,0 +1,46 @@
+#include <algorithm>
+
+#include "aimd_controller.hh"
+
+using namespace std;
+
+AIMDController::AIMDController( const bool debug )
+  : Controller( debug ),
+    window_( 1.0 ),
+    slow_start_threshold_( 64.0 ),
+    recovery_start_( 0 )
+{}
+
+unsigned int AIMDController::do_window_size( void )
+{
+  return max( 1u, static_cast<unsigned int>( window_ ) );
+}
+
+void AIMDController::do_ack_received( const uint64_t, const uint64_t,
+				      const uint64_t, const uint64_t )
+{
+  if ( window_ < slow_start_threshold_ ) {
+    window_ += 1.0;
+  } else {
+    window_ += 1.0 / window_;
+  }
+}
+
+void AIMDController::do_datagram_was_lost( const uint64_t,
+					   const uint64_t send_timestamp,
+					   const uint64_t timestamp_detected )
+{
+  if ( send_timestamp < recovery_start_ ) {
+    return;
+  }
+
+  slow_start_threshold_ = max( 2.0, window_ / 2.0 );
+  window_ = slow_start_threshold_;
+  recovery_start_ = timestamp_detected;
+}
+
+void AIMDController::do_timeout( const uint64_t )
+{
+  slow_start_threshold_ = max( 2.0, window_ / 2.0 );
+  window_ = slow_start_threshold_;
+}
@@ -0,0 +1,34 @@
+#ifndef AIMD_CONTROLLER_HH
+#define AIMD_CONTROLLER_HH
+
+#include "controller.hh"
+
+/* Classic AIMD: slow start up to a threshold, then one datagram
+   of additive increase per window acked; halve the window on a timeout,
+   or on a loss (at most once per window of data) */
+
+class AIMDController : public Controller
+{
+private:
+  double window_;
+  double slow_start_threshold_;
+
+  /* losses of datagrams sent before this belong to the last reduction */
+  uint64_t recovery_start_;
+
+protected:
+  unsigned int do_window_size( void ) override;
+  void do_ack_received( const uint64_t sequence_number_acked,
+			const uint64_t send_timestamp_acked,
+			const uint64_t recv_timestamp_acked,
+			const uint64_t timestamp_ack_received ) override;
+  void do_datagram_was_lost( const uint64_t sequence_number,
+			     const uint64_t send_timestamp,
+			     const uint64_t timestamp_detected ) override;
+  void do_timeout( const uint64_t abandoned ) override;
+
+public:
+  AIMDController( const bool debug );
+};
+
+#endif /* AIMD_CONTROLLER_HH */
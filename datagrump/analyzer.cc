@@ -0,0 +1,112 @@
+/* scores a mahimahi-format link log (from mm-link or the emulator):
+   throughput, 95th-percentile queueing delay and power, with an
+   optional time series */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "score.hh"
+
+using namespace std;
+
+/* read buffer for the log */
+static const size_t READ_BUFFER_SIZE = 1 << 20;
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " LOG|- [interval=MS] [series=FILE|-]" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc < 2 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  uint64_t interval_ms = 500;
+  string series_name;
+
+  for ( int i = 2; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option.substr( 0, 9 ) == "interval=" ) {
+      interval_ms = stoull( option.substr( 9 ) );
+    } else if ( option.substr( 0, 7 ) == "series=" ) {
+      series_name = option.substr( 7 );
+    } else {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* the log, from a file or standard input */
+  vector<char> read_buffer( READ_BUFFER_SIZE );
+  unique_ptr<ifstream> log_file;
+  istream * log = &cin;
+  const string log_name { argv[ 1 ] };
+  if ( log_name != "-" ) {
+    log_file.reset( new ifstream );
+    log_file->rdbuf()->pubsetbuf( read_buffer.data(), read_buffer.size() );
+    log_file->open( log_name );
+    if ( not log_file->good() ) {
+      throw runtime_error( log_name + ": error opening for reading" );
+    }
+    log = log_file.get();
+  }
+
+  /* where the time series goes, if anywhere */
+  unique_ptr<ofstream> series_file;
+  ostream * series = nullptr;
+  if ( series_name == "-" ) {
+    series = &cout;
+  } else if ( not series_name.empty() ) {
+    series_file.reset( new ofstream( series_name ) );
+    if ( not series_file->good() ) {
+      throw runtime_error( series_name + ": error opening for writing" );
+    }
+    series = series_file.get();
+  }
+
+  if ( series ) {
+    *series << "# time_s capacity_mbps throughput_mbps delay_p95_ms" << "\n";
+  }
+
+  LinkScore score( interval_ms, [&] ( const LinkScore::Interval & interval ) {
+	if ( series ) {
+	  *series << fixed << setprecision( 3 ) << interval.start_ms / 1000.0 << " "
+		  << interval.capacity_mbps() << " " << interval.throughput_mbps() << " "
+		  << interval.delay_p95_ms << "\n";
+	}
+      } );
+
+  /* one line at a time, so memory use doesn't grow with the log */
+  string line;
+  while ( getline( *log, line ) ) {
+    score.add_log_line( line );
+  }
+
+  if ( log->bad() ) {
+    throw runtime_error( log_name + ": error reading" );
+  }
+
+  score.finish();
+
+  if ( series ) {
+    series->flush();
+  }
+
+  cout << score.summary();
+
+  return EXIT_SUCCESS;
+}
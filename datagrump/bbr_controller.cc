@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "bbr_controller.hh"
+
+using namespace std;
+
+/* datagrams remembered for delivery-rate samples */
+static const size_t SENT_HISTORY = 1 << 16;
+
+/* filter windows */
+static const uint64_t BANDWIDTH_WINDOW_ROUNDS = 10;
+static const uint64_t MIN_RTT_WINDOW_US = 10 * 1000 * 1000;
+
+/* Startup gain (2/ln 2), enough to double the sending rate every round */
+static const double HIGH_GAIN = 2.885;
+
+/* ProbeBW pacing gains, one phase per min RTT */
+static const double CYCLE_GAINS[] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+static const unsigned int CYCLE_LENGTH = sizeof( CYCLE_GAINS ) / sizeof( CYCLE_GAINS[ 0 ] );
+
+/* ProbeRTT: window and how long to hold it */
+static const unsigned int MIN_WINDOW = 4;
+static const uint64_t PROBE_RTT_DURATION_US = 200 * 1000;
+
+/* window before there is a model */
+static const unsigned int INITIAL_WINDOW = 10;
+
+BBRController::BBRController( const bool debug )
+  : Controller( debug ),
+    sent_( SENT_HISTORY ),
+    sent_count_( 0 ),
+    delivered_( 0 ),
+    lost_( 0 ),
+    delivered_time_( 0 ),
+    first_send_time_( 0 ),
+    bottleneck_bandwidth_( BANDWIDTH_WINDOW_ROUNDS ),
+    min_rtt_( MIN_RTT_WINDOW_US ),
+    min_rtt_timestamp_( 0 ),
+    round_count_( 0 ),
+    next_round_delivered_( 0 ),
+    mode_( Mode::Startup ),
+    pacing_gain_( HIGH_GAIN ),
+    window_gain_( HIGH_GAIN ),
+    filled_pipe_( false ),
+    full_bandwidth_( 0 ),
+    full_bandwidth_count_( 0 ),
+    cycle_index_( 0 ),
+    cycle_start_( 0 ),
+    probe_rtt_done_( 0 )
+{}
+
+/* gain times the bandwidth-delay product, in datagrams */
+double BBRController::bdp( const double gain ) const
+{
+  return gain * bottleneck_bandwidth_.best() * min_rtt_.best() / 1000000.0;
+}
+
+unsigned int BBRController::do_window_size( void )
+{
+  if ( bottleneck_bandwidth_.empty() or min_rtt_.empty() ) {
+    return INITIAL_WINDOW;
+  }
+
+  if ( mode_ == Mode::ProbeRTT ) {
+    return MIN_WINDOW;
+  }
+
+  return max( MIN_WINDOW, static_cast<unsigned int>( ceil( bdp( window_gain_ ) ) ) );
+}
+
+double BBRController::do_pacing_rate( void )
+{
+  if ( bottleneck_bandwidth_.empty() ) {
+    return 0.0; /* no delivery-rate sample yet */
+  }
+
+  return pacing_gain_ * bottleneck_bandwidth_.best();
+}
+
+void BBRController::do_datagram_was_sent( const uint64_t sequence_number,
+					  const uint64_t send_timestamp )
+{
+  /* an idle sender starts a new interval */
+  if ( in_flight() == 0 ) {
+    first_send_time_ = send_timestamp;
+  }
+
+  sent_[ sequence_number % SENT_HISTORY ] = { sequence_number, send_timestamp,
+					      first_send_time_, delivered_, delivered_time_ };
+  sent_count_++;
+}
+
+void BBRController::do_ack_received( const uint64_t sequence_number_acked,
+				     const uint64_t send_timestamp_acked,
+				     const uint64_t recv_timestamp_acked,
+				     const uint64_t timestamp_ack_received )
+{
+  const uint64_t now = timestamp_ack_received;
+
+  /* RTT sample */
+  const uint64_t rtt = now - send_timestamp_acked;
+  if ( min_rtt_.empty() or rtt <= min_rtt_.best()
+       or now - min_rtt_timestamp_ > MIN_RTT_WINDOW_US ) {
+    min_rtt_timestamp_ = now;
+  }
+  min_rtt_.update( now, rtt );
+
+  /* delivery-rate sample, from the state when the acked datagram was sent */
+  if ( in_flight() > 0 ) {
+    delivered_++;
+  }
+  delivered_time_ = recv_timestamp_acked;
+
+  const SentDatagram & datagram = sent_[ sequence_number_acked % SENT_HISTORY ];
+  if ( datagram.sequence_number != sequence_number_acked ) {
+    return; /* fell out of the history */
+  }
+
+  first_send_time_ = datagram.send_time;
+
+  /* a new round starts when a datagram sent during this round is acked */
+  if ( datagram.delivered >= next_round_delivered_ ) {
+    next_round_delivered_ = delivered_;
+    round_count_++;
+    check_full_pipe();
+  }
+
+  /* the interval is the longer of the send and ack phases (receiver's clock for acks,
+     so the reverse path doesn't distort it) */
+  const uint64_t send_elapsed = datagram.send_time - datagram.first_send_time;
+  const uint64_t ack_elapsed = recv_timestamp_acked - datagram.delivered_time;
+  const uint64_t interval = max( send_elapsed, ack_elapsed );
+  if ( interval > 0 and datagram.delivered_time > 0 ) {
+    const double rate = (delivered_ - datagram.delivered) * 1000000.0 / interval;
+    bottleneck_bandwidth_.update( round_count_, rate );
+  }
+
+  update_mode( now );
+
+  if ( debug() ) {
+    cerr << "BBR round " << round_count_
+	 << " bandwidth " << bottleneck_bandwidth_.best()
+	 << " min RTT " << min_rtt_.best()
+	 << " in flight " << in_flight() << "\n";
+  }
+}
+
+/* Startup is over once the bandwidth stops growing by 25% a round, three rounds running */
+void BBRController::check_full_pipe( void )
+{
+  if ( filled_pipe_ or bottleneck_bandwidth_.empty() ) {
+    return;
+  }
+
+  if ( bottleneck_bandwidth_.best() >= full_bandwidth_ * 1.25 ) {
+    full_bandwidth_ = bottleneck_bandwidth_.best();
+    full_bandwidth_count_ = 0;
+    return;
+  }
+
+  if ( ++full_bandwidth_count_ >= 3 ) {
+    filled_pipe_ = true;
+  }
+}
+
+void BBRController::enter_probe_bw( const uint64_t now )
+{
+  mode_ = Mode::ProbeBW;
+  window_gain_ = 2.0;
+  cycle_index_ = 2; /* start in a cruising phase (fixed, so runs are reproducible) */
+  cycle_start_ = now;
+  pacing_gain_ = CYCLE_GAINS[ cycle_index_ ];
+}
+
+void BBRController::update_mode( const uint64_t now )
+{
+  switch ( mode_ ) {
+  case Mode::Startup:
+    if ( filled_pipe_ ) {
+      mode_ = Mode::Drain;
+      pacing_gain_ = 1.0 / HIGH_GAIN;
+      window_gain_ = HIGH_GAIN;
+    }
+    break;
+
+  case Mode::Drain:
+    if ( in_flight() <= bdp( 1.0 ) ) {
+      enter_probe_bw( now );
+    }
+    break;
+
+  case Mode::ProbeBW:
+    if ( now - cycle_start_ > min_rtt_.best() ) {
+      cycle_index_ = (cycle_index_ + 1) % CYCLE_LENGTH;
+      cycle_start_ = now;
+      pacing_gain_ = CYCLE_GAINS[ cycle_index_ ];
+    }
+    break;
+
+  case Mode::ProbeRTT:
+    /* hold the small window for a while once the queue has drained */
+    if ( probe_rtt_done_ == 0 and in_flight() <= MIN_WINDOW ) {
+      probe_rtt_done_ = now + PROBE_RTT_DURATION_US;
+    } else if ( probe_rtt_done_ and now > probe_rtt_done_ ) {
+      min_rtt_timestamp_ = now;
+      probe_rtt_done_ = 0;
+      if ( filled_pipe_ ) {
+	enter_probe_bw( now );
+      } else {
+	mode_ = Mode::Startup;
+	pacing_gain_ = window_gain_ = HIGH_GAIN;
+      }
+    }
+    return;
+  }
+
+  /* the min RTT hasn't been refreshed in a whole window: drain the queue to measure it */
+  if ( now - min_rtt_timestamp_ > MIN_RTT_WINDOW_US ) {
+    mode_ = Mode::ProbeRTT;
+    pacing_gain_ = window_gain_ = 1.0;
+    probe_rtt_done_ = 0;
+  }
+}
+
+/* a lost datagram is no longer in flight (the model itself ignores losses) */
+void BBRController::do_datagram_was_lost( const uint64_t, const uint64_t, const uint64_t )
+{
+  if ( in_flight() > 0 ) {
+    lost_++;
+  }
+}
+
+/* the datagrams the sender gave up on after a timeout are no longer in
+   flight (but the rest may still be acked) */
+void BBRController::do_timeout( const uint64_t abandoned )
+{
+  lost_ += min( abandoned, in_flight() );
+}
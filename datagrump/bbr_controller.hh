@@ -0,0 +1,81 @@
+#ifndef BBR_CONTROLLER_HH
+#define BBR_CONTROLLER_HH
+
+#include <vector>
+
+#include "controller.hh"
+#include "windowed_filter.hh"
+
+/* Model-based control in the style of BBR: estimate the bottleneck
+   bandwidth (windowed max of the delivery rate) and the round-trip
+   propagation delay (windowed min of the RTT), then pace at a multiple
+   of the bandwidth and cap the window at a multiple of their product.
+   Cycles through Startup, Drain, ProbeBW and ProbeRTT. */
+
+class BBRController : public Controller
+{
+private:
+  enum class Mode { Startup, Drain, ProbeBW, ProbeRTT };
+
+  /* what the sender's state was when each in-flight datagram was sent,
+     for delivery-rate samples (indexed by sequence number, modulo size) */
+  struct SentDatagram
+  {
+    uint64_t sequence_number;
+    uint64_t send_time;       /* sender's clock */
+    uint64_t first_send_time; /* of the interval this datagram ends */
+    uint64_t delivered;       /* datagrams delivered when this one was sent */
+    uint64_t delivered_time;  /* receiver's clock, at that delivery */
+  };
+
+  std::vector<SentDatagram> sent_;
+
+  /* delivery accounting */
+  uint64_t sent_count_, delivered_, lost_;
+  uint64_t delivered_time_;  /* receiver's clock, at the latest delivery */
+  uint64_t first_send_time_; /* sender's clock, start of the current interval */
+
+  /* the model */
+  WindowedMaxFilter<double> bottleneck_bandwidth_; /* datagrams per second, over rounds */
+  WindowedMinFilter<uint64_t> min_rtt_;           /* microseconds, over time */
+  uint64_t min_rtt_timestamp_;
+
+  /* round trips */
+  uint64_t round_count_, next_round_delivered_;
+
+  /* state machine */
+  Mode mode_;
+  double pacing_gain_, window_gain_;
+  bool filled_pipe_;
+  double full_bandwidth_;
+  unsigned int full_bandwidth_count_;
+  unsigned int cycle_index_;
+  uint64_t cycle_start_;
+  uint64_t probe_rtt_done_;
+
+  uint64_t in_flight( void ) const { return sent_count_ - delivered_ - lost_; }
+  double bdp( const double gain ) const;
+
+  void check_full_pipe( void );
+  void update_mode( const uint64_t now );
+  void enter_probe_bw( const uint64_t now );
+
+protected:
+  unsigned int do_window_size( void ) override;
+  void do_datagram_was_sent( const uint64_t sequence_number,
+			     const uint64_t send_timestamp ) override;
+  void do_ack_received( const uint64_t sequence_number_acked,
+			const uint64_t send_timestamp_acked,
+			const uint64_t recv_timestamp_acked,
+			const uint64_t timestamp_ack_received ) override;
+  void do_datagram_was_lost( const uint64_t sequence_number,
+			     const uint64_t send_timestamp,
+			     const uint64_t timestamp_detected ) override;
+  double do_pacing_rate( void ) override;
+  void do_timeout( const uint64_t abandoned ) override;
+
+public:
+  BBRController( const bool debug );
+};
+
+#endif /* BBR_CONTROLLER_HH */
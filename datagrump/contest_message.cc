@@ -1,84 +1,130 @@
 #include <stdexcept>
+#include <cstring>
+
+#include <endian.h>
 
 #include "contest_message.hh"
 #include "timestamp.hh"
 
 using namespace std;
 
+const size_t ContestMessage::Header::WIRE_SIZE;
+const size_t ContestMessage::AckRecord::WIRE_SIZE;
+
 /* helper to get the nth uint64_t field (in network byte order) */
-uint64_t get_header_field( const size_t n, const string & str )
+static uint64_t get_header_field( const size_t n, const char * data )
 {
-  if ( str.size() < (n + 1) * sizeof( uint64_t ) ) {
+  uint64_t network_order;
+  memcpy( &network_order, data + n * sizeof( network_order ), sizeof( network_order ) );
+  return be64toh( network_order );
+}
+
+/* make sure there is room for a header before parsing it */
+static const char * check_header_length( const char * data, const size_t length )
+{
+  if ( length < ContestMessage::Header::WIRE_SIZE ) {
     throw runtime_error( "contest message too small to contain header" );
   }
 
-  const uint64_t * const data_ptr
-    = reinterpret_cast<const uint64_t *>( str.data() ) + n;
-
-  return be64toh( *data_ptr );
+  return data;
 }
 
 /* Parse header from wire */
+ContestMessage::Header::Header( const char * data, const size_t length )
+  : sequence_number( get_header_field( 0, check_header_length( data, length ) ) ),
+    send_timestamp( get_header_field( 1, data ) ),
+    ack_sequence_number( get_header_field( 2, data ) ),
+    ack_send_timestamp( get_header_field( 3, data ) ),
+    ack_recv_timestamp( get_header_field( 4, data ) ),
+    ack_payload_length( get_header_field( 5, data ) )
+{}
+
 ContestMessage::Header::Header( const string & str )
-  : sequence_number( get_header_field( 0, str ) ),
-    send_timestamp( get_header_field( 1, str ) ),
-    ack_sequence_number( get_header_field( 2, str ) ),
-    ack_send_timestamp( get_header_field( 3, str ) ),
-    ack_recv_timestamp( get_header_field( 4, str ) ),
-    ack_payload_length( get_header_field( 5, str ) )
+  : Header( str.data(), str.size() )
 {}
 
 /* Parse incoming message from wire */
 ContestMessage::ContestMessage( const string & str )
   : header( str ),
-    payload( str.begin() + sizeof( header ), str.end() )
+    payload( str.begin() + Header::WIRE_SIZE, str.end() )
+{}
+
+/* Parse incoming message in place */
+ContestMessageView::ContestMessageView( const char * data, const size_t length )
+  : header( data, length ),
+    payload( data + ContestMessage::Header::WIRE_SIZE ),
+    payload_length( length - ContestMessage::Header::WIRE_SIZE )
 {}
 
+/* Fill in the send_timestamp for an outgoing header */
+void ContestMessage::Header::set_send_timestamp( void )
+{
+  send_timestamp = timestamp_us();
+}
+
 /* Fill in the send_timestamp for an outgoing message */
 void ContestMessage::set_send_timestamp( void )
 {
-  header.send_timestamp = timestamp_ms();
+  header.set_send_timestamp();
 }
 
-/* helper to put a uint64_t field (in network byte order) */
-string put_header_field( const uint64_t n )
+/* helper to put the nth uint64_t field (in network byte order) */
+static void put_header_field( const size_t n, const uint64_t value, char * dest )
 {
-  const uint64_t network_order = htobe64( n );
-  return string( reinterpret_cast<const char *>( &network_order ),
-		 sizeof( network_order ) );
+  const uint64_t network_order = htobe64( value );
+  memcpy( dest + n * sizeof( network_order ), &network_order, sizeof( network_order ) );
+}
+
+/* Write wire representation of header */
+void ContestMessage::Header::serialize( char * dest ) const
+{
+  put_header_field( 0, sequence_number, dest );
+  put_header_field( 1, send_timestamp, dest );
+  put_header_field( 2, ack_sequence_number, dest );
+  put_header_field( 3, ack_send_timestamp, dest );
+  put_header_field( 4, ack_recv_timestamp, dest );
+  put_header_field( 5, ack_payload_length, dest );
 }
 
 /* Make wire representation of header */
 string ContestMessage::Header::to_string( void ) const
 {
-  return put_header_field( sequence_number )
-    + put_header_field( send_timestamp )
-    + put_header_field( ack_sequence_number )
-    + put_header_field( ack_send_timestamp )
-    + put_header_field( ack_recv_timestamp )
-    + put_header_field( ack_payload_length );
+  string ret( WIRE_SIZE, 0 );
+  serialize( &ret[ 0 ] );
+  return ret;
 }
 
 /* Make wire representation of message */
 string ContestMessage::to_string( void ) const
 {
-  return header.to_string() + payload;
+  string ret( Header::WIRE_SIZE + payload.size(), 0 );
+  header.serialize( &ret[ 0 ] );
+  payload.copy( &ret[ Header::WIRE_SIZE ], payload.size() );
+  return ret;
 }
 
-/* Transform into an ack of the ContestMessage */
-void ContestMessage::transform_into_ack( const uint64_t sequence_number,
-					 const uint64_t recv_timestamp )
+/* Transform into the header of an ack */
+void ContestMessage::Header::transform_into_ack( const uint64_t s_sequence_number,
+						 const uint64_t recv_timestamp,
+						 const uint64_t payload_length )
 {
   /* ack the old sequence number */
-  header.ack_sequence_number = header.sequence_number;
+  ack_sequence_number = sequence_number;
 
   /* now assign a new sequence number for the outgoing ack */
-  header.sequence_number = sequence_number;
+  sequence_number = s_sequence_number;
 
   /* ack the other fields */
-  header.ack_send_timestamp = header.send_timestamp;
-  header.ack_recv_timestamp = recv_timestamp;
-  header.ack_payload_length = payload.length();
+  ack_send_timestamp = send_timestamp;
+  ack_recv_timestamp = recv_timestamp;
+  ack_payload_length = payload_length;
+}
+
+/* Transform into an ack of the ContestMessage */
+void ContestMessage::transform_into_ack( const uint64_t sequence_number,
+					 const uint64_t recv_timestamp )
+{
+  header.transform_into_ack( sequence_number, recv_timestamp, payload.length() );
 
   /* delete the payload */
   payload.clear();
@@ -101,8 +147,77 @@ ContestMessage::Header::Header( const uint64_t s_sequence_number )
     ack_payload_length( -1 )
 {}
 
+/* Is this header an ack? */
+bool ContestMessage::Header::is_ack( void ) const
+{
+  return ack_sequence_number != uint64_t( -1 );
+}
+
 /* Is this message an ack? */
 bool ContestMessage::is_ack( void ) const
 {
-  return header.ack_sequence_number != uint64_t( -1 );
+  return header.is_ack();
+}
+
+/* helpers for the 32-bit fields of an ack record (in network byte order) */
+static uint32_t get_record_field( const size_t n, const char * data )
+{
+  uint32_t network_order;
+  memcpy( &network_order, data + n * sizeof( network_order ), sizeof( network_order ) );
+  return be32toh( network_order );
+}
+
+static void put_record_field( const size_t n, const uint32_t value, char * dest )
+{
+  const uint32_t network_order = htobe32( value );
+  memcpy( dest + n * sizeof( network_order ), &network_order, sizeof( network_order ) );
+}
+
+/* difference that fits in a signed 32-bit field */
+static bool fits_in_int32( const uint64_t a, const uint64_t b )
+{
+  const int64_t difference = a - b;
+  return difference >= INT32_MIN and difference <= INT32_MAX;
+}
+
+/* Can this record be encoded relative to the ack? */
+bool ContestMessage::AckRecord::fits( const Header & ack ) const
+{
+  return fits_in_int32( ack.ack_sequence_number, sequence_number )
+    and fits_in_int32( ack.ack_send_timestamp, send_timestamp )
+    and fits_in_int32( ack.ack_recv_timestamp, recv_timestamp )
+    and payload_length <= UINT32_MAX;
+}
+
+/* Write wire representation of record: each field as a (signed)
+   difference from the ack's own fields, except the length */
+void ContestMessage::AckRecord::serialize( const Header & ack, char * dest ) const
+{
+  if ( not fits( ack ) ) {
+    throw runtime_error( "ack record too far from its ack to encode" );
+  }
+
+  put_record_field( 0, ack.ack_sequence_number - sequence_number, dest );
+  put_record_field( 1, ack.ack_send_timestamp - send_timestamp, dest );
+  put_record_field( 2, ack.ack_recv_timestamp - recv_timestamp, dest );
+  put_record_field( 3, payload_length, dest );
+}
+
+/* Parse record from wire */
+ContestMessage::AckRecord ContestMessage::AckRecord::parse( const Header & ack, const char * data )
+{
+  return { ack.ack_sequence_number - int32_t( get_record_field( 0, data ) ),
+	   ack.ack_send_timestamp - int32_t( get_record_field( 1, data ) ),
+	   ack.ack_recv_timestamp - int32_t( get_record_field( 2, data ) ),
+	   get_record_field( 3, data ) };
+}
+
+/* Earlier datagram acknowledged by an aggregated ack */
+ContestMessage::AckRecord ContestMessageView::ack_record( const size_t i ) const
+{
+  if ( i >= ack_record_count() ) {
+    throw out_of_range( "ack record index out of range" );
+  }
+
+  return ContestMessage::AckRecord::parse( header, payload + i * ContestMessage::AckRecord::WIRE_SIZE );
 }
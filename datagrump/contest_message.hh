@@ -4,6 +4,10 @@
 #include <string>
 #include <cstdint>
 
+#include "packet_pool.hh"
+
+/* Datagram of the congestion-control contest
+   (all timestamps are in microseconds) */
 struct ContestMessage
 {
   struct Header {
@@ -15,16 +19,57 @@ struct ContestMessage
     uint64_t ack_recv_timestamp;
     uint64_t ack_payload_length;
 
+    /* Size of header on the wire */
+    static const size_t WIRE_SIZE = 6 * sizeof( uint64_t );
+
     /* Header for new message */
     Header( const uint64_t s_sequence_number );
 
     /* Parse header from wire */
     Header( const std::string & str );
+    Header( const char * data, const size_t length );
+
+    /* Fill in the send_timestamp for an outgoing datagram */
+    void set_send_timestamp( void );
+
+    /* Write wire representation of header into WIRE_SIZE bytes at dest */
+    void serialize( char * dest ) const;
 
     /* Make wire representation of header */
     std::string to_string( void ) const;
+
+    /* Transform into the header of an ack of the datagram */
+    void transform_into_ack( const uint64_t s_sequence_number,
+			     const uint64_t recv_timestamp,
+			     const uint64_t payload_length );
+
+    /* Is this the header of an ack? */
+    bool is_ack( void ) const;
   } header;
 
+  /* An aggregated ack acknowledges several datagrams: the most recent in
+     its header (so it reads as a plain ack), and each earlier one as a
+     record in its payload, encoded compactly relative to the header */
+  struct AckRecord {
+    uint64_t sequence_number;
+    uint64_t send_timestamp;
+    uint64_t recv_timestamp;
+    uint64_t payload_length;
+
+    /* Size of one record on the wire */
+    static const size_t WIRE_SIZE = 4 * sizeof( uint32_t );
+
+    /* Is it close enough (in sequence and time) to the ack's own
+       datagram to be encoded relative to it? */
+    bool fits( const Header & ack ) const;
+
+    /* Write wire representation, relative to ack, into WIRE_SIZE bytes at dest */
+    void serialize( const Header & ack, char * dest ) const;
+
+    /* Parse from wire, relative to the ack that carried it */
+    static AckRecord parse( const Header & ack, const char * data );
+  };
+
   std::string payload;
 
   /* New message */
@@ -48,4 +93,30 @@ struct ContestMessage
   bool is_ack( void ) const;
 };
 
+/* Non-owning view of a datagram on the wire (e.g. in a receive buffer),
+   valid only as long as the buffer it was parsed from */
+struct ContestMessageView
+{
+  ContestMessage::Header header;
+
+  const char * payload;
+  size_t payload_length;
+
+  /* Parse incoming datagram in place */
+  ContestMessageView( const char * data, const size_t length );
+  explicit ContestMessageView( const PacketPool::Buffer & buffer )
+    : ContestMessageView( buffer.data(), buffer.length() ) {}
+
+  /* Is this message an ack? */
+  bool is_ack( void ) const { return header.is_ack(); }
+
+  /* Earlier datagrams acknowledged by an aggregated ack, oldest first */
+  size_t ack_record_count( void ) const
+  {
+    return is_ack() ? payload_length / ContestMessage::AckRecord::WIRE_SIZE : 0;
+  }
+
+  ContestMessage::AckRecord ack_record( const size_t i ) const;
+};
+
 #endif /* CONTEST_MESSAGE_HH */
@@ -1,109 +1,145 @@
+#include <algorithm>
 #include <iostream>
-#include <math.h>
+#include <limits>
+#include <stdexcept>
 
 #include "controller.hh"
+#include "aiad_controller.hh"
+#include "aimd_controller.hh"
+#include "bbr_controller.hh"
+#include "delay_target_controller.hh"
 #include "timestamp.hh"
 
 using namespace std;
 
-/* Default constructor */
-Controller::Controller( const bool debug )
-  : debug_(debug),
-    the_window_size(1.0),
-    num_packets_received(0),
-    first_of_burst(0), 
-    burst_count(1),
-    num_packets_sent(0),
-    last_queue_occ(-1),
-    num_increase(0.0)
+/* the built-in algorithms, by name */
+namespace {
+  struct Algorithm
+  {
+    const char * name;
+    Controller * (*make)( const bool debug, const Controller::Parameters & parameters );
+  };
+
+  const Algorithm algorithm_table[] = {
+    { "aiad", [] ( const bool debug, const Controller::Parameters & parameters ) -> Controller * {
+	return new AIADController( debug, parameters ); } },
+    { "aimd", [] ( const bool debug, const Controller::Parameters & ) -> Controller * {
+	return new AIMDController( debug ); } },
+    { "delay-target", [] ( const bool debug, const Controller::Parameters & ) -> Controller * {
+	return new DelayTargetController( debug ); } },
+    { "bbr", [] ( const bool debug, const Controller::Parameters & ) -> Controller * {
+	return new BBRController( debug ); } },
+  };
+}
+
+const string Controller::default_algorithm = "aiad";
+
+vector<string> Controller::algorithms( void )
 {
-  debug_ = false;
+  vector<string> ret;
+  for ( const auto & algorithm : algorithm_table ) {
+    ret.emplace_back( algorithm.name );
+  }
+  return ret;
 }
 
-/* Get current window size, in datagrams */
-unsigned int Controller::window_size( void )
+unique_ptr<Controller> Controller::make( const string & algorithm, const bool debug,
+					 const Parameters & parameters )
 {
-  if ( debug_ ) {
-    cerr << "At time " << timestamp_ms()
-	 << " window size is " << the_window_size << endl;
+  for ( const auto & candidate : algorithm_table ) {
+    if ( algorithm == candidate.name ) {
+      unique_ptr<Controller> controller( candidate.make( debug, parameters ) );
+
+      /* anything the constructor didn't read was misspelled, or meant for another algorithm */
+      for ( const auto & given : parameters ) {
+	if ( not controller->parameters_.count( given.first ) ) {
+	  throw runtime_error( algorithm + " has no parameter named " + given.first );
+	}
+      }
+
+      return controller;
+    }
   }
 
-  return max((int)the_window_size, 1);
+  throw runtime_error( "unknown congestion-control algorithm: " + algorithm );
 }
 
-/* A datagram was sent */
-void Controller::datagram_was_sent( const uint64_t sequence_number,
-				    /* of the sent datagram */
-				    const uint64_t send_timestamp )
-                                    /* in milliseconds */
+/* Default constructor */
+Controller::Controller( const bool debug )
+  : debug_( debug ),
+    parameters_(),
+    telemetry_( nullptr ),
+    last_window_size_( 0 )
+{}
+
+bool Controller::parse_parameter( const string & option, Parameters & parameters )
 {
-  if ( debug_ ) {
-    cerr << "At time " << send_timestamp
-	 << " sent datagram " << sequence_number << endl;
+  const auto equals = option.find( '=' );
+  if ( option.substr( 0, 3 ) != "cc-" or equals == string::npos ) {
+    return false;
   }
-  num_packets_sent++;
+
+  size_t parsed = 0;
+  const string value = option.substr( equals + 1 );
+  const double number = stod( value, &parsed );
+  if ( parsed != value.size() ) {
+    throw runtime_error( "not a number: " + value );
+  }
+
+  parameters[ option.substr( 3, equals - 3 ) ] = number;
+  return true;
 }
 
-uint64_t abs_(uint64_t first, uint64_t second) 
+double Controller::parameter( const Parameters & given, const string & name,
+			      const double default_value )
 {
-  if (first > second) {
-    return first - second;
-  } else {
-    return second - first;
-  }
+  const auto value = given.find( name );
+  return parameters_[ name ] = value == given.end() ? default_value : value->second;
 }
 
-uint64_t max_(uint64_t first, uint64_t second) 
+uint64_t Controller::duration_parameter_us( const Parameters & given, const string & name,
+					   const double default_ms )
 {
-  return first > second ? first : second;
+  const double us = 1000 * parameter( given, name, default_ms );
+
+  /* (converting anything else to a uint64_t is undefined) */
+  if ( not ( us >= 0 and us < numeric_limits<uint64_t>::max() ) ) {
+    throw runtime_error( "cc-" + name + " must be a nonnegative number of milliseconds" );
+  }
+
+  return us;
 }
 
-uint64_t min_(uint64_t first, uint64_t second) 
+/* Debugging output for window_size() */
+void Controller::print_window_size( const unsigned int the_window_size ) const
 {
-  return first > second ? second : first;
+  cerr << "At time " << timestamp_us()
+       << " window size is " << the_window_size << "\n";
 }
 
-void Controller::delay_aiad_unsmoothedRTT(const uint64_t sequence_number_acked,
-             const uint64_t send_timestamp_acked,
-             const uint64_t recv_timestamp_acked,
-             const uint64_t timestamp_ack_received )
+/* A datagram was sent */
+void Controller::datagram_was_sent( const uint64_t sequence_number,
+				    /* of the sent datagram */
+				    const uint64_t send_timestamp )
+                                    /* in microseconds */
 {
-  uint64_t newRoundTripTime = timestamp_ack_received - send_timestamp_acked;
-  num_packets_received++;
-
-  int newBufferOcc = num_packets_sent - num_packets_received;
-  if (num_packets_received == 1) {
-    // first packet, so start a new burst.
-    first_of_burst = recv_timestamp_acked;
-    if (newRoundTripTime <= 200) {
-      the_window_size += 2.0/window_size();  
-    }
-  } else {
-    if (last_queue_occ < newBufferOcc - 1) {
-      the_window_size -= 3.0/window_size();
-    } else {
-      // keep probing the network during the burst period
-      the_window_size += 2.0/window_size();
-    }
-    if (recv_timestamp_acked <= first_of_burst + 70) {
-      burst_count++;
-    } else {
-      // end of burst
-      // set the new window size to be a a little bit less than the measured value to avoid
-      // overflowing the queue. Smooth the change out with the old window size.
-      double new_window_size = 0.45 * the_window_size + 0.45 * burst_count;
-      the_window_size = new_window_size;
-
-      burst_count = 1;
-      first_of_burst = recv_timestamp_acked;
-    }
+  if ( debug_ ) {
+    cerr << "At time " << send_timestamp
+	 << " sent datagram " << sequence_number << "\n";
   }
-  last_queue_occ = newBufferOcc;
-  if (debug_) {
-    cerr << sequence_number_acked << endl;
+
+  if ( telemetry_ ) {
+    telemetry_->record( TelemetryLog::EventType::Sent, send_timestamp,
+			sequence_number, send_timestamp );
   }
+
+  do_datagram_was_sent( sequence_number, send_timestamp );
 }
 
+/* Default: take no action */
+void Controller::do_datagram_was_sent( const uint64_t, const uint64_t )
+{}
+
 /* An ack was received */
 void Controller::ack_received( const uint64_t sequence_number_acked,
 			       /* what sequence number was acknowledged */
@@ -114,26 +150,73 @@ void Controller::ack_received( const uint64_t sequence_number_acked,
 			       const uint64_t timestamp_ack_received )
                                /* when the ack was received (by sender) */
 {
-  /* Default: take no action */
-  delay_aiad_unsmoothedRTT(sequence_number_acked, send_timestamp_acked, recv_timestamp_acked, timestamp_ack_received);
+  do_ack_received( sequence_number_acked, send_timestamp_acked,
+		   recv_timestamp_acked, timestamp_ack_received );
 
   if ( debug_ ) {
     cerr << "At time " << timestamp_ack_received
 	 << " received ack for datagram " << sequence_number_acked
 	 << " (send @ time " << send_timestamp_acked
 	 << ", received @ time " << recv_timestamp_acked << " by receiver's clock)"
-	 << endl;
+	 << "\n";
+  }
+
+  if ( telemetry_ ) {
+    telemetry_->record( TelemetryLog::EventType::Ack, timestamp_ack_received,
+			sequence_number_acked, send_timestamp_acked,
+			timestamp_ack_received - min( timestamp_ack_received, send_timestamp_acked ) );
   }
 }
 
-void Controller::timeout_( void )
+/* A datagram was judged lost */
+void Controller::datagram_was_lost( const uint64_t sequence_number,
+				    /* of the lost datagram */
+				    const uint64_t send_timestamp,
+				    /* when it was sent */
+				    const uint64_t timestamp_detected )
+                                    /* when the loss was detected */
 {
-  the_window_size -= 1.5/window_size();
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_detected
+	 << " lost datagram " << sequence_number
+	 << " (send @ time " << send_timestamp << ")" << "\n";
+  }
+
+  if ( telemetry_ ) {
+    telemetry_->record( TelemetryLog::EventType::Lost, timestamp_detected,
+			sequence_number, send_timestamp );
+  }
+
+  do_datagram_was_lost( sequence_number, send_timestamp, timestamp_detected );
+}
+
+/* Default: take no action */
+void Controller::do_datagram_was_lost( const uint64_t, const uint64_t, const uint64_t )
+{}
+
+/* Rate at which to release datagrams */
+double Controller::pacing_rate( void )
+{
+  return do_pacing_rate();
 }
 
 /* How long to wait (in milliseconds) if there are no acks
    before sending one more datagram */
 unsigned int Controller::timeout_ms( void )
 {
-  return 150; /* timeout of one second */
+  return do_timeout_ms();
+}
+
+/* No ack arrived within timeout_ms() */
+void Controller::timeout_( const uint64_t abandoned )
+{
+  if ( debug_ ) {
+    cerr << "At time " << timestamp_us() << " timeout" << "\n";
+  }
+
+  if ( telemetry_ ) {
+    telemetry_->record( TelemetryLog::EventType::Timeout, timestamp_us(), 0, 0, abandoned );
+  }
+
+  do_timeout( abandoned );
 }
@@ -3,53 +3,140 @@
 
 #include <cstdint>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "telemetry.hh"
+#include "timestamp.hh"
 
 /* Congestion controller interface */
 
+/* Each algorithm subclasses Controller and fills in the protected hooks;
+   the public methods (called by the sender) handle debugging output
+   and telemetry, and then call the hooks. */
+
 class Controller
 {
+public:
+  /* Tunable constants of an algorithm, by name */
+  typedef std::map<std::string, double> Parameters;
+
 private:
   bool debug_; /* Enables debugging output */
-  double the_window_size;
-  uint64_t num_packets_received;
-  uint64_t first_of_burst;
-  uint64_t burst_count;
 
-  uint64_t num_packets_sent;
-  int last_queue_occ;
-  int num_increase;
+  Parameters parameters_; /* the value in use of each tunable constant */
+
+  /* Where to record events, if anywhere, and the window last recorded */
+  TelemetryLog * telemetry_;
+  unsigned int last_window_size_;
 
-  /* Add member variables here */
-  void delay_aiad_unsmoothedRTT(const uint64_t sequence_number_acked,
-             const uint64_t send_timestamp_acked,
-             const uint64_t recv_timestamp_acked,
-             const uint64_t timestamp_ack_received );
+  /* kept out of line, so the per-packet calls stay small */
+  void print_window_size( const unsigned int the_window_size ) const;
+
+protected:
+  /* Hooks for each algorithm */
+  virtual unsigned int do_window_size( void ) = 0;
+  virtual void do_datagram_was_sent( const uint64_t sequence_number,
+				     const uint64_t send_timestamp );
+  virtual void do_ack_received( const uint64_t sequence_number_acked,
+				const uint64_t send_timestamp_acked,
+				const uint64_t recv_timestamp_acked,
+				const uint64_t timestamp_ack_received ) = 0;
+  virtual void do_datagram_was_lost( const uint64_t sequence_number,
+				     const uint64_t send_timestamp,
+				     const uint64_t timestamp_detected );
+  virtual double do_pacing_rate( void ) { return 0.0; }
+  virtual unsigned int do_timeout_ms( void ) { return 150; }
+  virtual void do_timeout( const uint64_t ) {}
+
+  bool debug( void ) const { return debug_; }
+
+  /* The value of a tunable constant: as given to make(), or else its
+     default (each algorithm reads all of its own in its constructor) */
+  double parameter( const Parameters & given, const std::string & name,
+		    const double default_value );
+
+  /* the same, for a length of time given in milliseconds, in microseconds
+     (throws unless it is nonnegative and that many fit in a uint64_t) */
+  uint64_t duration_parameter_us( const Parameters & given, const std::string & name,
+				  const double default_ms );
 
 public:
   /* Public interface for the congestion controller */
-  /* You can change these if you prefer, but will need to change
-     the call site as well (in sender.cc) */
 
   /* Default constructor */
   Controller( const bool debug );
 
-  /* Get current window size, in datagrams */
-  unsigned int window_size( void );
+  virtual ~Controller() {}
+
+  /* Get current window size, in datagrams
+     (called for every datagram, so inline) */
+  unsigned int window_size( void )
+  {
+    const unsigned int the_window_size = do_window_size();
+    if ( debug_ ) {
+      print_window_size( the_window_size );
+    }
+    if ( telemetry_ and the_window_size != last_window_size_ ) {
+      last_window_size_ = the_window_size;
+      telemetry_->record( TelemetryLog::EventType::Window, timestamp_us(),
+			  0, 0, the_window_size );
+    }
+    return the_window_size;
+  }
 
   /* A datagram was sent */
   void datagram_was_sent( const uint64_t sequence_number,
 			  const uint64_t send_timestamp );
 
-  /* An ack was received */
+  /* An ack was received (all timestamps in microseconds) */
   void ack_received( const uint64_t sequence_number_acked,
 		     const uint64_t send_timestamp_acked,
 		     const uint64_t recv_timestamp_acked,
 		     const uint64_t timestamp_ack_received );
 
+  /* A datagram was judged lost by the sender's loss detection
+     (as opposed to a timeout, when nothing at all was heard) */
+  void datagram_was_lost( const uint64_t sequence_number,
+			  const uint64_t send_timestamp,
+			  const uint64_t timestamp_detected );
+
+  /* Rate at which to release datagrams, in datagrams per second
+     (or 0 to send as soon as the window allows) */
+  double pacing_rate( void );
+
   /* How long to wait (in milliseconds) if there are no acks
      before sending one more datagram */
   unsigned int timeout_ms( void );
-  void timeout_( void );
+
+  /* No ack arrived within timeout_ms(), and the sender gave up on
+     (and marked lost) this many datagrams that were still in flight */
+  void timeout_( const uint64_t abandoned = 0 );
+
+  /* Registry of the built-in algorithms */
+  static const std::string default_algorithm;
+  static std::vector<std::string> algorithms( void );
+
+  /* Make a controller by name, with any of its tunable constants set
+     (throws if there is no such algorithm, or it has no such constant) */
+  static std::unique_ptr<Controller> make( const std::string & algorithm,
+					   const bool debug,
+					   const Parameters & parameters = Parameters() );
+
+  /* Record every event in a log (which must outlive the controller) */
+  void set_telemetry( TelemetryLog * const telemetry ) { telemetry_ = telemetry; }
+
+  /* Every tunable constant of the algorithm, with the value in use */
+  const Parameters & parameters( void ) const { return parameters_; }
+
+  /* Read a command-line option of the form cc-NAME=VALUE into parameters
+     (returns false if the option isn't one; throws if the value is bad) */
+  static bool parse_parameter( const std::string & option, Parameters & parameters );
+
+  /* forbid copying controllers */
+  Controller( const Controller & other ) = delete;
+  const Controller & operator=( const Controller & other ) = delete;
 };
 
 #endif
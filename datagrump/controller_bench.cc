@@ -0,0 +1,393 @@
+/* micro-benchmark for congestion controllers: feeds a stream of send and
+   ack events straight into a Controller (no sockets, no clock) and reports
+   the CPU time and heap allocations per ack, plus the window it chose */
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "controller.hh"
+#include "link_queue.hh"
+
+using namespace std;
+
+/* every heap allocation in this program is counted */
+static uint64_t allocation_count = 0;
+
+void * operator new( size_t size )
+{
+  allocation_count++;
+  void * ret = malloc( size ? size : 1 );
+  if ( not ret ) {
+    throw bad_alloc();
+  }
+  return ret;
+}
+
+/* (the replacement operator new above uses malloc, so free is right here) */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete( void * ptr ) noexcept
+{
+  free( ptr );
+}
+#pragma GCC diagnostic pop
+
+/* what the sender tells its controller, in order */
+struct Event
+{
+  enum class Type : uint8_t { Sent, Ack, Lost, Timeout } type;
+  uint64_t sequence_number, time; /* time: sent, ack received, loss detected, or timed out */
+  uint64_t send_timestamp, recv_timestamp; /* acks (and send_timestamp for losses) only */
+};
+
+/* bottleneck of the synthetic network: a constant rate, or a mahimahi
+   trace with one datagram per delivery opportunity */
+class SyntheticLink
+{
+private:
+  uint64_t service_us_;
+  shared_ptr<const PacketTrace> trace_;
+  size_t next_opportunity_;
+  uint64_t repetitions_;
+  uint64_t free_at_;
+
+  uint64_t opportunity_time( void ) const
+  {
+    return ( repetitions_ * trace_->period_ms()
+	     + trace_->opportunities_ms()[ next_opportunity_ ] ) * 1000;
+  }
+
+  void next_opportunity( void )
+  {
+    if ( ++next_opportunity_ == trace_->opportunities_ms().size() ) {
+      next_opportunity_ = 0;
+      repetitions_++;
+    }
+  }
+
+public:
+  SyntheticLink( const double rate_mbps, const string & trace_name )
+    : service_us_( max( uint64_t( 1 ), uint64_t( PacketTrace::PACKET_SIZE * 8 / rate_mbps ) ) ),
+      trace_( trace_name.empty() ? nullptr : make_shared<PacketTrace>( trace_name ) ),
+      next_opportunity_( 0 ),
+      repetitions_( 0 ),
+      free_at_( 0 )
+  {}
+
+  /* when a datagram reaching the bottleneck at arrival has crossed it */
+  uint64_t delivery_time( const uint64_t arrival )
+  {
+    if ( not trace_ ) {
+      free_at_ = max( arrival, free_at_ ) + service_us_;
+      return free_at_;
+    }
+
+    /* skip opportunities that went unused */
+    while ( opportunity_time() < arrival ) {
+      next_opportunity();
+    }
+
+    /* use up this one */
+    const uint64_t ret = opportunity_time();
+    next_opportunity();
+    return ret;
+  }
+};
+
+/* run a controller in closed loop against the synthetic network,
+   recording what it is told */
+vector<Event> synthesize( const string & algorithm, SyntheticLink && link,
+			  const uint64_t rtt_us, const uint64_t ack_count )
+{
+  vector<Event> events;
+  deque<Event> acks_in_flight; /* in order of arrival */
+
+  const auto controller = Controller::make( algorithm, false );
+
+  uint64_t now = 0, next_release = 0;
+  uint64_t sequence_number = 0, next_ack_expected = 0, acks = 0;
+
+  auto send = [&] () {
+    events.push_back( { Event::Type::Sent, sequence_number, now, 0, 0 } );
+    controller->datagram_was_sent( sequence_number, now );
+
+    const uint64_t recv_timestamp = link.delivery_time( now + rtt_us / 2 );
+    acks_in_flight.push_back( { Event::Type::Ack, sequence_number,
+				recv_timestamp + rtt_us / 2, now, recv_timestamp } );
+    sequence_number++;
+
+    const double rate = controller->pacing_rate();
+    next_release = rate > 0 ? now + uint64_t( 1000000 / rate ) : now;
+  };
+
+  auto window_is_open = [&] () {
+    return sequence_number - next_ack_expected < controller->window_size();
+  };
+
+  while ( acks < ack_count ) {
+    while ( window_is_open() and next_release <= now ) {
+      send();
+    }
+
+    if ( acks_in_flight.empty() ) {
+      if ( window_is_open() ) {
+	/* waiting only on pacing */
+	now = next_release;
+      } else {
+	/* nothing will arrive: time out and send one */
+	now += controller->timeout_ms() * uint64_t( 1000 );
+	events.push_back( { Event::Type::Timeout, 0, now, 0, 0 } );
+	controller->timeout_();
+	send();
+      }
+      continue;
+    }
+
+    now = acks_in_flight.front().time;
+    if ( window_is_open() ) {
+      now = min( now, next_release );
+    }
+
+    while ( not acks_in_flight.empty() and acks_in_flight.front().time <= now ) {
+      const Event & ack = acks_in_flight.front();
+      events.push_back( ack );
+      controller->ack_received( ack.sequence_number, ack.send_timestamp,
+				ack.recv_timestamp, ack.time );
+      next_ack_expected = ack.sequence_number + 1;
+      acks++;
+      acks_in_flight.pop_front();
+    }
+  }
+
+  return events;
+}
+
+/* the events in a sender's debug output (stderr of "sender ... debug") */
+vector<Event> read_debug_log( const string & filename )
+{
+  ifstream log( filename );
+  if ( not log.good() ) {
+    throw runtime_error( filename + ": error opening for reading" );
+  }
+
+  vector<Event> events;
+  string line;
+  while ( getline( log, line ) ) {
+    Event event { Event::Type::Sent, 0, 0, 0, 0 };
+    if ( sscanf( line.c_str(), "At time %" SCNu64 " received ack for datagram %" SCNu64
+		 " (send @ time %" SCNu64 ", received @ time %" SCNu64,
+		 &event.time, &event.sequence_number,
+		 &event.send_timestamp, &event.recv_timestamp ) == 4 ) {
+      event.type = Event::Type::Ack;
+    } else if ( sscanf( line.c_str(), "At time %" SCNu64 " lost datagram %" SCNu64
+			" (send @ time %" SCNu64,
+			&event.time, &event.sequence_number, &event.send_timestamp ) == 3 ) {
+      event.type = Event::Type::Lost;
+    } else if ( sscanf( line.c_str(), "At time %" SCNu64 " sent datagram %" SCNu64,
+			&event.time, &event.sequence_number ) == 2 ) {
+      event.type = Event::Type::Sent;
+    } else if ( line.find( " timeout" ) != string::npos
+		and sscanf( line.c_str(), "At time %" SCNu64, &event.time ) == 1 ) {
+      event.type = Event::Type::Timeout;
+    } else {
+      continue;
+    }
+    events.push_back( event );
+  }
+
+  if ( events.empty() ) {
+    throw runtime_error( filename + ": no send or ack events found" );
+  }
+
+  return events;
+}
+
+/* the controller's choices after one ack */
+struct Sample
+{
+  uint64_t time;
+  unsigned int window;
+  double pacing_rate;
+};
+
+/* feed the events to a controller, querying it after each ack the way
+   the sender does; returns a checksum of the answers */
+double replay( Controller & controller, const vector<Event> & events,
+	       vector<Sample> * const trajectory )
+{
+  double checksum = 0;
+
+  for ( const auto & event : events ) {
+    switch ( event.type ) {
+    case Event::Type::Sent:
+      controller.datagram_was_sent( event.sequence_number, event.time );
+      break;
+    case Event::Type::Ack:
+      {
+	controller.ack_received( event.sequence_number, event.send_timestamp,
+				 event.recv_timestamp, event.time );
+	const unsigned int window = controller.window_size();
+	const double rate = controller.pacing_rate();
+	checksum += window + rate;
+	if ( trajectory ) {
+	  trajectory->push_back( { event.time, window, rate } );
+	}
+      }
+      break;
+    case Event::Type::Lost:
+      controller.datagram_was_lost( event.sequence_number, event.send_timestamp, event.time );
+      break;
+    case Event::Type::Timeout:
+      controller.timeout_();
+      break;
+    }
+  }
+
+  return checksum;
+}
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " [cc=ALGORITHM|all] [acks=N] [rtt=MS] [rate=MBPS] [trace=FILE]"
+       << " [log=SENDER_DEBUG_LOG] [repeat=N] [trajectory=FILE]" << endl;
+  cerr << "Algorithms:";
+  for ( const auto & name : Controller::algorithms() ) {
+    cerr << " " << name;
+  }
+  cerr << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  string algorithm = "all", trace_name, log_name, trajectory_name;
+  uint64_t ack_count = 200000, rtt_ms = 40, repeat = 5;
+  double rate_mbps = 12;
+
+  for ( int i = 1; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    const size_t equals = option.find( '=' );
+    const string key = option.substr( 0, equals );
+    const string value = equals == string::npos ? "" : option.substr( equals + 1 );
+
+    if ( key == "cc" ) {
+      algorithm = value;
+    } else if ( key == "acks" ) {
+      ack_count = stoull( value );
+    } else if ( key == "rtt" ) {
+      rtt_ms = stoull( value );
+    } else if ( key == "rate" ) {
+      rate_mbps = stod( value );
+    } else if ( key == "trace" ) {
+      trace_name = value;
+    } else if ( key == "log" ) {
+      log_name = value;
+    } else if ( key == "repeat" ) {
+      repeat = max( uint64_t( 1 ), uint64_t( stoull( value ) ) );
+    } else if ( key == "trajectory" ) {
+      trajectory_name = value;
+    } else {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( rate_mbps <= 0 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  const vector<string> algorithms = algorithm == "all"
+    ? Controller::algorithms() : vector<string> { algorithm };
+
+  /* a recorded stream is replayed open-loop into every algorithm */
+  const vector<Event> recorded = log_name.empty() ? vector<Event>() : read_debug_log( log_name );
+
+  unique_ptr<ofstream> trajectory_file;
+  if ( not trajectory_name.empty() ) {
+    trajectory_file.reset( new ofstream( trajectory_name ) );
+    if ( not trajectory_file->good() ) {
+      throw runtime_error( trajectory_name + ": error opening for writing" );
+    }
+    *trajectory_file << "# algorithm time_ms window pacing_rate" << "\n";
+  }
+
+  cout << left << setw( 14 ) << "algorithm" << right
+       << setw( 10 ) << "acks" << setw( 10 ) << "ns/ack" << setw( 12 ) << "allocs/ack"
+       << setw( 13 ) << "mean window" << setw( 14 ) << "final window" << "\n";
+
+  for ( const auto & name : algorithms ) {
+    const vector<Event> events = log_name.empty()
+      ? synthesize( name, SyntheticLink( rate_mbps, trace_name ), rtt_ms * 1000, ack_count )
+      : recorded;
+
+    vector<Sample> trajectory;
+    trajectory.reserve( events.size() );
+
+    {
+      const auto controller = Controller::make( name, false );
+      replay( *controller, events, &trajectory );
+    }
+
+    /* best of several timed runs, each with a fresh controller */
+    double best_ns = numeric_limits<double>::max(), checksum = 0;
+    uint64_t allocations = 0;
+
+    for ( uint64_t run = 0; run < repeat; run++ ) {
+      const auto controller = Controller::make( name, false );
+
+      const uint64_t allocations_before = allocation_count;
+      const auto start = chrono::steady_clock::now();
+      checksum += replay( *controller, events, nullptr );
+      const auto end = chrono::steady_clock::now();
+      allocations = allocation_count - allocations_before;
+
+      best_ns = min( best_ns, double( chrono::duration_cast<chrono::nanoseconds>( end - start ).count() ) );
+    }
+
+    const uint64_t acks = trajectory.size();
+    double window_sum = 0;
+    for ( const auto & sample : trajectory ) {
+      window_sum += sample.window;
+    }
+
+    cout << left << setw( 14 ) << name << right << fixed
+	 << setw( 10 ) << acks
+	 << setprecision( 1 ) << setw( 10 ) << ( acks ? best_ns / acks : 0.0 )
+	 << setprecision( 3 ) << setw( 12 ) << ( acks ? double( allocations ) / acks : 0.0 )
+	 << setprecision( 1 ) << setw( 13 ) << ( acks ? window_sum / acks : 0.0 )
+	 << setw( 14 ) << ( acks ? trajectory.back().window : 0 ) << "\n";
+
+    if ( trajectory_file ) {
+      for ( const auto & sample : trajectory ) {
+	*trajectory_file << name << " " << sample.time / 1000.0 << " "
+			 << sample.window << " " << sample.pacing_rate << "\n";
+      }
+    }
+
+    /* keep the timed work from being optimized away */
+    if ( checksum < 0 ) {
+      cerr << checksum << endl;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
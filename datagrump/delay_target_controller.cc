@@ -0,0 +1,69 @@
+#include <algorithm>
+
+#include "delay_target_controller.hh"
+
+using namespace std;
+
+/* queueing delay to aim for */
+static const double TARGET_DELAY_US = 50 * 1000;
+
+/* datagrams of window change per window acked, at full distance from the target */
+static const double GAIN = 1.0;
+
+/* how much faster than one window per RTT to pace, so the window can still fill */
+static const double PACING_GAIN = 1.25;
+
+DelayTargetController::DelayTargetController( const bool debug )
+  : Controller( debug ),
+    window_( 2.0 ),
+    min_rtt_us_( -1 ),
+    smoothed_rtt_us_( 0.0 ),
+    recovery_start_( 0 )
+{}
+
+unsigned int DelayTargetController::do_window_size( void )
+{
+  return max( 1u, static_cast<unsigned int>( window_ ) );
+}
+
+void DelayTargetController::do_ack_received( const uint64_t,
+					     const uint64_t send_timestamp_acked,
+					     const uint64_t,
+					     const uint64_t timestamp_ack_received )
+{
+  const uint64_t rtt = timestamp_ack_received - send_timestamp_acked;
+
+  min_rtt_us_ = min( min_rtt_us_, rtt );
+  smoothed_rtt_us_ = smoothed_rtt_us_ == 0.0 ? rtt : 0.875 * smoothed_rtt_us_ + 0.125 * rtt;
+
+  /* positive while under the target, negative (without bound) while over */
+  const double off_target = (TARGET_DELAY_US - (rtt - min_rtt_us_)) / TARGET_DELAY_US;
+
+  window_ = max( 1.0, window_ + GAIN * off_target / window_ );
+}
+
+void DelayTargetController::do_datagram_was_lost( const uint64_t,
+						  const uint64_t send_timestamp,
+						  const uint64_t timestamp_detected )
+{
+  if ( send_timestamp < recovery_start_ ) {
+    return;
+  }
+
+  window_ = max( 1.0, window_ / 2.0 );
+  recovery_start_ = timestamp_detected;
+}
+
+double DelayTargetController::do_pacing_rate( void )
+{
+  if ( smoothed_rtt_us_ == 0.0 ) {
+    return 0.0; /* no RTT sample yet */
+  }
+
+  return PACING_GAIN * window_ * 1000000.0 / max( smoothed_rtt_us_, 1.0 );
+}
+
+void DelayTargetController::do_timeout( const uint64_t )
+{
+  window_ = max( 1.0, window_ / 2.0 );
+}
@@ -0,0 +1,37 @@
+#ifndef DELAY_TARGET_CONTROLLER_HH
+#define DELAY_TARGET_CONTROLLER_HH
+
+#include "controller.hh"
+
+/* Delay target (in the style of LEDBAT): grow the window while the
+   queueing delay (RTT above the smallest RTT seen) is under a target,
+   and shrink it in proportion to how far the delay is over; halve it
+   on a loss (at most once per window of data) or a timeout */
+
+class DelayTargetController : public Controller
+{
+private:
+  double window_;
+  uint64_t min_rtt_us_;
+  double smoothed_rtt_us_;
+
+  /* losses of datagrams sent before this belong to the last reduction */
+  uint64_t recovery_start_;
+
+protected:
+  unsigned int do_window_size( void ) override;
+  void do_ack_received( const uint64_t sequence_number_acked,
+			const uint64_t send_timestamp_acked,
+			const uint64_t recv_timestamp_acked,
+			const uint64_t timestamp_ack_received ) override;
+  void do_datagram_was_lost( const uint64_t sequence_number,
+			     const uint64_t send_timestamp,
+			     const uint64_t timestamp_detected ) override;
+  double do_pacing_rate( void ) override;
+  void do_timeout( const uint64_t abandoned ) override;
+
+public:
+  DelayTargetController( const bool debug );
+};
+
+#endif /* DELAY_TARGET_CONTROLLER_HH */
@@ -0,0 +1,250 @@
+/* trace-driven link emulator: relays datagrams between a sender and a
+   receiver through an emulated bottleneck in each direction */
+
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+
+#include "socket.hh"
+#include "poller.hh"
+#include "stats.hh"
+#include "timestamp.hh"
+#include "link_queue.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* most datagrams to move with one system call */
+static const size_t BATCH_SIZE = 64;
+
+/* largest datagram to relay (well above the contest's, but nothing like
+   the 64 KiB a UDP datagram can reach, since the queues hold slots this
+   big); bigger ones are dropped and counted */
+static const size_t MTU = 2048;
+
+/* IPv4 and UDP headers, which take up room on the emulated link too */
+static const size_t HEADER_OVERHEAD = 28;
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " LISTEN_PORT RECEIVER_HOST RECEIVER_PORT UPLINK_TRACE DOWNLINK_TRACE"
+       << " [delay=MS] [queue=PACKETS] [uplink-log=FILE] [downlink-log=FILE] [once] [io_uring] [stats]" << endl;
+}
+
+/* open a log file, if one was requested */
+unique_ptr<ofstream> open_log( const string & filename )
+{
+  if ( filename.empty() ) {
+    return nullptr;
+  }
+
+  unique_ptr<ofstream> log( new ofstream( filename ) );
+  if ( not log->good() ) {
+    throw runtime_error( filename + ": error opening for writing" );
+  }
+
+  return log;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc < 6 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  uint64_t delay_ms = 0;
+  size_t queue_limit = 0;
+  string uplink_log_name, downlink_log_name;
+  bool once = false, io_uring = false, stats = false;
+
+  for ( int i = 6; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option.substr( 0, 6 ) == "delay=" ) {
+      delay_ms = stoull( option.substr( 6 ) );
+    } else if ( option.substr( 0, 6 ) == "queue=" ) {
+      queue_limit = stoull( option.substr( 6 ) );
+    } else if ( option.substr( 0, 11 ) == "uplink-log=" ) {
+      uplink_log_name = option.substr( 11 );
+    } else if ( option.substr( 0, 13 ) == "downlink-log=" ) {
+      downlink_log_name = option.substr( 13 );
+    } else if ( option == "once" ) {
+      /* exit once the uplink trace has played all the way through */
+      once = true;
+    } else if ( option == "io_uring" ) {
+      io_uring = true;
+    } else if ( option == "stats" ) {
+      /* print the event loop's statistics on SIGUSR1 and at exit */
+      stats = true;
+    } else {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( stats ) {
+    Stats::dump_on_signal();
+  }
+
+  if ( io_uring and not IOUring::available() ) {
+    cerr << "io_uring is not available; falling back to poll." << endl;
+    io_uring = false;
+  }
+
+  string command_line;
+  for ( int i = 0; i < argc; i++ ) {
+    command_line += (i ? " " : "") + string( argv[ i ] );
+  }
+
+  /* socket facing the sender, which learns the sender's address from its first datagram */
+  UDPSocket sender_socket;
+  sender_socket.bind( Address( "::0", argv[ 1 ] ) );
+  Address sender_address;
+  bool sender_known = false;
+
+  /* socket facing the receiver */
+  UDPSocket receiver_socket;
+  receiver_socket.connect( Address( argv[ 2 ], argv[ 3 ] ) );
+
+  if ( io_uring ) {
+    sender_socket.set_io_uring_sends();
+    receiver_socket.set_io_uring_sends();
+  }
+
+  cerr << "Listening on " << sender_socket.local_address().to_string()
+       << ", relaying to " << receiver_socket.peer_address().to_string() << endl;
+
+  /* a datagram stays in the slot it was received into until it is sent
+     on (so the pool has to outlive the links) */
+  PacketPool pool( MTU );
+
+  /* the emulated link in each direction */
+  const uint64_t start_time = timestamp_us();
+
+  auto uplink_log = open_log( uplink_log_name ), downlink_log = open_log( downlink_log_name );
+
+  LinkQueue uplink( make_shared<PacketTrace>( argv[ 4 ] ), start_time,
+		    delay_ms * 1000, queue_limit, uplink_log.get() );
+  LinkQueue downlink( make_shared<PacketTrace>( argv[ 5 ] ), start_time,
+		      delay_ms * 1000, queue_limit, downlink_log.get() );
+
+  const uint64_t init_timestamp_ms = time( nullptr ) * uint64_t( 1000 );
+  uplink.log_header( command_line, init_timestamp_ms );
+  downlink.log_header( command_line, init_timestamp_ms );
+
+  /* storage for datagrams coming in, and going out, each way */
+  UDPSocket::RecvBatch from_sender( BATCH_SIZE, pool ), from_receiver( BATCH_SIZE, pool );
+  UDPSocket::SendBatch to_receiver( BATCH_SIZE, pool ), to_sender( BATCH_SIZE, pool );
+
+  /* hand packets coming out of each link to their destination */
+  const LinkQueue::DeliveryCallback deliver_to_receiver = [&] ( const uint64_t, LinkQueue::Packet & packet ) {
+    to_receiver.append( move( packet.contents ) );
+    if ( to_receiver.full() ) {
+      receiver_socket.send_batch( to_receiver );
+    }
+  };
+
+  const LinkQueue::DeliveryCallback deliver_to_sender = [&] ( const uint64_t, LinkQueue::Packet & packet ) {
+    to_sender.append( sender_address, move( packet.contents ) );
+    if ( to_sender.full() ) {
+      sender_socket.send_batch( to_sender );
+    }
+  };
+
+  /* run both links up to the present */
+  auto advance_links = [&] () {
+    const uint64_t now = timestamp_us();
+
+    uplink.advance( now, deliver_to_receiver );
+    downlink.advance( now, deliver_to_sender );
+
+    receiver_socket.send_batch( to_receiver );
+    sender_socket.send_batch( to_sender );
+  };
+
+  Poller poller( io_uring ? Poller::Backend::IOUring : Poller::Backend::Poll );
+
+  /* say so when datagrams too big to relay turn up (at 1, 2, 4, ... of them) */
+  uint64_t next_oversized_report = 1;
+  const auto report_oversized = [&] () {
+    const uint64_t oversized = from_sender.oversized() + from_receiver.oversized();
+    if ( oversized >= next_oversized_report ) {
+      cerr << "Dropped " << oversized << " datagram" << ( oversized > 1 ? "s" : "" )
+	   << " over " << MTU << " bytes." << endl;
+      while ( next_oversized_report <= oversized ) {
+	next_oversized_report *= 2;
+      }
+    }
+  };
+
+  /* first rule: datagrams from the sender enter the uplink */
+  poller.add_datagram_action( sender_socket, from_sender, [&] () {
+      const uint64_t now = timestamp_us();
+      for ( size_t i = 0; i < from_sender.size(); i++ ) {
+	if ( not sender_known ) {
+	  sender_address = from_sender.source_address( i );
+	  sender_known = true;
+	  cerr << "Sender is " << sender_address.to_string() << endl;
+	}
+
+	uplink.send( now, { from_sender.payload_length( i ) + HEADER_OVERHEAD, from_sender.take( i ) } );
+      }
+      report_oversized();
+      return ResultType::Continue;
+    } );
+
+  /* second rule: datagrams from the receiver enter the downlink */
+  poller.add_datagram_action( receiver_socket, from_receiver, [&] () {
+      const uint64_t now = timestamp_us();
+      for ( size_t i = 0; i < from_receiver.size(); i++ ) {
+	/* nowhere to deliver until the sender has been heard from */
+	if ( sender_known ) {
+	  downlink.send( now, { from_receiver.payload_length( i ) + HEADER_OVERHEAD,
+				from_receiver.take( i ) } );
+	}
+      }
+      report_oversized();
+      return ResultType::Continue;
+    } );
+
+  /* wake up for the next thing either link has to do */
+  uint64_t timer_id = 0, timer_deadline = numeric_limits<uint64_t>::max();
+
+  while ( true ) {
+    advance_links();
+
+    if ( once and uplink.trace_finished() ) {
+      cerr << "Uplink trace finished." << endl;
+      return EXIT_SUCCESS;
+    }
+
+    const uint64_t next_event = min( uplink.next_event_time(), downlink.next_event_time() );
+    if ( next_event != timer_deadline ) {
+      poller.cancel_timer( timer_id );
+      timer_deadline = next_event;
+
+      if ( next_event != numeric_limits<uint64_t>::max() ) {
+	const uint64_t now = timestamp_us();
+	timer_id = poller.add_timer( next_event > now ? next_event - now : 0, [&] () {
+	    timer_deadline = numeric_limits<uint64_t>::max();
+	    return ResultType::Continue;
+	  } );
+      }
+    }
+
+    /* with "once", wake up at least every second to notice the end of the trace */
+    const auto ret = poller.poll( once ? 1000 : -1 );
+    if ( ret.result == PollResult::Exit ) {
+      return ret.exit_status;
+    }
+  }
+}
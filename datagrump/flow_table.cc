@@ -0,0 +1,172 @@
+#include <utility>
+
+#include "flow_table.hh"
+
+using namespace std;
+
+constexpr double FlowTable::MAX_LOAD;
+
+void FlowTable::Flow::datagram_received( const uint64_t sequence_number,
+					 const uint64_t length,
+					 const uint64_t now )
+{
+  if ( datagrams == 0 ) {
+    highest_sequence_number = sequence_number;
+  } else if ( sequence_number > highest_sequence_number ) {
+    /* skipped ahead: whatever is in between is missing, for now */
+    lost += sequence_number - highest_sequence_number - 1;
+    highest_sequence_number = sequence_number;
+  } else {
+    /* late (or duplicate) */
+    reordered++;
+    if ( lost > 0 ) {
+      lost--;
+    }
+  }
+
+  datagrams++;
+  bytes += length;
+  last_seen = now;
+}
+
+FlowTable::FlowTable( const size_t initial_capacity )
+  : tags_(),
+    slots_(),
+    size_( 0 )
+{
+  /* round up to a power of two */
+  size_t capacity = 16;
+  while ( capacity < initial_capacity ) {
+    capacity *= 2;
+  }
+
+  tags_.resize( capacity );
+  slots_.resize( capacity );
+}
+
+FlowTable::Flow & FlowTable::find_or_insert( const Address::Key & key, const uint64_t now )
+{
+  if ( size_ + 1 > MAX_LOAD * capacity() ) {
+    grow();
+  }
+
+  const uint64_t hash = key.hash();
+  const uint32_t key_tag = tag( hash );
+
+  size_t i = hash & mask();
+  while ( tags_[ i ] ) {
+    if ( tags_[ i ] == key_tag and slots_[ i ].key == key ) {
+      return slots_[ i ].flow;
+    }
+    i = ( i + 1 ) & mask();
+  }
+
+  /* a new flow */
+  tags_[ i ] = key_tag;
+  slots_[ i ] = Slot( key, { 0, 0, 0, 0, 0, 0, now, now, 0 } );
+  size_++;
+
+  return slots_[ i ].flow;
+}
+
+const FlowTable::Flow * FlowTable::find( const Address::Key & key ) const
+{
+  const uint64_t hash = key.hash();
+  const uint32_t key_tag = tag( hash );
+
+  for ( size_t i = hash & mask(); tags_[ i ]; i = ( i + 1 ) & mask() ) {
+    if ( tags_[ i ] == key_tag and slots_[ i ].key == key ) {
+      return &slots_[ i ].flow;
+    }
+  }
+
+  return nullptr;
+}
+
+FlowTable::Flow * FlowTable::find( const Address::Key & key )
+{
+  return const_cast<Flow *>( static_cast<const FlowTable &>( *this ).find( key ) );
+}
+
+bool FlowTable::erase( const Address::Key & key )
+{
+  const uint64_t hash = key.hash();
+  const uint32_t key_tag = tag( hash );
+
+  for ( size_t i = hash & mask(); tags_[ i ]; i = ( i + 1 ) & mask() ) {
+    if ( tags_[ i ] == key_tag and slots_[ i ].key == key ) {
+      erase_slot( i );
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* empty a slot, then pull back any later entries of the same run that
+   may now sit closer to their home slot, so probes never need tombstones */
+void FlowTable::erase_slot( size_t hole )
+{
+  for ( size_t i = ( hole + 1 ) & mask(); tags_[ i ]; i = ( i + 1 ) & mask() ) {
+    const size_t home = slots_[ i ].key.hash() & mask();
+
+    /* can move if the hole lies between its home and where it is now */
+    if ( ( ( i - home ) & mask() ) >= ( ( i - hole ) & mask() ) ) {
+      tags_[ hole ] = tags_[ i ];
+      slots_[ hole ] = slots_[ i ];
+      hole = i;
+    }
+  }
+
+  tags_[ hole ] = 0;
+  size_--;
+}
+
+void FlowTable::grow( void )
+{
+  vector<uint32_t> old_tags( tags_.size() * 2 );
+  vector<Slot> old_slots( slots_.size() * 2 );
+  swap( old_tags, tags_ );
+  swap( old_slots, slots_ );
+
+  for ( size_t j = 0; j < old_tags.size(); j++ ) {
+    if ( not old_tags[ j ] ) {
+      continue;
+    }
+
+    size_t i = old_slots[ j ].key.hash() & mask();
+    while ( tags_[ i ] ) {
+      i = ( i + 1 ) & mask();
+    }
+
+    tags_[ i ] = old_tags[ j ];
+    slots_[ i ] = old_slots[ j ];
+  }
+}
+
+size_t FlowTable::expire( const uint64_t idle_since, const FlowCallback & expired )
+{
+  size_t count = 0;
+
+  for ( size_t i = 0; i < tags_.size(); i++ ) {
+    /* erasing can pull another entry into this slot, so look again */
+    while ( tags_[ i ] and slots_[ i ].flow.last_seen < idle_since ) {
+      if ( expired ) {
+	expired( slots_[ i ].key, slots_[ i ].flow );
+      }
+      erase_slot( i );
+      count++;
+    }
+  }
+
+  return count;
+}
+
+void FlowTable::for_each( const FlowCallback & callback ) const
+{
+  for ( size_t i = 0; i < tags_.size(); i++ ) {
+    if ( tags_[ i ] ) {
+      callback( slots_[ i ].key, slots_[ i ].flow );
+    }
+  }
+}
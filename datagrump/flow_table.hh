@@ -0,0 +1,88 @@
+#ifndef FLOW_TABLE_HH
+#define FLOW_TABLE_HH
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "address.hh"
+
+/* Per-flow state for a receiver serving many senders, keyed by the
+   sender's address.
+
+   Open addressing with linear probing, and backward-shift deletion so
+   no tombstones build up as flows come and go. A separate array of
+   32-bit hash tags is what a probe scans, so a lookup usually touches
+   one cache line of tags and then the one slot it wants. */
+class FlowTable
+{
+public:
+  struct Flow
+  {
+    uint64_t next_ack_sequence_number;
+
+    uint64_t datagrams, bytes;
+
+    /* from the sender's sequence numbers: a gap counts as lost until
+       (unless) the missing datagrams turn up late, as reordered */
+    uint64_t highest_sequence_number;
+    uint64_t lost, reordered;
+
+    uint64_t first_seen, last_seen; /* microseconds */
+
+    /* for the receiver: 1 + the index of this flow's held-back acks, or 0 */
+    uint32_t delayed_acks;
+
+    void datagram_received( const uint64_t sequence_number,
+			    const uint64_t length,
+			    const uint64_t now );
+  };
+
+  typedef std::function<void( const Address::Key & key, const Flow & flow )> FlowCallback;
+
+private:
+  struct Slot
+  {
+    Address::Key key;
+    Flow flow;
+
+    Slot() : key(), flow() {}
+    Slot( const Address::Key & s_key, const Flow & s_flow ) : key( s_key ), flow( s_flow ) {}
+  };
+
+  std::vector<uint32_t> tags_; /* 0 for an empty slot */
+  std::vector<Slot> slots_;
+  size_t size_;
+
+  size_t mask( void ) const { return tags_.size() - 1; }
+  static uint32_t tag( const uint64_t hash ) { return uint32_t( hash >> 32 ) | 1; }
+
+  void grow( void );
+  void erase_slot( size_t hole );
+
+public:
+  /* most of the slots that may be in use before the table doubles */
+  static constexpr double MAX_LOAD = 0.75;
+
+  FlowTable( const size_t initial_capacity = 1024 );
+
+  /* the flow for a sender, created (as of now) if this is its first datagram */
+  Flow & find_or_insert( const Address::Key & key, const uint64_t now );
+
+  /* the flow for a sender, or nullptr */
+  Flow * find( const Address::Key & key );
+  const Flow * find( const Address::Key & key ) const;
+
+  bool erase( const Address::Key & key );
+
+  /* forget every flow last seen before idle_since, handing each to
+     expired (if given) first; returns how many there were */
+  size_t expire( const uint64_t idle_since, const FlowCallback & expired = FlowCallback() );
+
+  void for_each( const FlowCallback & callback ) const;
+
+  size_t size( void ) const { return size_; }
+  size_t capacity( void ) const { return tags_.size(); }
+};
+
+#endif /* FLOW_TABLE_HH */
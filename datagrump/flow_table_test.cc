@@ -0,0 +1,151 @@
+/* checks the receiver's FlowTable against std::unordered_map: a long
+   random run of inserts, lookups, erasures and expiries, from a small
+   enough set of senders that they keep colliding, must leave both
+   holding the same flows */
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "flow_table.hh"
+
+using namespace std;
+
+static void check( const bool condition, const string & what )
+{
+  if ( not condition ) {
+    throw runtime_error( "check failed: " + what );
+  }
+}
+
+/* what the reference keeps for each flow */
+struct Expected
+{
+  uint64_t datagrams, last_seen;
+};
+
+typedef unordered_map<Address::Key, Expected, Address::Key::Hasher> Reference;
+
+/* the table holds exactly the flows the reference does */
+static void check_same( const FlowTable & table, const Reference & reference, const uint64_t step )
+{
+  const string when = " (step " + to_string( step ) + ")";
+  check( table.size() == reference.size(), "same size" + when );
+
+  size_t visited = 0;
+  table.for_each( [&] ( const Address::Key & key, const FlowTable::Flow & flow ) {
+      const auto expected = reference.find( key );
+      check( expected != reference.end(), "no extra flows" + when );
+      check( flow.datagrams == expected->second.datagrams
+	     and flow.last_seen == expected->second.last_seen, "same flow state" + when );
+      visited++;
+    } );
+  check( visited == reference.size(), "for_each visits every flow" + when );
+}
+
+static void check_random_operations( const uint64_t seed, const size_t sender_count )
+{
+  const uint64_t STEPS = 400000;
+
+  mt19937 prng( seed );
+
+  /* the senders (a few sharing an address, on different ports) */
+  vector<Address::Key> senders( sender_count );
+  for ( size_t i = 0; i < sender_count; i++ ) {
+    senders[ i ].ip[ 2 ] = htonl( 0xffff );
+    senders[ i ].ip[ 3 ] = prng() % ( sender_count / 4 + 1 );
+    senders[ i ].port = prng();
+  }
+  uniform_int_distribution<size_t> pick( 0, sender_count - 1 );
+  uniform_int_distribution<unsigned int> operation( 0, 99 );
+
+  FlowTable table( 16 ); /* (to grow many times over) */
+  Reference reference;
+
+  uint64_t now = 0;
+  for ( uint64_t step = 0; step < STEPS; step++ ) {
+    now += prng() % 10;
+    const Address::Key & key = senders[ pick( prng ) ];
+    const unsigned int choice = operation( prng );
+
+    if ( choice < 50 ) {
+      /* a datagram arrives */
+      FlowTable::Flow & flow = table.find_or_insert( key, now );
+      flow.datagram_received( flow.datagrams, 100, now );
+
+      Expected & expected = reference[ key ];
+      expected.datagrams++;
+      expected.last_seen = now;
+    } else if ( choice < 80 ) {
+      const FlowTable::Flow * const flow = table.find( key );
+      const auto expected = reference.find( key );
+      check( ( flow != nullptr ) == ( expected != reference.end() ),
+	     "find agrees (step " + to_string( step ) + ")" );
+      if ( flow ) {
+	check( flow->datagrams == expected->second.datagrams,
+	       "found the right flow (step " + to_string( step ) + ")" );
+      }
+    } else if ( choice < 99 ) {
+      check( table.erase( key ) == ( reference.erase( key ) == 1 ),
+	     "erase agrees (step " + to_string( step ) + ")" );
+    } else {
+      /* forget the flows idle for a while */
+      const uint64_t idle_since = now - min( now, uint64_t( 2000 ) );
+      size_t expected_count = 0;
+      for ( auto flow = reference.begin(); flow != reference.end(); ) {
+	if ( flow->second.last_seen < idle_since ) {
+	  flow = reference.erase( flow );
+	  expected_count++;
+	} else {
+	  ++flow;
+	}
+      }
+
+      size_t handed_over = 0;
+      const size_t count = table.expire( idle_since, [&] ( const Address::Key &,
+							   const FlowTable::Flow & flow ) {
+					   check( flow.last_seen < idle_since, "expired only idle flows" );
+					   handed_over++;
+					 } );
+      check( count == expected_count and handed_over == count,
+	     "expire agrees (step " + to_string( step ) + ")" );
+    }
+
+    check( table.size() <= FlowTable::MAX_LOAD * table.capacity(), "load stays in bounds" );
+
+    if ( step % 10000 == 0 ) {
+      check_same( table, reference, step );
+    }
+  }
+
+  check_same( table, reference, STEPS );
+
+  /* and empties out */
+  for ( const auto & sender : senders ) {
+    table.erase( sender );
+  }
+  check( table.size() == 0, "empty after erasing every sender" );
+  for ( const auto & sender : senders ) {
+    check( table.find( sender ) == nullptr, "nothing left to find" );
+  }
+}
+
+int main()
+{
+  try {
+    for ( uint64_t seed = 1; seed <= 3; seed++ ) {
+      check_random_operations( seed, 64 );
+      check_random_operations( seed, 3000 );
+    }
+  } catch ( const exception & e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  cerr << "FlowTable checks passed." << endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+#include "link_queue.hh"
+#include "score.hh"
+
+using namespace std;
+
+const size_t PacketTrace::PACKET_SIZE;
+
+PacketTrace::PacketTrace( const string & filename )
+  : opportunities_ms_()
+{
+  ifstream trace_file( filename );
+  if ( not trace_file.good() ) {
+    throw runtime_error( filename + ": error opening for reading" );
+  }
+
+  string line;
+  while ( getline( trace_file, line ) ) {
+    if ( line.empty() ) {
+      continue;
+    }
+
+    const uint64_t ms = stoull( line );
+    if ( not opportunities_ms_.empty() and ms < opportunities_ms_.back() ) {
+      throw runtime_error( filename + ": timestamps must be nondecreasing" );
+    }
+
+    opportunities_ms_.push_back( ms );
+  }
+
+  if ( opportunities_ms_.empty() or opportunities_ms_.back() == 0 ) {
+    throw runtime_error( filename + ": trace must last longer than 0 ms" );
+  }
+}
+
+LinkQueue::LinkQueue( const shared_ptr<const PacketTrace> & trace,
+		      const uint64_t start_time,
+		      const uint64_t delay_us,
+		      const size_t queue_limit,
+		      ostream * log,
+		      LinkScore * score )
+  : trace_( trace ),
+    start_time_( start_time ),
+    delay_us_( delay_us ),
+    queue_limit_( queue_limit ),
+    in_transit_(),
+    queue_(),
+    next_opportunity_( 0 ),
+    repetitions_( 0 ),
+    log_( log ),
+    score_( score )
+{}
+
+void LinkQueue::log_header( const string & command_line, const uint64_t init_timestamp_ms ) const
+{
+  if ( not log_ ) {
+    return;
+  }
+
+  *log_ << "# mahimahi mm-link [emulated]" << "\n"
+	<< "# command line: " << command_line << "\n"
+	<< "# queue: droptail";
+  if ( queue_limit_ ) {
+    *log_ << " [packets=" << queue_limit_ << "]";
+  } else {
+    *log_ << " [infinite]";
+  }
+  *log_ << "\n"
+	<< "# init timestamp: " << init_timestamp_ms << "\n"
+	<< "# base timestamp: 0" << "\n";
+}
+
+void LinkQueue::log( const uint64_t time, const char event, const size_t bytes ) const
+{
+  const uint64_t time_ms = (time - start_time_) / 1000;
+
+  if ( log_ ) {
+    *log_ << time_ms << " " << event << " " << bytes << "\n";
+  }
+
+  if ( score_ ) {
+    switch ( event ) {
+    case '+': score_->arrival( time_ms, bytes ); break;
+    case '#': score_->opportunity( time_ms, bytes ); break;
+    case 'd': score_->drop( time_ms, bytes ); break;
+    }
+  }
+}
+
+void LinkQueue::log_departure( const uint64_t time, const QueuedPacket & packet ) const
+{
+  const uint64_t time_ms = (time - start_time_) / 1000;
+  const uint64_t delay_ms = (time - packet.queue_time) / 1000;
+
+  if ( log_ ) {
+    *log_ << time_ms << " - " << packet.packet.size << " " << delay_ms << "\n";
+  }
+
+  if ( score_ ) {
+    score_->departure( time_ms, packet.packet.size, delay_ms );
+  }
+}
+
+uint64_t LinkQueue::next_opportunity_time( void ) const
+{
+  const uint64_t ms = repetitions_ * trace_->period_ms()
+    + trace_->opportunities_ms().at( next_opportunity_ );
+  return start_time_ + ms * 1000;
+}
+
+uint64_t LinkQueue::next_event_time( void ) const
+{
+  uint64_t ret = numeric_limits<uint64_t>::max();
+
+  if ( not in_transit_.empty() ) {
+    ret = in_transit_.front().queue_time;
+  }
+
+  if ( not queue_.empty() ) {
+    ret = min( ret, next_opportunity_time() );
+  }
+
+  return ret;
+}
+
+void LinkQueue::send( const uint64_t now, Packet && packet )
+{
+  const size_t size = packet.size;
+  in_transit_.push_back( QueuedPacket { now + delay_us_, size, move( packet ) } );
+}
+
+/* a packet reaches the end of the delay line: queue it, unless the queue is full */
+void LinkQueue::enqueue( QueuedPacket && packet )
+{
+  if ( queue_limit_ and queue_.size() >= queue_limit_ ) {
+    log( packet.queue_time, 'd', packet.packet.size );
+    return;
+  }
+
+  log( packet.queue_time, '+', packet.packet.size );
+  queue_.push_back( move( packet ) );
+}
+
+/* transmit up to PACKET_SIZE bytes from the head of the queue
+   (a packet may be split across opportunities) */
+void LinkQueue::use_opportunity( const uint64_t time, const DeliveryCallback & deliver )
+{
+  log( time, '#', PacketTrace::PACKET_SIZE );
+
+  size_t bytes_left = PacketTrace::PACKET_SIZE;
+  while ( bytes_left > 0 and not queue_.empty() ) {
+    QueuedPacket & head = queue_.front();
+
+    if ( head.bytes_left > bytes_left ) {
+      head.bytes_left -= bytes_left;
+      break;
+    }
+
+    bytes_left -= head.bytes_left;
+
+    log_departure( time, head );
+
+    deliver( time, head.packet );
+    queue_.pop_front();
+  }
+
+  /* move on to the next opportunity, wrapping around the trace */
+  if ( ++next_opportunity_ == trace_->opportunities_ms().size() ) {
+    next_opportunity_ = 0;
+    repetitions_++;
+  }
+}
+
+void LinkQueue::advance( const uint64_t now, const DeliveryCallback & deliver )
+{
+  while ( true ) {
+    const uint64_t arrival = in_transit_.empty()
+      ? numeric_limits<uint64_t>::max() : in_transit_.front().queue_time;
+    const uint64_t opportunity = next_opportunity_time();
+
+    if ( min( arrival, opportunity ) > now ) {
+      return;
+    }
+
+    /* handle events in order (an arrival at the same instant as an
+       opportunity can use it) */
+    if ( arrival <= opportunity ) {
+      QueuedPacket packet = move( in_transit_.front() );
+      in_transit_.pop_front();
+      enqueue( move( packet ) );
+    } else {
+      use_opportunity( opportunity, deliver );
+    }
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef LINK_QUEUE_HH
+#define LINK_QUEUE_HH
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "packet_pool.hh"
+
+class LinkScore;
+
+/* mahimahi packet-delivery trace: each line is the time (in ms) of one
+   opportunity to deliver PACKET_SIZE bytes, and the trace repeats
+   with a period of its last timestamp */
+class PacketTrace
+{
+private:
+  std::vector<uint64_t> opportunities_ms_;
+
+public:
+  /* bytes that one delivery opportunity can carry */
+  static const size_t PACKET_SIZE = 1504;
+
+  PacketTrace( const std::string & filename );
+
+  const std::vector<uint64_t> & opportunities_ms( void ) const { return opportunities_ms_; }
+  uint64_t period_ms( void ) const { return opportunities_ms_.back(); }
+};
+
+/* One direction of an emulated link: a fixed propagation delay, then a
+   droptail queue drained at the trace's delivery opportunities (as in
+   mm-delay around mm-link). The caller supplies the time (in microseconds)
+   so the same link can run in real time or in a simulation.
+
+   With a log, every arrival, opportunity, departure and drop is recorded
+   in mahimahi's log format (times in ms since the link started); with a
+   score, the same events are scored as they happen instead. */
+class LinkQueue
+{
+public:
+  struct Packet
+  {
+    size_t size;                 /* bytes occupied on the link */
+    PacketPool::Buffer contents; /* carried along untouched (may be empty) */
+  };
+
+  typedef std::function<void( const uint64_t departure_time, Packet & packet )> DeliveryCallback;
+
+private:
+  struct QueuedPacket
+  {
+    uint64_t queue_time; /* when it reaches (or reached) the queue */
+    size_t bytes_left;   /* still to transmit, for the head of the queue */
+    Packet packet;
+  };
+
+  std::shared_ptr<const PacketTrace> trace_;
+  uint64_t start_time_, delay_us_;
+  size_t queue_limit_; /* in packets, 0 for no limit */
+
+  std::deque<QueuedPacket> in_transit_, queue_;
+
+  /* the next delivery opportunity */
+  size_t next_opportunity_;
+  uint64_t repetitions_;
+
+  std::ostream * log_;
+  LinkScore * score_;
+
+  uint64_t next_opportunity_time( void ) const;
+  void enqueue( QueuedPacket && packet );
+  void use_opportunity( const uint64_t time, const DeliveryCallback & deliver );
+  void log( const uint64_t time, const char event, const size_t bytes ) const;
+  void log_departure( const uint64_t time, const QueuedPacket & packet ) const;
+
+public:
+  LinkQueue( const std::shared_ptr<const PacketTrace> & trace,
+	     const uint64_t start_time,
+	     const uint64_t delay_us,
+	     const size_t queue_limit,
+	     std::ostream * log = nullptr,
+	     LinkScore * score = nullptr );
+
+  /* a packet enters the link */
+  void send( const uint64_t now, Packet && packet );
+
+  /* run the link up to now, handing each packet that comes out to deliver */
+  void advance( const uint64_t now, const DeliveryCallback & deliver );
+
+  /* earliest time the link has anything to do (or UINT64_MAX if it is idle) */
+  uint64_t next_event_time( void ) const;
+
+  /* has the trace been played all the way through? */
+  bool trace_finished( void ) const { return repetitions_ > 0; }
+
+  size_t queue_length( void ) const { return queue_.size(); }
+
+  /* write mahimahi's log header */
+  void log_header( const std::string & command_line, const uint64_t init_timestamp_ms ) const;
+
+  /* forbid copying LinkQueue objects or assigning them */
+  LinkQueue( const LinkQueue & other ) = delete;
+  const LinkQueue & operator=( const LinkQueue & other ) = delete;
+};
+
+#endif /* LINK_QUEUE_HH */
@@ -1,12 +1,362 @@
-/* simple UDP receiver that acknowledges every datagram */
+/* simple UDP receiver that acknowledges every datagram
+   (optionally several with one ack) */
 
+#include <algorithm>
 #include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
 
 #include "socket.hh"
 #include "contest_message.hh"
+#include "flow_table.hh"
+#include "poller.hh"
+#include "stats.hh"
+#include "timestamp.hh"
+#include "util.hh"
 
 using namespace std;
+using namespace PollerShortNames;
+
+/* most datagrams to drain with one system call */
+static const size_t RECEIVE_BATCH_SIZE = 64;
+
+/* most datagrams one ack may cover */
+static const unsigned int MAX_ACK_EVERY = 64;
+
+/* size of an ack covering that many */
+static const size_t MAX_ACK_SIZE = ContestMessage::Header::WIRE_SIZE
+  + ( MAX_ACK_EVERY - 1 ) * ContestMessage::AckRecord::WIRE_SIZE;
+
+/* flows not heard from for this long are forgotten */
+static const uint64_t FLOW_IDLE_TIMEOUT_US = 30 * 1000 * 1000;
+
+/* longest an ack may be held back (well short of the idle timeout) */
+static const uint64_t MAX_ACK_DELAY_US = 1000 * 1000;
+
+/* how often to look for idle flows */
+static const uint64_t FLOW_EXPIRY_INTERVAL_US = 1000 * 1000;
+
+/* run the calling thread only on the given CPU */
+void pin_to_cpu( const unsigned int cpu )
+{
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CPU_SET( cpu, &cpus );
+  SystemCall( "sched_setaffinity", sched_setaffinity( 0, sizeof( cpus ), &cpus ) );
+}
+
+/* summary of a flow that has ended */
+void print_flow( const Address::Key & key, const FlowTable::Flow & flow )
+{
+  cerr << "Flow from " << Address( key ).to_string() << ": "
+       << flow.datagrams << " datagrams (" << flow.bytes << " bytes) over "
+       << ( flow.last_seen - flow.first_seen ) / 1000 << " ms, "
+       << flow.lost << " lost, " << flow.reordered << " reordered" << endl;
+}
+
+/* acks held back to go out together, for one flow */
+struct DelayedAcks
+{
+  Address::Key key;
+  Address destination;
+  vector<ContestMessage::AckRecord> acked; /* oldest first; empty if the slot is free */
+  uint64_t deadline;
+};
+
+/* acknowledges every datagram arriving on one socket */
+class DatagrumpReceiver
+{
+private:
+  UDPSocket & socket_;
+
+  /* acks cover up to ack_every_ datagrams, each delayed at most ack_delay_us_ */
+  unsigned int ack_every_;
+  uint64_t ack_delay_us_;
+
+  /* acks are numbered separately for each flow (i.e., each sender address) */
+  FlowTable flows_;
+  bool print_flows_;
+  uint64_t next_expiry_;
+
+  /* wait and do I/O through io_uring, rather than poll and system calls */
+  bool io_uring_;
+
+  /* storage for however many datagrams arrive together, and their acks */
+  UDPSocket::RecvBatch incoming_;
+  UDPSocket::SendBatch acks_;
+
+  /* flows with acks being held back (each flow knows its slot) */
+  vector<DelayedAcks> delayed_;
+  vector<uint32_t> free_delayed_;
+  bool flush_timer_pending_;
+
+  void receive( Poller & poller );
+  void queue_ack( const Address & destination, FlowTable::Flow & flow,
+		  const ContestMessage::AckRecord * const acked, const size_t count );
+  void delay_ack( Poller & poller, const size_t i, FlowTable::Flow & flow,
+		  const ContestMessage::AckRecord & record, const uint64_t now );
+  void flush_delayed( FlowTable::Flow & flow );
+  void flush_overdue( Poller & poller );
+  void arm_flush_timer( Poller & poller, const uint64_t deadline );
+  void expire_flows( const uint64_t now );
+
+public:
+  DatagrumpReceiver( UDPSocket & socket, const unsigned int ack_every,
+		     const uint64_t ack_delay_us, const bool print_flows,
+		     const bool io_uring );
+  int loop( void );
+};
+
+DatagrumpReceiver::DatagrumpReceiver( UDPSocket & socket,
+				      const unsigned int ack_every,
+				      const uint64_t ack_delay_us,
+				      const bool print_flows,
+				      const bool io_uring )
+  : socket_( socket ),
+    ack_every_( ack_every ),
+    ack_delay_us_( ack_delay_us ),
+    flows_(),
+    print_flows_( print_flows ),
+    next_expiry_( timestamp_us() + FLOW_EXPIRY_INTERVAL_US ),
+    io_uring_( io_uring ),
+    incoming_( RECEIVE_BATCH_SIZE ),
+    acks_( RECEIVE_BATCH_SIZE, MAX_ACK_SIZE ),
+    delayed_(),
+    free_delayed_(),
+    flush_timer_pending_( false )
+{
+  /* (the ring is set up here, on the thread that will use it) */
+  if ( io_uring_ ) {
+    socket_.set_io_uring_sends();
+  }
+}
+
+/* assemble one ack covering the given datagrams (the latest in its
+   header, the rest as records) and queue it, written straight into
+   the outgoing batch */
+void DatagrumpReceiver::queue_ack( const Address & destination, FlowTable::Flow & flow,
+				   const ContestMessage::AckRecord * const acked,
+				   const size_t count )
+{
+  const ContestMessage::AckRecord & latest = acked[ count - 1 ];
+
+  /* rebuild the latest datagram's header, and turn it into the ack */
+  ContestMessage::Header ack( latest.sequence_number );
+  ack.send_timestamp = latest.send_timestamp;
+  ack.transform_into_ack( flow.next_ack_sequence_number++,
+			  latest.recv_timestamp, latest.payload_length );
+
+  /* any record too far away to encode relative to the ack gets its own */
+  size_t records = 0;
+  for ( size_t i = 0; i + 1 < count; i++ ) {
+    if ( acked[ i ].fits( ack ) ) {
+      records++;
+    } else {
+      queue_ack( destination, flow, &acked[ i ], 1 );
+    }
+  }
+
+  if ( acks_.full() ) {
+    socket_.send_batch( acks_ );
+  }
+
+  /* timestamp the ack just before sending */
+  ack.set_send_timestamp();
+
+  char * wire = acks_.append( destination, ContestMessage::Header::WIRE_SIZE
+			      + records * ContestMessage::AckRecord::WIRE_SIZE );
+  ack.serialize( wire );
+  wire += ContestMessage::Header::WIRE_SIZE;
+
+  for ( size_t i = 0; i + 1 < count; i++ ) {
+    if ( acked[ i ].fits( ack ) ) {
+      acked[ i ].serialize( ack, wire );
+      wire += ContestMessage::AckRecord::WIRE_SIZE;
+    }
+  }
+}
+
+/* hold back the ack of the ith incoming datagram, until the flow has
+   ack_every_ to send or the first has waited ack_delay_us_ */
+void DatagrumpReceiver::delay_ack( Poller & poller, const size_t i, FlowTable::Flow & flow,
+				   const ContestMessage::AckRecord & record, const uint64_t now )
+{
+  if ( not flow.delayed_acks ) {
+    if ( free_delayed_.empty() ) {
+      free_delayed_.push_back( delayed_.size() );
+      delayed_.push_back( { Address::Key(), Address(), {}, 0 } );
+      delayed_.back().acked.reserve( ack_every_ );
+    }
+
+    flow.delayed_acks = free_delayed_.back() + 1;
+    free_delayed_.pop_back();
+
+    DelayedAcks & slot = delayed_.at( flow.delayed_acks - 1 );
+    slot.key = incoming_.source_key( i );
+    slot.destination = incoming_.source_address( i );
+    slot.deadline = now + ack_delay_us_;
+
+    arm_flush_timer( poller, slot.deadline );
+  }
+
+  DelayedAcks & slot = delayed_.at( flow.delayed_acks - 1 );
+  slot.acked.push_back( record );
+
+  if ( slot.acked.size() >= ack_every_ ) {
+    flush_delayed( flow );
+  }
+}
+
+/* send a flow's held-back acks now */
+void DatagrumpReceiver::flush_delayed( FlowTable::Flow & flow )
+{
+  DelayedAcks & slot = delayed_.at( flow.delayed_acks - 1 );
+  queue_ack( slot.destination, flow, slot.acked.data(), slot.acked.size() );
+
+  slot.acked.clear();
+  free_delayed_.push_back( flow.delayed_acks - 1 );
+  flow.delayed_acks = 0;
+}
+
+/* send the held-back acks that have waited long enough */
+void DatagrumpReceiver::flush_overdue( Poller & poller )
+{
+  const uint64_t now = timestamp_us();
+  uint64_t next_deadline = numeric_limits<uint64_t>::max();
+
+  for ( auto & slot : delayed_ ) {
+    if ( slot.acked.empty() ) {
+      continue;
+    } else if ( slot.deadline <= now ) {
+      FlowTable::Flow * const flow = flows_.find( slot.key );
+      if ( flow ) {
+	flush_delayed( *flow );
+      } else { /* (the flow has been forgotten, so there's no one to ack) */
+	slot.acked.clear();
+	free_delayed_.push_back( &slot - &delayed_.front() );
+      }
+    } else {
+      next_deadline = min( next_deadline, slot.deadline );
+    }
+  }
+
+  socket_.send_batch( acks_ );
+
+  if ( next_deadline != numeric_limits<uint64_t>::max() ) {
+    arm_flush_timer( poller, next_deadline );
+  }
+}
+
+/* make sure a timer will fire by the deadline (one timer serves every flow) */
+void DatagrumpReceiver::arm_flush_timer( Poller & poller, const uint64_t deadline )
+{
+  if ( flush_timer_pending_ ) {
+    return;
+  }
+
+  const uint64_t now = timestamp_us();
+  flush_timer_pending_ = true;
+  poller.add_timer( deadline > now ? deadline - now : 0, [&] () {
+      flush_timer_pending_ = false;
+      flush_overdue( poller );
+      return ResultType::Continue;
+    } );
+}
+
+/* forget flows that have gone quiet */
+void DatagrumpReceiver::expire_flows( const uint64_t now )
+{
+  if ( now < next_expiry_ ) {
+    return;
+  }
+
+  const uint64_t idle_since = now - min( now, FLOW_IDLE_TIMEOUT_US );
+
+  /* send whatever a flow about to be forgotten still has held back */
+  for ( const auto & slot : delayed_ ) {
+    if ( slot.acked.empty() ) {
+      continue;
+    }
+
+    FlowTable::Flow * const flow = flows_.find( slot.key );
+    if ( flow and flow->last_seen < idle_since ) {
+      flush_delayed( *flow );
+    }
+  }
+
+  flows_.expire( idle_since, print_flows_ ? print_flow : FlowTable::FlowCallback() );
+  next_expiry_ = now + FLOW_EXPIRY_INTERVAL_US;
+}
+
+/* acknowledge the datagrams just received */
+void DatagrumpReceiver::receive( Poller & poller )
+{
+  const size_t count = incoming_.size();
+  const uint64_t now = timestamp_us();
+  Stats & stats = Stats::thread();
+
+  for ( size_t i = 0; i < count; i++ ) {
+    const uint64_t parse_start_ns = Stats::now_ns();
+    const ContestMessageView message( incoming_.payload( i ), incoming_.payload_length( i ) );
+    stats.record( Stats::Parse, Stats::now_ns() - parse_start_ns );
+
+    FlowTable::Flow & flow = flows_.find_or_insert( incoming_.source_key( i ), now );
+    flow.datagram_received( message.header.sequence_number, incoming_.payload_length( i ), now );
+
+    const ContestMessage::AckRecord record { message.header.sequence_number,
+					     message.header.send_timestamp,
+					     incoming_.timestamp( i ),
+					     message.payload_length };
+
+    if ( ack_every_ > 1 ) {
+      delay_ack( poller, i, flow, record, now );
+    } else {
+      queue_ack( incoming_.source_address( i ), flow, &record, 1 );
+    }
+  }
+
+  expire_flows( now );
+
+  /* send all the acks */
+  socket_.send_batch( acks_ );
+}
+
+/* Loop and acknowledge every incoming datagram back to its source */
+int DatagrumpReceiver::loop( void )
+{
+  Poller poller( io_uring_ ? Poller::Backend::IOUring : Poller::Backend::Poll );
+
+  poller.add_datagram_action( socket_, incoming_, [&] () {
+      receive( poller );
+      return ResultType::Continue;
+    } );
+
+  while ( true ) {
+    const auto ret = poller.poll( -1 );
+    if ( ret.result == PollResult::Exit ) {
+      return ret.exit_status;
+    }
+  }
+}
+
+/* run a receiver on the calling thread, optionally pinned to one CPU */
+void run_worker( UDPSocket & socket, const int cpu, const unsigned int ack_every,
+		 const uint64_t ack_delay_us, const bool print_flows, const bool io_uring )
+{
+  if ( cpu >= 0 ) {
+    pin_to_cpu( cpu );
+  }
+
+  DatagrumpReceiver receiver( socket, ack_every, ack_delay_us, print_flows, io_uring );
+  receiver.loop();
+}
 
 int main( int argc, char *argv[] )
 {
@@ -15,37 +365,97 @@ int main( int argc, char *argv[] )
     abort();
   }
 
-  if ( argc != 2 ) {
-    cerr << "Usage: " << argv[ 0 ] << " PORT" << endl;
+  unsigned int thread_count = 1, ack_every = 1;
+  uint64_t ack_delay_us = 1000;
+  bool pin = false, print_flows = false, io_uring = false, gro = false, stats = false;
+  bool usage_error = argc < 2;
+
+  for ( int i = 2; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option.substr( 0, 8 ) == "threads=" ) {
+      thread_count = stoul( option.substr( 8 ) );
+      usage_error |= thread_count == 0;
+    } else if ( option.substr( 0, 10 ) == "ack-every=" ) {
+      /* aggregate acks: one for every K datagrams of a flow */
+      ack_every = stoul( option.substr( 10 ) );
+      usage_error |= ack_every == 0 or ack_every > MAX_ACK_EVERY;
+    } else if ( option.substr( 0, 10 ) == "ack-delay=" ) {
+      /* ... unless the first has waited this long (microseconds) */
+      ack_delay_us = stoull( option.substr( 10 ) );
+      usage_error |= ack_delay_us > MAX_ACK_DELAY_US;
+    } else if ( option == "pin" ) {
+      pin = true;
+    } else if ( option == "flows" ) {
+      /* print each flow's statistics when it goes idle */
+      print_flows = true;
+    } else if ( option == "io_uring" ) {
+      io_uring = true;
+    } else if ( option == "gro" ) {
+      /* let the kernel coalesce each flow's datagrams as they arrive */
+      gro = true;
+    } else if ( option == "stats" ) {
+      /* print each thread's event-loop statistics on SIGUSR1 and at exit */
+      stats = true;
+    } else {
+      usage_error = true;
+    }
+  }
+
+  if ( usage_error ) {
+    cerr << "Usage: " << argv[ 0 ] << " PORT [threads=N] [pin] [flows] [io_uring] [gro] [stats]"
+	 << " [ack-every=K (at most " << MAX_ACK_EVERY << ")]"
+	 << " [ack-delay=US (at most " << MAX_ACK_DELAY_US << ")]" << endl;
     return EXIT_FAILURE;
   }
 
-  /* create UDP socket for incoming datagrams */
-  UDPSocket socket;
+  if ( stats ) {
+    Stats::dump_on_signal();
+  }
 
-  /* turn on timestamps on receipt */
-  socket.set_timestamps();
+  if ( io_uring and not IOUring::available() ) {
+    cerr << "io_uring is not available; falling back to poll." << endl;
+    io_uring = false;
+  }
 
-  /* "bind" the socket to the user-specified local port number */
-  socket.bind( Address( "::0", argv[ 1 ] ) );
+  /* one socket per worker; with several, the kernel hashes each flow to one of them */
+  vector<unique_ptr<UDPSocket>> sockets;
+  for ( unsigned int i = 0; i < thread_count; i++ ) {
+    sockets.emplace_back( new UDPSocket );
 
-  cerr << "Listening on " << socket.local_address().to_string() << endl;
+    /* turn on timestamps on receipt */
+    sockets.back()->set_timestamps();
 
-  uint64_t sequence_number = 0;
+    if ( gro ) {
+      sockets.back()->set_gro();
+    }
 
-  /* Loop and acknowledge every incoming datagram back to its source */
-  while ( true ) {
-    const UDPSocket::received_datagram recd = socket.recv();
-    ContestMessage message = recd.payload;
+    if ( thread_count > 1 ) {
+      sockets.back()->set_reuseport();
+    }
 
-    /* assemble the acknowledgment */
-    message.transform_into_ack( sequence_number++, recd.timestamp );
+    /* "bind" the socket to the user-specified local port number */
+    sockets.back()->bind( Address( "::0", argv[ 1 ] ) );
+  }
+
+  cerr << "Listening on " << sockets.front()->local_address().to_string();
+  if ( thread_count > 1 ) {
+    cerr << " with " << thread_count << " threads";
+  }
+  cerr << endl;
+
+  /* the first worker runs on the main thread */
+  const unsigned int cpu_count = max( 1u, thread::hardware_concurrency() );
+
+  vector<thread> workers;
+  for ( unsigned int i = 1; i < thread_count; i++ ) {
+    workers.emplace_back( run_worker, ref( *sockets.at( i ) ), pin ? int( i % cpu_count ) : -1,
+			  ack_every, ack_delay_us, print_flows, io_uring );
+  }
 
-    /* timestamp the ack just before sending */
-    message.set_send_timestamp();
+  run_worker( *sockets.front(), pin ? 0 : -1, ack_every, ack_delay_us, print_flows, io_uring );
 
-    /* send the ack */
-    socket.sendto( recd.source_address, message.to_string() );
+  for ( auto & worker : workers ) {
+    worker.join();
   }
 
   return EXIT_SUCCESS;
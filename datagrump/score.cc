@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+#include "score.hh"
+
+using namespace std;
+
+const uint64_t DelayHistogram::MAX_DELAY_MS;
+
+void DelayHistogram::add( const uint64_t delay_ms )
+{
+  const uint64_t bucket = min( delay_ms, MAX_DELAY_MS );
+  if ( bucket >= counts_.size() ) {
+    counts_.resize( bucket + 1 );
+  }
+
+  counts_[ bucket ]++;
+  total_++;
+}
+
+void DelayHistogram::clear( void )
+{
+  /* keep the storage, since the next interval will likely need as much */
+  fill( counts_.begin(), counts_.end(), 0 );
+  total_ = 0;
+}
+
+uint64_t DelayHistogram::percentile( const double fraction ) const
+{
+  if ( total_ == 0 ) {
+    return 0;
+  }
+
+  const uint64_t rank = max( uint64_t( 1 ), uint64_t( ceil( fraction * total_ ) ) );
+  uint64_t seen = 0;
+  for ( size_t delay = 0; delay < counts_.size(); delay++ ) {
+    seen += counts_[ delay ];
+    if ( seen >= rank ) {
+      return delay;
+    }
+  }
+
+  return counts_.size() - 1;
+}
+
+/* bytes over ms, in Mbits/s */
+static double mbps( const uint64_t bytes, const uint64_t duration_ms )
+{
+  return duration_ms ? bytes * 8.0 / duration_ms / 1000.0 : 0.0;
+}
+
+double LinkScore::Interval::capacity_mbps( void ) const
+{
+  return mbps( capacity_bytes, duration_ms );
+}
+
+double LinkScore::Interval::throughput_mbps( void ) const
+{
+  return mbps( delivered_bytes, duration_ms );
+}
+
+LinkScore::LinkScore( const uint64_t interval_ms,
+		      const IntervalCallback & interval_callback )
+  : interval_ms_( interval_ms ),
+    interval_callback_( interval_callback ),
+    have_origin_( false ),
+    origin_ms_( 0 ),
+    last_ms_( 0 ),
+    capacity_bytes_( 0 ),
+    delivered_bytes_( 0 ),
+    arrivals_( 0 ),
+    departures_( 0 ),
+    drops_( 0 ),
+    delays_(),
+    current_( { 0, interval_ms, 0, 0, 0 } ),
+    current_delays_(),
+    line_number_( 0 )
+{}
+
+void LinkScore::base_timestamp( const uint64_t time_ms )
+{
+  if ( not have_origin_ ) {
+    origin_ms_ = time_ms;
+    have_origin_ = true;
+  }
+}
+
+void LinkScore::finish_interval( void )
+{
+  current_.delay_p95_ms = current_delays_.percentile( 0.95 );
+  if ( interval_callback_ ) {
+    interval_callback_( current_ );
+  }
+
+  current_ = { current_.start_ms + current_.duration_ms, interval_ms_, 0, 0, 0 };
+  current_delays_.clear();
+}
+
+uint64_t LinkScore::advance( const uint64_t time_ms )
+{
+  base_timestamp( time_ms );
+
+  /* clamp, so a stray early timestamp can't run the clock backwards */
+  const uint64_t relative = max( time_ms, origin_ms_ ) - origin_ms_;
+  last_ms_ = max( last_ms_, relative );
+
+  if ( interval_ms_ ) {
+    while ( last_ms_ >= current_.start_ms + interval_ms_ ) {
+      finish_interval();
+    }
+  }
+
+  return last_ms_;
+}
+
+void LinkScore::opportunity( const uint64_t time_ms, const uint64_t bytes )
+{
+  advance( time_ms );
+  capacity_bytes_ += bytes;
+  current_.capacity_bytes += bytes;
+}
+
+void LinkScore::arrival( const uint64_t time_ms, const uint64_t )
+{
+  advance( time_ms );
+  arrivals_++;
+}
+
+void LinkScore::departure( const uint64_t time_ms, const uint64_t bytes, const uint64_t delay_ms )
+{
+  advance( time_ms );
+  delivered_bytes_ += bytes;
+  departures_++;
+  delays_.add( delay_ms );
+
+  current_.delivered_bytes += bytes;
+  current_delays_.add( delay_ms );
+}
+
+void LinkScore::drop( const uint64_t time_ms, const uint64_t )
+{
+  advance( time_ms );
+  drops_++;
+}
+
+void LinkScore::add_log_line( const string & line )
+{
+  line_number_++;
+
+  if ( line.empty() ) {
+    return;
+  }
+
+  /* header: only the base timestamp matters */
+  if ( line[ 0 ] == '#' ) {
+    static const string base_prefix = "# base timestamp: ";
+    if ( line.compare( 0, base_prefix.size(), base_prefix ) == 0 ) {
+      base_timestamp( strtoull( line.c_str() + base_prefix.size(), nullptr, 10 ) );
+    }
+    return;
+  }
+
+  /* "TIME EVENT BYTES [DELAY]" */
+  const char * position = line.c_str();
+  char * end = nullptr;
+
+  auto malformed = [&] () {
+    return runtime_error( "log line " + to_string( line_number_ ) + ": malformed: " + line );
+  };
+
+  auto next_number = [&] () {
+    const uint64_t value = strtoull( position, &end, 10 );
+    if ( end == position ) {
+      throw malformed();
+    }
+    position = end;
+    return value;
+  };
+
+  const uint64_t time_ms = next_number();
+  while ( *position == ' ' ) {
+    position++;
+  }
+  const char event = *position++;
+  const uint64_t bytes = next_number();
+
+  switch ( event ) {
+  case '#':
+    opportunity( time_ms, bytes );
+    break;
+  case '+':
+    arrival( time_ms, bytes );
+    break;
+  case '-':
+    departure( time_ms, bytes, next_number() );
+    break;
+  case 'd':
+    drop( time_ms, bytes );
+    break;
+  default:
+    throw malformed();
+  }
+}
+
+void LinkScore::finish( void )
+{
+  if ( interval_ms_ and have_origin_ and last_ms_ > current_.start_ms ) {
+    current_.duration_ms = last_ms_ - current_.start_ms;
+    finish_interval();
+  }
+}
+
+uint64_t LinkScore::duration_ms( void ) const
+{
+  return last_ms_;
+}
+
+double LinkScore::capacity_mbps( void ) const
+{
+  return mbps( capacity_bytes_, duration_ms() );
+}
+
+double LinkScore::throughput_mbps( void ) const
+{
+  return mbps( delivered_bytes_, duration_ms() );
+}
+
+double LinkScore::utilization( void ) const
+{
+  return capacity_bytes_ ? double( delivered_bytes_ ) / capacity_bytes_ : 0.0;
+}
+
+double LinkScore::power( void ) const
+{
+  const uint64_t delay_ms = delay_percentile_ms( 0.95 );
+  return delay_ms ? throughput_mbps() / ( delay_ms / 1000.0 ) : 0.0;
+}
+
+string LinkScore::summary( void ) const
+{
+  ostringstream out;
+  out << fixed << setprecision( 2 )
+      << "Duration: " << duration_ms() / 1000.0 << " s" << "\n"
+      << "Average capacity: " << capacity_mbps() << " Mbits/s" << "\n"
+      << "Average throughput: " << throughput_mbps() << " Mbits/s ("
+      << setprecision( 1 ) << 100.0 * utilization() << "% utilization)" << "\n"
+      << "95th percentile per-packet queueing delay: " << delay_percentile_ms( 0.95 ) << " ms" << "\n"
+      << setprecision( 2 )
+      << "Power (throughput/delay): " << power() << " Mbits/s per s" << "\n"
+      << "Packets: " << arrivals_ << " arrived, " << departures_ << " delivered, "
+      << drops_ << " dropped" << "\n";
+  return out.str();
+}
@@ -0,0 +1,115 @@
+#ifndef SCORE_HH
+#define SCORE_HH
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/* Counts of per-packet delays in whole milliseconds, for percentiles
+   in memory that depends only on the largest delay, not on the
+   number of packets */
+class DelayHistogram
+{
+private:
+  std::vector<uint64_t> counts_;
+  uint64_t total_;
+
+public:
+  /* delays beyond this are counted as this */
+  static const uint64_t MAX_DELAY_MS = 600000;
+
+  DelayHistogram() : counts_(), total_( 0 ) {}
+
+  void add( const uint64_t delay_ms );
+  void clear( void );
+
+  uint64_t count( void ) const { return total_; }
+
+  /* smallest delay at or below which the given fraction of packets fall
+     (0 if there are none) */
+  uint64_t percentile( const double fraction ) const;
+};
+
+/* Performance of one direction of a link, from the events in its
+   mahimahi-format log (mm-link's --uplink-log, or the emulator's):
+   capacity, throughput, 95th-percentile per-packet queueing delay, and
+   their ratio ("power"), overall and in fixed intervals of time.
+
+   Events must arrive in time order; only running totals and delay
+   histograms are kept, so logs of any length can be scored. */
+class LinkScore
+{
+public:
+  /* totals over one interval of the time series */
+  struct Interval
+  {
+    uint64_t start_ms, duration_ms;
+    uint64_t capacity_bytes, delivered_bytes;
+    uint64_t delay_p95_ms; /* of packets that left in this interval */
+
+    double capacity_mbps( void ) const;
+    double throughput_mbps( void ) const;
+  };
+
+  typedef std::function<void( const Interval & interval )> IntervalCallback;
+
+private:
+  uint64_t interval_ms_;
+  IntervalCallback interval_callback_;
+
+  /* times are relative to the base timestamp, if the log gives one,
+     otherwise to the first event */
+  bool have_origin_;
+  uint64_t origin_ms_, last_ms_;
+
+  uint64_t capacity_bytes_, delivered_bytes_;
+  uint64_t arrivals_, departures_, drops_;
+  DelayHistogram delays_;
+
+  Interval current_;
+  DelayHistogram current_delays_;
+
+  uint64_t line_number_;
+
+  /* bring the clock up to an event's time, finishing intervals on the way */
+  uint64_t advance( const uint64_t time_ms );
+  void finish_interval( void );
+
+public:
+  /* with interval_ms > 0, interval_callback is given each completed
+     interval of that length */
+  LinkScore( const uint64_t interval_ms = 0,
+	     const IntervalCallback & interval_callback = IntervalCallback() );
+
+  /* events, with absolute times in ms */
+  void base_timestamp( const uint64_t time_ms );
+  void opportunity( const uint64_t time_ms, const uint64_t bytes );
+  void arrival( const uint64_t time_ms, const uint64_t bytes );
+  void departure( const uint64_t time_ms, const uint64_t bytes, const uint64_t delay_ms );
+  void drop( const uint64_t time_ms, const uint64_t bytes );
+
+  /* parse one line of a mahimahi log and record its event */
+  void add_log_line( const std::string & line );
+
+  /* report the final (partial) interval */
+  void finish( void );
+
+  uint64_t duration_ms( void ) const;
+  double capacity_mbps( void ) const;
+  double throughput_mbps( void ) const;
+  double utilization( void ) const;
+  uint64_t delay_percentile_ms( const double fraction ) const { return delays_.percentile( fraction ); }
+
+  /* throughput (Mbits/s) over 95th-percentile delay (s) */
+  double power( void ) const;
+
+  uint64_t arrivals( void ) const { return arrivals_; }
+  uint64_t departures( void ) const { return departures_; }
+  uint64_t drops( void ) const { return drops_; }
+
+  /* multi-line report in the style of mm-throughput-graph */
+  std::string summary( void ) const;
+};
+
+#endif /* SCORE_HH */
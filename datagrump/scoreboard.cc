@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "scoreboard.hh"
+
+using namespace std;
+
+const uint64_t Scoreboard::DUPLICATE_THRESHOLD;
+
+Scoreboard::Scoreboard( const size_t capacity )
+  : ring_(),
+    oldest_( 0 ),
+    next_( 0 ),
+    in_flight_( 0 ),
+    bytes_in_flight_( 0 ),
+    acked_ahead_( 0 ),
+    have_rack_( false ),
+    rack_sequence_number_( 0 ),
+    rack_rtt_( 0 ),
+    min_rtt_( numeric_limits<uint64_t>::max() ),
+    lost_( 0 ),
+    spurious_losses_( 0 )
+{
+  /* round up to a power of two */
+  size_t ring_size = 16;
+  while ( ring_size < capacity ) {
+    ring_size *= 2;
+  }
+
+  ring_.resize( ring_size );
+}
+
+void Scoreboard::sent( const uint64_t sequence_number,
+		       const uint64_t send_timestamp,
+		       const uint32_t size )
+{
+  if ( sequence_number != next_ ) {
+    throw runtime_error( "Scoreboard: datagrams must be sent in sequence" );
+  }
+
+  if ( full() ) {
+    throw runtime_error( "Scoreboard: too many datagrams outstanding" );
+  }
+
+  at( sequence_number ) = { send_timestamp, size, State::InFlight };
+  next_++;
+
+  in_flight_++;
+  bytes_in_flight_ += size;
+}
+
+void Scoreboard::transmitted( const uint64_t sequence_number, const uint64_t timestamp )
+{
+  if ( tracked( sequence_number ) ) {
+    at( sequence_number ).send_timestamp = timestamp;
+  }
+}
+
+uint64_t Scoreboard::send_timestamp( const uint64_t sequence_number, const uint64_t fallback ) const
+{
+  return tracked( sequence_number ) ? at( sequence_number ).send_timestamp : fallback;
+}
+
+void Scoreboard::acked( const uint64_t sequence_number, const uint64_t timestamp )
+{
+  /* ignore acks for datagrams never sent, or long since forgotten */
+  if ( not tracked( sequence_number ) ) {
+    return;
+  }
+
+  Datagram & datagram = at( sequence_number );
+
+  switch ( datagram.state ) {
+  case State::InFlight:
+    in_flight_--;
+    bytes_in_flight_ -= datagram.size;
+    break;
+  case State::Lost:
+    /* it was only late */
+    spurious_losses_++;
+    break;
+  case State::Acked:
+    return;
+  }
+
+  datagram.state = State::Acked;
+
+  /* (one already given up on, and left behind by oldest_, is not ahead of anything) */
+  if ( sequence_number >= oldest_ ) {
+    acked_ahead_++;
+  }
+
+  const uint64_t rtt = timestamp - min( timestamp, datagram.send_timestamp );
+  min_rtt_ = min( min_rtt_, rtt );
+
+  /* RACK follows the most recently sent datagram to be acked */
+  if ( not have_rack_ or sequence_number > rack_sequence_number_ ) {
+    have_rack_ = true;
+    rack_sequence_number_ = sequence_number;
+    rack_rtt_ = rtt;
+  }
+
+  advance();
+}
+
+void Scoreboard::mark_lost( const uint64_t sequence_number )
+{
+  Datagram & datagram = at( sequence_number );
+
+  datagram.state = State::Lost;
+  in_flight_--;
+  bytes_in_flight_ -= datagram.size;
+  lost_++;
+}
+
+void Scoreboard::advance( void )
+{
+  while ( oldest_ < next_ and at( oldest_ ).state != State::InFlight ) {
+    if ( at( oldest_ ).state == State::Acked ) {
+      acked_ahead_--;
+    }
+    oldest_++;
+  }
+}
+
+void Scoreboard::detect_losses( const uint64_t now, const LossCallback & lost )
+{
+  if ( not have_rack_ ) {
+    return;
+  }
+
+  const uint64_t reordering_window = min_rtt_ / 4;
+
+  /* how many datagrams later than the one being judged have been acked */
+  uint64_t acked_later = acked_ahead_;
+
+  /* only datagrams sent before the RACK datagram can be judged; since
+     both tests get easier with age, the lost ones come first */
+  for ( uint64_t sequence_number = oldest_;
+	sequence_number < rack_sequence_number_;
+	sequence_number++ ) {
+    const Datagram & datagram = at( sequence_number );
+    if ( datagram.state != State::InFlight ) {
+      if ( datagram.state == State::Acked ) {
+	acked_later--;
+      }
+      continue;
+    }
+
+    if ( acked_later < DUPLICATE_THRESHOLD
+	 and now < datagram.send_timestamp + rack_rtt_ + reordering_window ) {
+      break;
+    }
+
+    mark_lost( sequence_number );
+    lost( sequence_number, datagram );
+  }
+
+  advance();
+}
+
+uint64_t Scoreboard::next_loss_time( void ) const
+{
+  if ( not have_rack_ or oldest_ >= rack_sequence_number_ ) {
+    return numeric_limits<uint64_t>::max();
+  }
+
+  /* the oldest datagram in flight will be the first to go */
+  return at( oldest_ ).send_timestamp + rack_rtt_ + min_rtt_ / 4;
+}
+
+uint64_t Scoreboard::abandon( const uint64_t sent_before )
+{
+  uint64_t count = 0;
+
+  for ( uint64_t sequence_number = oldest_; sequence_number < next_; sequence_number++ ) {
+    const Datagram & datagram = at( sequence_number );
+    if ( datagram.state != State::InFlight ) {
+      continue;
+    }
+
+    if ( datagram.send_timestamp >= sent_before ) {
+      break;
+    }
+
+    mark_lost( sequence_number );
+    count++;
+  }
+
+  advance();
+
+  return count;
+}
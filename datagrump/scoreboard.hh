@@ -0,0 +1,105 @@
+#ifndef SCOREBOARD_HH
+#define SCOREBOARD_HH
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/* Sender's record of every datagram from the oldest unresolved one
+   onward, in a ring indexed by sequence number: which are still in
+   flight, which were acked, and which are judged lost.
+
+   Loss detection follows RACK (RFC 8985) and its packet threshold:
+   a datagram is lost once a later one has been acked and either
+   DUPLICATE_THRESHOLD later ones have been acked, or it has been out
+   for an RTT plus a reordering window longer than the later one took. */
+class Scoreboard
+{
+public:
+  enum class State : uint8_t { InFlight, Acked, Lost };
+
+  struct Datagram
+  {
+    uint64_t send_timestamp;
+    uint32_t size;
+    State state;
+  };
+
+  typedef std::function<void( const uint64_t sequence_number,
+			      const Datagram & datagram )> LossCallback;
+
+  /* acks of this many later datagrams (counting each one acked, not how
+     far ahead it is) mean an earlier one is lost */
+  static const uint64_t DUPLICATE_THRESHOLD = 3;
+
+private:
+  std::vector<Datagram> ring_;
+
+  uint64_t oldest_;   /* lowest sequence number still in flight (or next_, if none) */
+  uint64_t next_;     /* next sequence number to be sent */
+
+  uint64_t in_flight_, bytes_in_flight_;
+
+  /* datagrams acked from oldest_ on (so all later than it) */
+  uint64_t acked_ahead_;
+
+  /* RACK state: the highest sequence number acked, the RTT it saw,
+     and the smallest RTT seen (for the reordering window) */
+  bool have_rack_;
+  uint64_t rack_sequence_number_, rack_rtt_, min_rtt_;
+
+  uint64_t lost_, spurious_losses_;
+
+  bool tracked( const uint64_t sequence_number ) const
+  {
+    return sequence_number < next_ and next_ - sequence_number <= ring_.size();
+  }
+
+  Datagram & at( const uint64_t sequence_number ) { return ring_[ sequence_number & ( ring_.size() - 1 ) ]; }
+  const Datagram & at( const uint64_t sequence_number ) const { return ring_[ sequence_number & ( ring_.size() - 1 ) ]; }
+
+  void mark_lost( const uint64_t sequence_number );
+
+  /* move oldest_ past datagrams that are no longer in flight */
+  void advance( void );
+
+public:
+  /* capacity (rounded up to a power of two) bounds the span of sequence
+     numbers from the oldest datagram in flight to the newest */
+  Scoreboard( const size_t capacity = 65536 );
+
+  /* record a datagram (sequence numbers must be consecutive) */
+  void sent( const uint64_t sequence_number, const uint64_t send_timestamp, const uint32_t size );
+
+  /* the kernel says when a datagram actually left, which from then on
+     counts as the time it was sent */
+  void transmitted( const uint64_t sequence_number, const uint64_t timestamp );
+
+  /* when a datagram was sent, if the scoreboard still has it (or otherwise the fallback) */
+  uint64_t send_timestamp( const uint64_t sequence_number, const uint64_t fallback ) const;
+
+  /* an ack arrived (at timestamp) for a datagram */
+  void acked( const uint64_t sequence_number, const uint64_t timestamp );
+
+  /* judge which datagrams are lost as of now, reporting each */
+  void detect_losses( const uint64_t now, const LossCallback & lost );
+
+  /* when detect_losses() could next find a loss, if no more acks arrive
+     (UINT64_MAX if it can't) */
+  uint64_t next_loss_time( void ) const;
+
+  /* give up on everything sent before a time (e.g. after a timeout),
+     returning how many datagrams that was */
+  uint64_t abandon( const uint64_t sent_before );
+
+  /* no room to send another datagram until older ones resolve */
+  bool full( void ) const { return next_ - oldest_ >= ring_.size(); }
+
+  uint64_t in_flight( void ) const { return in_flight_; }
+  uint64_t bytes_in_flight( void ) const { return bytes_in_flight_; }
+
+  uint64_t lost( void ) const { return lost_; }
+  uint64_t spurious_losses( void ) const { return spurious_losses_; }
+};
+
+#endif /* SCOREBOARD_HH */
@@ -0,0 +1,173 @@
+/* checks the sender's Scoreboard: on a simulated path that drops some
+   datagrams and delays the rest (with a little reordering), the losses
+   it reports must be exactly the datagrams dropped */
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+#include "scoreboard.hh"
+
+using namespace std;
+
+static void check( const bool condition, const string & what )
+{
+  if ( not condition ) {
+    throw runtime_error( "check failed: " + what );
+  }
+}
+
+/* send through a lossy path, keeping a window in flight, and compare the
+   losses reported against the drops */
+static void check_losses_match_drops( const uint64_t seed )
+{
+  const uint64_t DATAGRAMS = 200000, WINDOW = 64;
+  const uint64_t SEND_INTERVAL_US = 100, RTT_US = 10000, JITTER_US = 150;
+  const double DROP_PROBABILITY = 0.03;
+
+  mt19937 prng( seed );
+  bernoulli_distribution drop( DROP_PROBABILITY );
+  uniform_int_distribution<uint64_t> jitter( 0, JITTER_US );
+
+  Scoreboard scoreboard( 1024 );
+  multimap<uint64_t, uint64_t> acks; /* arrival time -> sequence number */
+  set<uint64_t> dropped, reported;
+
+  const auto lost = [&] ( const uint64_t sequence_number, const Scoreboard::Datagram & ) {
+    check( reported.insert( sequence_number ).second,
+	   "datagram " + to_string( sequence_number ) + " reported lost twice" );
+  };
+
+  uint64_t now = 0, next_send = 0, sent = 0;
+  while ( sent < DATAGRAMS or not acks.empty() ) {
+    /* send whenever the window has room and it's time */
+    if ( sent < DATAGRAMS and scoreboard.in_flight() < WINDOW and next_send <= now ) {
+      scoreboard.sent( sent, now, 1500 );
+      if ( drop( prng ) ) {
+	dropped.insert( sent );
+      } else {
+	acks.emplace( now + RTT_US + jitter( prng ), sent );
+      }
+      sent++;
+      next_send = now + SEND_INTERVAL_US;
+      continue;
+    }
+
+    /* otherwise move on to the next thing to happen */
+    uint64_t next = scoreboard.next_loss_time();
+    if ( not acks.empty() ) {
+      next = min( next, acks.begin()->first );
+    }
+    if ( sent < DATAGRAMS and scoreboard.in_flight() < WINDOW ) {
+      next = min( next, next_send );
+    }
+    check( next != numeric_limits<uint64_t>::max(), "stalled with nothing to wait for" );
+    now = max( now, next );
+
+    while ( not acks.empty() and acks.begin()->first <= now ) {
+      scoreboard.acked( acks.begin()->second, now );
+      acks.erase( acks.begin() );
+    }
+
+    scoreboard.detect_losses( now, lost );
+  }
+
+  /* drops after the last datagram acked can only be given up on */
+  uint64_t tail = 0;
+  for ( uint64_t sequence_number = DATAGRAMS; sequence_number-- > 0
+	  and not reported.count( sequence_number ); ) {
+    if ( dropped.count( sequence_number ) ) {
+      reported.insert( sequence_number );
+      tail++;
+    } else {
+      break;
+    }
+  }
+  check( scoreboard.abandon( now + 1 ) == tail, "abandon() gave up on the trailing drops" );
+
+  check( reported == dropped, "the losses reported are the datagrams dropped" );
+  check( scoreboard.lost() == dropped.size(), "lost() counts every drop" );
+  check( scoreboard.spurious_losses() == 0, "no datagram delivered was judged lost" );
+  check( scoreboard.in_flight() == 0 and scoreboard.bytes_in_flight() == 0,
+	 "nothing left in flight" );
+}
+
+/* an ack for a datagram already judged lost counts as a spurious loss,
+   and a timeout gives up on only what was sent before it began */
+static void check_spurious_and_abandon( void )
+{
+  Scoreboard scoreboard;
+  for ( uint64_t i = 0; i < 10; i++ ) {
+    scoreboard.sent( i, i * 1000, 100 );
+  }
+
+  /* 0 is overtaken by DUPLICATE_THRESHOLD later ones */
+  for ( uint64_t i = 1; i <= Scoreboard::DUPLICATE_THRESHOLD; i++ ) {
+    scoreboard.acked( i, 20000 + i * 1000 );
+  }
+
+  uint64_t lost_count = 0;
+  scoreboard.detect_losses( 25000, [&] ( const uint64_t sequence_number,
+					 const Scoreboard::Datagram & ) {
+			      check( sequence_number == 0, "only datagram 0 is lost" );
+			      lost_count++;
+			    } );
+  check( lost_count == 1 and scoreboard.lost() == 1, "one loss" );
+
+  scoreboard.acked( 0, 26000 );
+  check( scoreboard.spurious_losses() == 1, "a late ack is a spurious loss" );
+
+  /* 4 to 9 are still in flight; give up on those sent before 7000 */
+  check( scoreboard.in_flight() == 6, "six still in flight" );
+  check( scoreboard.abandon( 7000 ) == 3, "abandon() gives up on 4, 5 and 6" );
+  check( scoreboard.in_flight() == 3 and scoreboard.bytes_in_flight() == 300,
+	 "three still in flight" );
+}
+
+/* the packet threshold counts the later datagrams acked, not how far
+   ahead the furthest one is: an ack for 3 alone says nothing yet about 0,
+   but acks for 1, 2 and 3 do */
+static void check_duplicate_threshold( void )
+{
+  Scoreboard scoreboard;
+  for ( uint64_t i = 0; i < 4; i++ ) {
+    scoreboard.sent( i, 0, 100 );
+  }
+
+  uint64_t lost_count = 0;
+  const auto lost = [&] ( const uint64_t, const Scoreboard::Datagram & ) { lost_count++; };
+
+  /* (well inside the time threshold) */
+  scoreboard.acked( 3, 10000 );
+  scoreboard.detect_losses( 10000, lost );
+  check( lost_count == 0, "one ack three ahead is not enough" );
+
+  scoreboard.acked( 2, 10000 );
+  scoreboard.detect_losses( 10000, lost );
+  check( lost_count == 0, "two acks ahead are not enough" );
+
+  scoreboard.acked( 1, 10000 );
+  scoreboard.detect_losses( 10000, lost );
+  check( lost_count == 1 and scoreboard.lost() == 1, "three acks ahead are" );
+}
+
+int main()
+{
+  try {
+    for ( uint64_t seed = 1; seed <= 5; seed++ ) {
+      check_losses_match_drops( seed );
+    }
+    check_spurious_and_abandon();
+    check_duplicate_threshold();
+  } catch ( const exception & e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  cerr << "Scoreboard checks passed." << endl;
+  return EXIT_SUCCESS;
+}
@@ -1,37 +1,115 @@
 /* UDP sender for congestion-control contest */
 
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <signal.h>
+#include <sys/signalfd.h>
 
 #include "socket.hh"
 #include "contest_message.hh"
+#include "scoreboard.hh"
 #include "controller.hh"
 #include "poller.hh"
+#include "stats.hh"
+#include "telemetry.hh"
+#include "timestamp.hh"
+#include "util.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
+/* most acks to drain with one system call */
+static const size_t ACK_BATCH_SIZE = 32;
+
+/* most datagrams to send with one system call (the kernel's limit for sendmmsg) */
+static const size_t SEND_BATCH_SIZE = 1024;
+
+/* size of each outgoing datagram: 48-byte header plus dummy payload */
+static const size_t DATAGRAM_SIZE = 1472;
+
+/* how far the pacing schedule may fall behind (e.g. from a late wakeup)
+   before the missed release times are given up rather than sent in a burst */
+static const uint64_t PACING_SLACK_US = 1000;
+
+/* with kernel pacing, how far ahead of its release time a datagram may be
+   handed to the kernel (time it spends held there counts toward its RTT) */
+static const uint64_t KERNEL_PACING_HORIZON_US = 2000;
+
+/* how often to report the time datagrams spent in the kernel before leaving */
+static const uint64_t TX_QUEUEING_REPORT_INTERVAL_US = 1000000;
+
 /* simple sender class to handle the accounting */
 class DatagrumpSender
 {
 private:
   UDPSocket socket_;
-  Controller controller_; /* your class */
+
+  /* binary log of every event, if asked for (before the controller, which records into it) */
+  std::unique_ptr<TelemetryLog> telemetry_;
+
+  std::unique_ptr<Controller> controller_; /* chosen on the command line */
 
   uint64_t sequence_number_; /* next outgoing sequence number */
 
-  /* if network does not reorder or lose datagrams,
-     this is the sequence number that the sender
-     next expects will be acknowledged by the receiver */
-  uint64_t next_ack_expected_;
+  /* every datagram not yet acked or judged lost */
+  Scoreboard scoreboard_;
+
+  /* when loss detection will next need to look, if no acks arrive first */
+  uint64_t loss_timer_id_, loss_timer_deadline_;
+
+  /* one pool of datagram-sized slots for everything sent and received */
+  PacketPool pool_;
+
+  /* datagrams serialized but not yet handed to the kernel,
+     with the (sequence number, send timestamp) of each */
+  UDPSocket::SendBatch outgoing_;
+  std::vector<std::pair<uint64_t, uint64_t>> pending_sends_;
+
+  /* pacing: when the next datagram may leave, and whether the kernel
+     (instead of the sender's own timers) holds each datagram until then */
+  bool kernel_pacing_;
+  uint64_t next_release_us_;
+  bool release_timer_pending_;
+
+  /* wait and do I/O through io_uring, rather than poll and system calls */
+  bool io_uring_;
+
+  /* hand the kernel each batch as a few large segmented sends */
+  bool gso_;
 
+  /* take each datagram's send time from the kernel's timestamp of when it
+     left, and keep track of how long it waited there since the last report */
+  bool tx_timestamps_;
+  uint64_t tx_queueing_count_, tx_queueing_total_us_, tx_queueing_max_us_;
+
+  void queue_datagram( const uint64_t release_us );
+  void flush_datagrams( void );
   void send_datagram( void );
-  void got_ack( const uint64_t timestamp, const ContestMessage & msg );
+  void send_window( void );
+  void got_ack( const uint64_t timestamp, const ContestMessageView & msg );
+  void got_tx_timestamp( const uint64_t sequence_number, const uint64_t timestamp );
+  void report_tx_queueing( void );
+  void detect_losses( const uint64_t now );
   bool window_is_open( void );
+  void arm_loss_timer( Poller & poller );
+
+  bool release_is_due( const uint64_t now );
+  uint64_t schedule_release( const uint64_t now );
+  void arm_release_timer( Poller & poller );
 
 public:
   DatagrumpSender( const char * const host, const char * const port,
-		   const bool debug );
+		   const std::string & algorithm, const Controller::Parameters & parameters,
+		   const bool debug, const bool kernel_pacing, const bool io_uring,
+		   const bool gso, const bool tx_timestamps,
+		   const std::string & telemetry_filename );
   int loop( void );
 };
 
@@ -42,33 +120,136 @@ int main( int argc, char *argv[] )
     abort();
   }
 
-  bool debug = false;
-  if ( argc == 4 and string( argv[ 3 ] ) == "debug" ) {
-    debug = true;
-  } else if ( argc == 3 ) {
-    /* do nothing */
-  } else {
-    cerr << "Usage: " << argv[ 0 ] << " HOST PORT [debug]" << endl;
+  bool debug = false, kernel_pacing = false, io_uring = false, gso = false;
+  bool tx_timestamps = false, stats = false;
+  string algorithm = Controller::default_algorithm, telemetry_filename;
+  Controller::Parameters parameters;
+  bool usage_error = argc < 3;
+  for ( int i = 3; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option.substr( 0, 3 ) == "cc=" ) {
+      algorithm = option.substr( 3 );
+    } else if ( option == "debug" ) {
+      debug = true;
+    } else if ( option == "txtime" ) {
+      /* pace with SO_TXTIME (needs the fq qdisc on the outgoing interface) */
+      kernel_pacing = true;
+    } else if ( option == "io_uring" ) {
+      io_uring = true;
+    } else if ( option == "gso" ) {
+      /* UDP segmentation offload (a datagram paced with txtime still goes alone) */
+      gso = true;
+    } else if ( option == "tx-timestamps" ) {
+      /* RTTs from when datagrams left the kernel, rather than when they went in */
+      tx_timestamps = true;
+    } else if ( option == "stats" ) {
+      /* print the event loop's statistics on SIGUSR1 and at exit */
+      stats = true;
+    } else if ( option.substr( 0, 10 ) == "telemetry=" ) {
+      /* a binary log of every event, for telemetry-decoder */
+      telemetry_filename = option.substr( 10 );
+    } else if ( Controller::parse_parameter( option, parameters ) ) {
+      /* a tunable constant of the algorithm */
+    } else {
+      usage_error = true;
+    }
+  }
+
+  const auto algorithms = Controller::algorithms();
+  if ( find( algorithms.begin(), algorithms.end(), algorithm ) == algorithms.end() ) {
+    usage_error = true;
+  }
+
+  if ( usage_error ) {
+    cerr << "Usage: " << argv[ 0 ] << " HOST PORT [cc=ALGORITHM] [debug] [txtime] [io_uring] [gso] [tx-timestamps]"
+	 << " [telemetry=FILE] [stats] [cc-PARAMETER=VALUE]..." << endl;
+    cerr << "Algorithms:";
+    for ( const auto & name : algorithms ) {
+      cerr << " " << name;
+    }
+    cerr << " (default " << Controller::default_algorithm << ")" << endl;
     return EXIT_FAILURE;
   }
 
+  if ( stats ) {
+    Stats::dump_on_signal();
+  }
+
+  if ( io_uring and not IOUring::available() ) {
+    cerr << "io_uring is not available; falling back to poll." << endl;
+    io_uring = false;
+  }
+
   /* create sender object to handle the accounting */
   /* all the interesting work is done by the Controller */
-  DatagrumpSender sender( argv[ 1 ], argv[ 2 ], debug );
+  DatagrumpSender sender( argv[ 1 ], argv[ 2 ], algorithm, parameters, debug, kernel_pacing,
+			  io_uring, gso, tx_timestamps, telemetry_filename );
   return sender.loop();
 }
 
 DatagrumpSender::DatagrumpSender( const char * const host,
 				  const char * const port,
-				  const bool debug )
+				  const string & algorithm,
+				  const Controller::Parameters & parameters,
+				  const bool debug,
+				  const bool kernel_pacing,
+				  const bool io_uring,
+				  const bool gso,
+				  const bool tx_timestamps,
+				  const string & telemetry_filename )
   : socket_(),
-    controller_( debug ),
+    telemetry_( telemetry_filename.empty() ? nullptr : new TelemetryLog( telemetry_filename ) ),
+    controller_( Controller::make( algorithm, debug, parameters ) ),
     sequence_number_( 0 ),
-    next_ack_expected_( 0 )
+    scoreboard_(),
+    loss_timer_id_( 0 ),
+    loss_timer_deadline_( numeric_limits<uint64_t>::max() ),
+    pool_( DATAGRAM_SIZE, SEND_BATCH_SIZE + ACK_BATCH_SIZE ),
+    outgoing_( SEND_BATCH_SIZE, pool_ ),
+    pending_sends_(),
+    kernel_pacing_( kernel_pacing ),
+    next_release_us_( 0 ),
+    release_timer_pending_( false ),
+    io_uring_( io_uring ),
+    gso_( gso ),
+    tx_timestamps_( tx_timestamps ),
+    tx_queueing_count_( 0 ),
+    tx_queueing_total_us_( 0 ),
+    tx_queueing_max_us_( 0 )
 {
+  controller_->set_telemetry( telemetry_.get() );
+
+  pending_sends_.reserve( SEND_BATCH_SIZE );
+
+  /* All messages use the same dummy payload, and each slot of the batch
+     keeps whatever was last written to it, so fill it in once up front */
+  while ( not outgoing_.full() ) {
+    memset( outgoing_.append( DATAGRAM_SIZE ) + ContestMessage::Header::WIRE_SIZE,
+	    'x', DATAGRAM_SIZE - ContestMessage::Header::WIRE_SIZE );
+  }
+  outgoing_.clear();
+
   /* turn on timestamps when socket receives a datagram */
   socket_.set_timestamps();
 
+  /* let each datagram tell the kernel when to release it */
+  if ( kernel_pacing_ ) {
+    socket_.set_txtime();
+  }
+
+  if ( io_uring_ ) {
+    socket_.set_io_uring_sends();
+  }
+
+  if ( gso_ ) {
+    socket_.set_gso();
+  }
+
+  /* (datagrams are numbered from here, as are sequence numbers) */
+  if ( tx_timestamps_ ) {
+    socket_.set_tx_timestamps();
+  }
+
   /* connect socket to the remote host */
   /* (note: this doesn't send anything; it just tags the socket
      locally with the remote address */
@@ -78,77 +259,296 @@ DatagrumpSender::DatagrumpSender( const char * const host,
 }
 
 void DatagrumpSender::got_ack( const uint64_t timestamp,
-			       const ContestMessage & ack )
+			       const ContestMessageView & ack )
 {
   if ( not ack.is_ack() ) {
     throw runtime_error( "sender got something other than an ack from the receiver" );
   }
 
-  /* Update sender's counter */
-  next_ack_expected_ = max( next_ack_expected_,
-			    ack.header.ack_sequence_number + 1 );
+  /* An aggregated ack also covers earlier datagrams: inform the
+     congestion controller of each, oldest first */
+  for ( size_t i = 0; i < ack.ack_record_count(); i++ ) {
+    const ContestMessage::AckRecord record = ack.ack_record( i );
+
+    scoreboard_.acked( record.sequence_number, timestamp );
+
+    controller_->ack_received( record.sequence_number,
+			      scoreboard_.send_timestamp( record.sequence_number,
+							  record.send_timestamp ),
+			      record.recv_timestamp,
+			      timestamp );
+  }
 
-  /* Inform congestion controller */
-  controller_.ack_received( ack.header.ack_sequence_number,
-			    ack.header.ack_send_timestamp,
+  /* Update sender's scoreboard */
+  scoreboard_.acked( ack.header.ack_sequence_number, timestamp );
+
+  /* Inform congestion controller (of when the datagram left the kernel, if known) */
+  controller_->ack_received( ack.header.ack_sequence_number,
+			    scoreboard_.send_timestamp( ack.header.ack_sequence_number,
+							ack.header.ack_send_timestamp ),
 			    ack.header.ack_recv_timestamp,
 			    timestamp );
+
+  detect_losses( timestamp );
+}
+
+/* the kernel says when a datagram left, which is its send time from now on */
+void DatagrumpSender::got_tx_timestamp( const uint64_t sequence_number, const uint64_t timestamp )
+{
+  const uint64_t handed_over = scoreboard_.send_timestamp( sequence_number, timestamp );
+  scoreboard_.transmitted( sequence_number, timestamp );
+
+  const uint64_t queueing = timestamp - min( timestamp, handed_over );
+  tx_queueing_count_++;
+  tx_queueing_total_us_ += queueing;
+  tx_queueing_max_us_ = max( tx_queueing_max_us_, queueing );
+
+  if ( telemetry_ ) {
+    telemetry_->record( TelemetryLog::EventType::TxQueueing, timestamp,
+			sequence_number, handed_over, queueing );
+  }
+}
+
+void DatagrumpSender::report_tx_queueing( void )
+{
+  if ( tx_queueing_count_ == 0 ) {
+    return;
+  }
+
+  cerr << "At time " << timestamp_us()
+       << " kernel send queueing over " << tx_queueing_count_ << " datagrams:"
+       << " mean " << tx_queueing_total_us_ / tx_queueing_count_ << " us,"
+       << " max " << tx_queueing_max_us_ << " us" << endl;
+
+  tx_queueing_count_ = tx_queueing_total_us_ = tx_queueing_max_us_ = 0;
+}
+
+/* judge which datagrams are lost, and tell the congestion controller */
+void DatagrumpSender::detect_losses( const uint64_t now )
+{
+  scoreboard_.detect_losses( now, [&] ( const uint64_t sequence_number,
+					const Scoreboard::Datagram & datagram ) {
+			       controller_->datagram_was_lost( sequence_number,
+							       datagram.send_timestamp, now );
+			     } );
+}
+
+void DatagrumpSender::queue_datagram( const uint64_t release_us )
+{
+  ContestMessage::Header header( sequence_number_++ );
+  header.set_send_timestamp();
+
+  /* serialize the header straight into the outgoing batch (the dummy
+     payload is already there) */
+  header.serialize( outgoing_.append( DATAGRAM_SIZE ) );
+
+  if ( kernel_pacing_ ) {
+    outgoing_.set_departure_time( monotonic_ns( release_us ) );
+  }
+
+  pending_sends_.emplace_back( header.sequence_number, header.send_timestamp );
+  scoreboard_.sent( header.sequence_number, header.send_timestamp, DATAGRAM_SIZE );
+
+  if ( outgoing_.full() ) {
+    flush_datagrams();
+  }
+}
+
+void DatagrumpSender::flush_datagrams( void )
+{
+  if ( outgoing_.empty() ) {
+    return;
+  }
+
+  socket_.send_batch( outgoing_ );
+
+  if ( telemetry_ ) {
+    telemetry_->record( TelemetryLog::EventType::Flush, timestamp_us(),
+			0, 0, pending_sends_.size() );
+  }
+
+  /* Inform congestion controller, with the timestamp each datagram carried */
+  for ( const auto & sent : pending_sends_ ) {
+    controller_->datagram_was_sent( sent.first, sent.second );
+  }
+
+  pending_sends_.clear();
 }
 
 void DatagrumpSender::send_datagram( void )
 {
-  /* All messages use the same dummy payload */
-  static const string dummy_payload( 1424, 'x' );
+  queue_datagram( timestamp_us() );
+  flush_datagrams();
+}
+
+/* send as much as the window and the pacing schedule allow, as one batch */
+void DatagrumpSender::send_window( void )
+{
+  const uint64_t now = timestamp_us();
 
-  ContestMessage cm( sequence_number_++, dummy_payload );
-  cm.set_send_timestamp();
-  socket_.send( cm.to_string() );
+  while ( window_is_open() and release_is_due( now ) ) {
+    queue_datagram( schedule_release( now ) );
+  }
 
-  /* Inform congestion controller */
-  controller_.datagram_was_sent( cm.header.sequence_number,
-				 cm.header.send_timestamp );
+  flush_datagrams();
 }
 
 bool DatagrumpSender::window_is_open( void )
 {
-  return sequence_number_ - next_ack_expected_ < controller_.window_size();
+  return not scoreboard_.full()
+    and scoreboard_.in_flight() < controller_->window_size();
+}
+
+/* may the next datagram be handed to the kernel now? */
+bool DatagrumpSender::release_is_due( const uint64_t now )
+{
+  return next_release_us_ <= now + (kernel_pacing_ ? KERNEL_PACING_HORIZON_US : 0);
+}
+
+/* advance the pacing schedule by one datagram, returning when that datagram may leave */
+uint64_t DatagrumpSender::schedule_release( const uint64_t now )
+{
+  const double rate = controller_->pacing_rate();
+  if ( rate <= 0 ) {
+    next_release_us_ = now;
+    return now;
+  }
+
+  const uint64_t release = max( next_release_us_, now - min( now, PACING_SLACK_US ) );
+  next_release_us_ = release + uint64_t( 1000000.0 / rate );
+
+  return max( release, now );
+}
+
+/* if pacing is holding back an open window, wake up when the next datagram is due */
+void DatagrumpSender::arm_release_timer( Poller & poller )
+{
+  if ( release_timer_pending_ or not window_is_open() ) {
+    return;
+  }
+
+  const uint64_t now = timestamp_us();
+  if ( release_is_due( now ) ) {
+    return;
+  }
+
+  release_timer_pending_ = true;
+  poller.add_timer( next_release_us_ - now
+		    - (kernel_pacing_ ? KERNEL_PACING_HORIZON_US : 0), [&] () {
+      release_timer_pending_ = false;
+      send_window();
+      return ResultType::Continue;
+    } );
+}
+
+/* if datagrams might be lost with no more acks to show it, wake up to check */
+void DatagrumpSender::arm_loss_timer( Poller & poller )
+{
+  const uint64_t deadline = scoreboard_.next_loss_time();
+  if ( deadline >= loss_timer_deadline_ ) {
+    return;
+  }
+
+  /* (a deadline of UINT64_MAX means no loss timer is pending, so there's
+     none to cancel, whatever id the Poller gives its other timers) */
+  if ( loss_timer_deadline_ != numeric_limits<uint64_t>::max() ) {
+    poller.cancel_timer( loss_timer_id_ );
+  }
+  loss_timer_deadline_ = deadline;
+
+  const uint64_t now = timestamp_us();
+  loss_timer_id_ = poller.add_timer( deadline > now ? deadline - now : 0, [&] () {
+      loss_timer_deadline_ = numeric_limits<uint64_t>::max();
+      detect_losses( timestamp_us() );
+      return ResultType::Continue;
+    } );
 }
 
 int DatagrumpSender::loop( void )
 {
+  /* with a telemetry log, take SIGINT and SIGTERM as a request to quit
+     normally, so that the log is flushed and finished on the way out */
+  unique_ptr<FileDescriptor> signal_fd;
+  if ( telemetry_ ) {
+    sigset_t signals;
+    SystemCall( "sigemptyset", sigemptyset( &signals ) );
+    SystemCall( "sigaddset", sigaddset( &signals, SIGINT ) );
+    SystemCall( "sigaddset", sigaddset( &signals, SIGTERM ) );
+    SystemCall( "sigprocmask", sigprocmask( SIG_BLOCK, &signals, nullptr ) );
+    signal_fd.reset( new FileDescriptor( SystemCall( "signalfd",
+						     signalfd( -1, &signals, SFD_CLOEXEC ) ) ) );
+  }
+
   /* read and write from the receiver using an event-driven "poller" */
-  Poller poller;
+  Poller poller( io_uring_ ? Poller::Backend::IOUring : Poller::Backend::Poll );
+
+  if ( signal_fd ) {
+    poller.add_action( Action( *signal_fd, Direction::In, [&] () {
+	  signal_fd->read();
+	  return ResultType::Exit;
+	} ) );
+  }
 
   /* first rule: if the window is open, close it by
-     sending more datagrams */
+     sending more datagrams (as fast as the pacing schedule allows) */
   poller.add_action( Action( socket_, Direction::Out, [&] () {
-	/* Close the window */
-	while ( window_is_open() ) {
-	  send_datagram();
-	}
+	send_window();
 	return ResultType::Continue;
       },
-      /* We're only interested in this rule when the window is open */
-      [&] () { return window_is_open(); } ) );
+      /* We're only interested in this rule when the window is open
+	 and the next datagram is due */
+      [&] () { return window_is_open() and release_is_due( timestamp_us() ); } ) );
+
+  /* with transmit timestamps, correct each datagram's send time as soon
+     as the kernel has it (and before any ack for it is processed); quit
+     on a socket error, as the poller would without this rule */
+  if ( tx_timestamps_ ) {
+    poller.add_action( Action( socket_, Direction::Error, [&] () {
+	  const bool ok = socket_.recv_tx_timestamps( [&] ( const uint64_t sequence_number,
+							    const uint64_t timestamp ) {
+							got_tx_timestamp( sequence_number, timestamp );
+						      } );
+	  return ok ? ResultType::Continue : ResultType::Exit;
+	} ) );
+
+    poller.add_timer( TX_QUEUEING_REPORT_INTERVAL_US, [&] () {
+	report_tx_queueing();
+	return ResultType::Continue;
+      }, TX_QUEUEING_REPORT_INTERVAL_US );
+  }
 
   /* second rule: if sender receives an ack,
      process it and inform the controller
      (by using the sender's got_ack method) */
-  poller.add_action( Action( socket_, Direction::In, [&] () {
-	const UDPSocket::received_datagram recd = socket_.recv();
-	const ContestMessage ack  = recd.payload;
-	got_ack( recd.timestamp, ack );
+  UDPSocket::RecvBatch acks( ACK_BATCH_SIZE, pool_ );
+  Stats & stats = Stats::thread();
+  poller.add_datagram_action( socket_, acks, [&] () {
+	for ( size_t i = 0; i < acks.size(); i++ ) {
+	  const uint64_t parse_start_ns = Stats::now_ns();
+	  const ContestMessageView ack( acks.payload( i ), acks.payload_length( i ) );
+	  stats.record( Stats::Parse, Stats::now_ns() - parse_start_ns );
+
+	  got_ack( acks.timestamp( i ), ack );
+	}
 	return ResultType::Continue;
-      } ) );
+      } );
 
-  /* Run these two rules forever */
+  /* Run these two rules forever, plus timers whenever pacing holds back
+     the window or loss detection is waiting on the clock */
   while ( true ) {
-    const auto ret = poller.poll( controller_.timeout_ms() );
+    arm_release_timer( poller );
+    arm_loss_timer( poller );
+
+    const auto ret = poller.poll( controller_->timeout_ms() );
     if ( ret.result == PollResult::Exit ) {
       return ret.exit_status;
     } else if ( ret.result == PollResult::Timeout ) {
-      /* After a timeout, send one datagram to try to get things moving again */
-      controller_.timeout_();
+      /* After a timeout, give up on whatever was sent before it began,
+	 and send one datagram to try to get things moving again */
+      const uint64_t now = timestamp_us();
+      const uint64_t abandoned
+	= scoreboard_.abandon( now - min( now, controller_->timeout_ms() * uint64_t( 1000 ) ) );
+      controller_->timeout_( abandoned );
       send_datagram();
     }
   }
@@ -0,0 +1,178 @@
+#include <algorithm>
+#include <limits>
+
+#include "simulation.hh"
+
+using namespace std;
+
+/* as in sender.cc: each datagram's size (48-byte header plus dummy
+   payload), and how far the pacing schedule may fall behind */
+static const size_t DATAGRAM_SIZE = 1472;
+static const uint64_t PACING_SLACK_US = 1000;
+
+/* as in the emulator: IPv4 and UDP headers, which take up room on the link too */
+static const size_t HEADER_OVERHEAD = 28;
+
+Simulation::Simulation( const Config & config, unique_ptr<Controller> && controller,
+			ostream * uplink_log )
+  : config_( config ),
+    controller_( move( controller ) ),
+    now_( 0 ),
+    pool_( ContestMessage::Header::WIRE_SIZE ),
+    uplink_score_(),
+    uplink_( config.uplink_trace, 0, config.delay_ms * 1000, config.queue_limit,
+	     uplink_log, &uplink_score_ ),
+    downlink_( config.downlink_trace, 0, config.delay_ms * 1000, config.queue_limit ),
+    sequence_number_( 0 ),
+    scoreboard_(),
+    next_release_us_( 0 ),
+    last_activity_us_( 0 ),
+    timeouts_( 0 ),
+    ack_sequence_number_( 0 )
+{
+  uplink_.log_header( "simulation", 0 );
+  uplink_score_.base_timestamp( 0 );
+}
+
+void Simulation::send_datagram( void )
+{
+  ContestMessage::Header header( sequence_number_++ );
+  header.set_send_timestamp();
+
+  /* only the header goes along the link; the size stands for the rest */
+  PacketPool::Buffer contents = pool_.get();
+  header.serialize( contents.data() );
+  contents.set_length( ContestMessage::Header::WIRE_SIZE );
+
+  scoreboard_.sent( header.sequence_number, header.send_timestamp, DATAGRAM_SIZE );
+  controller_->datagram_was_sent( header.sequence_number, header.send_timestamp );
+
+  uplink_.send( now_, { DATAGRAM_SIZE + HEADER_OVERHEAD, move( contents ) } );
+  last_activity_us_ = now_;
+}
+
+/* send as much as the window and the pacing schedule allow */
+void Simulation::send_window( void )
+{
+  while ( window_is_open() and release_is_due() ) {
+    const double rate = controller_->pacing_rate();
+    if ( rate <= 0 ) {
+      next_release_us_ = now_;
+    } else {
+      next_release_us_ = max( next_release_us_, now_ - min( now_, PACING_SLACK_US ) )
+	+ uint64_t( 1000000.0 / rate );
+    }
+
+    send_datagram();
+  }
+}
+
+bool Simulation::window_is_open( void )
+{
+  return not scoreboard_.full()
+    and scoreboard_.in_flight() < controller_->window_size();
+}
+
+void Simulation::detect_losses( void )
+{
+  scoreboard_.detect_losses( now_, [&] ( const uint64_t sequence_number,
+					 const Scoreboard::Datagram & datagram ) {
+			       controller_->datagram_was_lost( sequence_number,
+							       datagram.send_timestamp, now_ );
+			     } );
+}
+
+/* the receiver acks each datagram as it comes off the uplink */
+void Simulation::receive( const uint64_t time, LinkQueue::Packet & packet )
+{
+  ContestMessage::Header ack( packet.contents.data(), packet.contents.length() );
+  ack.transform_into_ack( ack_sequence_number_++, time,
+			  DATAGRAM_SIZE - ContestMessage::Header::WIRE_SIZE );
+  ack.send_timestamp = time;
+  ack.serialize( packet.contents.data() );
+
+  downlink_.send( time, { ContestMessage::Header::WIRE_SIZE + HEADER_OVERHEAD,
+			  move( packet.contents ) } );
+}
+
+void Simulation::got_ack( const uint64_t time, LinkQueue::Packet & packet )
+{
+  const ContestMessageView ack( packet.contents );
+
+  scoreboard_.acked( ack.header.ack_sequence_number, time );
+
+  controller_->ack_received( ack.header.ack_sequence_number,
+			    ack.header.ack_send_timestamp,
+			    ack.header.ack_recv_timestamp,
+			    time );
+
+  detect_losses();
+  last_activity_us_ = time;
+}
+
+void Simulation::advance_links( void )
+{
+  uplink_.advance( now_, [&] ( const uint64_t time, LinkQueue::Packet & packet ) {
+      receive( time, packet );
+    } );
+
+  downlink_.advance( now_, [&] ( const uint64_t time, LinkQueue::Packet & packet ) {
+      got_ack( time, packet );
+    } );
+}
+
+uint64_t Simulation::next_sender_event( void )
+{
+  /* a datagram might be judged lost, or pacing release the next one */
+  uint64_t ret = scoreboard_.next_loss_time();
+  if ( window_is_open() ) {
+    ret = min( ret, next_release_us_ );
+  }
+
+  /* or with nothing else going on, the sender times out */
+  return min( ret, last_activity_us_ + controller_->timeout_ms() * uint64_t( 1000 ) );
+}
+
+void Simulation::run( void )
+{
+  VirtualClock clock( now_ );
+
+  const uint64_t end_us = ( config_.duration_ms ? config_.duration_ms
+			    : config_.uplink_trace->period_ms() ) * 1000;
+
+  while ( now_ < end_us ) {
+    clock.set( now_ );
+
+    advance_links();
+
+    /* the same steps as one turn of the sender's loop */
+    if ( now_ >= scoreboard_.next_loss_time() ) {
+      detect_losses();
+      last_activity_us_ = now_;
+    }
+
+    const uint64_t timeout_us = controller_->timeout_ms() * uint64_t( 1000 );
+    if ( now_ >= last_activity_us_ + timeout_us ) {
+      /* give up on whatever was sent before the timeout began,
+	 and send one datagram to try to get things moving again */
+      controller_->timeout_( scoreboard_.abandon( now_ - min( now_, timeout_us ) ) );
+      timeouts_++;
+      send_datagram();
+    }
+
+    send_window();
+
+    /* jump to the next thing to happen (but never stand still) */
+    const uint64_t next = min( { uplink_.next_event_time(),
+				 downlink_.next_event_time(),
+				 next_sender_event() } );
+    now_ = max( next, now_ + 1 );
+  }
+
+  /* count the link's capacity right up to the end */
+  now_ = end_us;
+  clock.set( now_ );
+  advance_links();
+
+  uplink_score_.finish();
+}
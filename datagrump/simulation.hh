@@ -0,0 +1,94 @@
+#ifndef SIMULATION_HH
+#define SIMULATION_HH
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+#include "controller.hh"
+#include "contest_message.hh"
+#include "link_queue.hh"
+#include "packet_pool.hh"
+#include "score.hh"
+#include "scoreboard.hh"
+#include "timestamp.hh"
+
+/* The contest in one process and in virtual time: the sender's window,
+   pacing, loss detection and timeouts around a Controller (as in
+   sender.cc), an emulated link each way (as in the emulator), and the
+   receiver's acks. Each step jumps the clock straight to the next thing
+   that happens, and nothing depends on the real clock or on scheduling,
+   so a run takes milliseconds and the same configuration always gives
+   the same result. Controllers see the simulated time through
+   timestamp_us() as well. */
+class Simulation
+{
+public:
+  struct Config
+  {
+    std::shared_ptr<const PacketTrace> uplink_trace, downlink_trace;
+    uint64_t delay_ms;    /* one-way propagation delay, each way */
+    size_t queue_limit;   /* in packets, each way (0 for no limit) */
+    uint64_t duration_ms; /* 0 for one pass through the uplink trace */
+  };
+
+private:
+  Config config_;
+  std::unique_ptr<Controller> controller_;
+
+  /* the simulated time (which timestamp_us() tells, while run() is running) */
+  uint64_t now_;
+
+  /* each datagram's header travels in a slot of its own */
+  PacketPool pool_;
+
+  LinkScore uplink_score_;
+  LinkQueue uplink_, downlink_;
+
+  /* sender */
+  uint64_t sequence_number_;
+  Scoreboard scoreboard_;
+  uint64_t next_release_us_;
+  uint64_t last_activity_us_; /* for the timeout: when there was last anything to do */
+  uint64_t timeouts_;
+
+  /* receiver */
+  uint64_t ack_sequence_number_;
+
+  void send_datagram( void );
+  void send_window( void );
+  bool window_is_open( void );
+  bool release_is_due( void ) const { return next_release_us_ <= now_; }
+  void detect_losses( void );
+
+  void receive( const uint64_t time, LinkQueue::Packet & packet );
+  void got_ack( const uint64_t time, LinkQueue::Packet & packet );
+
+  /* run both links up to the present */
+  void advance_links( void );
+
+  /* when the sender next has something to do on its own (UINT64_MAX if never) */
+  uint64_t next_sender_event( void );
+
+public:
+  /* the uplink (but not the downlink) may also be logged, in mahimahi's format */
+  Simulation( const Config & config, std::unique_ptr<Controller> && controller,
+	      std::ostream * uplink_log = nullptr );
+
+  /* run until the configured duration is up (on one thread, although
+     simulations on different threads can run at once) */
+  void run( void );
+
+  /* the uplink's throughput and delay */
+  const LinkScore & uplink_score( void ) const { return uplink_score_; }
+
+  uint64_t datagrams_sent( void ) const { return sequence_number_; }
+  uint64_t datagrams_lost( void ) const { return scoreboard_.lost(); }
+  uint64_t timeouts( void ) const { return timeouts_; }
+
+  /* forbid copying, since the links call back into the simulation */
+  Simulation( const Simulation & other ) = delete;
+  const Simulation & operator=( const Simulation & other ) = delete;
+};
+
+#endif /* SIMULATION_HH */
@@ -0,0 +1,97 @@
+/* runs a congestion controller against trace-driven links in simulated
+   time (see simulation.hh), and scores the uplink as the analyzer would */
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+
+#include "simulation.hh"
+
+using namespace std;
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " UPLINK_TRACE DOWNLINK_TRACE [cc=ALGORITHM] [delay=MS] [queue=PACKETS]"
+       << " [duration=MS] [uplink-log=FILE] [debug] [cc-PARAMETER=VALUE]..." << endl;
+  cerr << "Algorithms:";
+  for ( const auto & name : Controller::algorithms() ) {
+    cerr << " " << name;
+  }
+  cerr << " (default " << Controller::default_algorithm << ")" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc < 3 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  string algorithm = Controller::default_algorithm, uplink_log_name;
+  Controller::Parameters parameters;
+  bool debug = false;
+
+  /* the defaults of run-contest: 20 ms each way, and no limit on the queue */
+  Simulation::Config config { make_shared<PacketTrace>( argv[ 1 ] ),
+			      make_shared<PacketTrace>( argv[ 2 ] ),
+			      20, 0, 0 };
+
+  for ( int i = 3; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option.substr( 0, 3 ) == "cc=" ) {
+      algorithm = option.substr( 3 );
+    } else if ( option.substr( 0, 6 ) == "delay=" ) {
+      config.delay_ms = stoull( option.substr( 6 ) );
+    } else if ( option.substr( 0, 6 ) == "queue=" ) {
+      config.queue_limit = stoull( option.substr( 6 ) );
+    } else if ( option.substr( 0, 9 ) == "duration=" ) {
+      config.duration_ms = stoull( option.substr( 9 ) );
+    } else if ( option.substr( 0, 11 ) == "uplink-log=" ) {
+      uplink_log_name = option.substr( 11 );
+    } else if ( option == "debug" ) {
+      debug = true;
+    } else if ( Controller::parse_parameter( option, parameters ) ) {
+      /* a tunable constant of the algorithm */
+    } else {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  unique_ptr<ofstream> uplink_log;
+  if ( not uplink_log_name.empty() ) {
+    uplink_log.reset( new ofstream( uplink_log_name ) );
+    if ( not uplink_log->good() ) {
+      throw runtime_error( uplink_log_name + ": error opening for writing" );
+    }
+  }
+
+  Simulation simulation( config, Controller::make( algorithm, debug, parameters ),
+			 uplink_log.get() );
+
+  const auto start = chrono::steady_clock::now();
+  simulation.run();
+  const auto end = chrono::steady_clock::now();
+
+  cout << simulation.uplink_score().summary();
+  cout << "Datagrams: " << simulation.datagrams_sent() << " sent, "
+       << simulation.datagrams_lost() << " judged lost, "
+       << simulation.timeouts() << " timeouts" << "\n";
+
+  /* (the only thing that varies from run to run, so it goes apart from the results) */
+  cerr << "Simulated " << simulation.uplink_score().duration_ms() << " ms in "
+       << fixed << setprecision( 1 )
+       << chrono::duration_cast<chrono::microseconds>( end - start ).count() / 1000.0
+       << " ms" << endl;
+
+  return EXIT_SUCCESS;
+}
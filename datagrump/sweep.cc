@@ -0,0 +1,298 @@
+/* tunes a congestion controller's constants: runs a simulation (see
+   simulation.hh) of every combination of parameter values, or of random
+   ones, on every trace, on all processors at once, and ranks them */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include "simulation.hh"
+#include "task_pool.hh"
+
+using namespace std;
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name
+       << " TRACE... [downlink=TRACE] [cc=ALGORITHM] [delay=MS] [queue=PACKETS] [duration=MS]"
+       << " [threads=N] [random=N] [seed=N] [top=N] [cc-PARAMETER=VALUES]..." << endl;
+  cerr << "Each trace is the uplink, and the downlink unless one is given. VALUES are" << endl
+       << "either a list (V1,V2,...) or a range (LOW:HIGH:COUNT), and every combination" << endl
+       << "is tried, or with random=N, N combinations drawn at random from them." << endl;
+  cerr << "Algorithms:";
+  for ( const auto & name : Controller::algorithms() ) {
+    cerr << " " << name;
+  }
+  cerr << " (default " << Controller::default_algorithm << ")" << endl;
+}
+
+/* the values to try for one parameter */
+struct Dimension
+{
+  string name;
+  vector<double> values;
+  bool range; /* (random draws come from anywhere between the ends) */
+};
+
+static double parse_number( const string & text )
+{
+  size_t parsed = 0;
+  const double ret = stod( text, &parsed );
+  if ( parsed != text.size() or not isfinite( ret ) ) {
+    throw runtime_error( "not a number: " + text );
+  }
+  return ret;
+}
+
+static Dimension parse_dimension( const string & name, const string & spec )
+{
+  Dimension ret { name, {}, false };
+
+  const auto colon = spec.find( ':' );
+  if ( colon == string::npos ) {
+    istringstream values( spec );
+    string value;
+    while ( getline( values, value, ',' ) ) {
+      ret.values.push_back( parse_number( value ) );
+    }
+  } else {
+    const auto second_colon = spec.find( ':', colon + 1 );
+    if ( second_colon == string::npos ) {
+      throw runtime_error( name + ": a range is LOW:HIGH:COUNT" );
+    }
+
+    const double low = parse_number( spec.substr( 0, colon ) );
+    const double high = parse_number( spec.substr( colon + 1, second_colon - colon - 1 ) );
+    const unsigned long count = stoul( spec.substr( second_colon + 1 ) );
+    if ( count == 0 ) {
+      throw runtime_error( name + ": a range needs at least one value" );
+    }
+
+    /* (random draws from a backwards range are undefined) */
+    if ( low > high ) {
+      throw runtime_error( name + ": a range goes from LOW up to HIGH" );
+    }
+
+    for ( unsigned long i = 0; i < count; i++ ) {
+      ret.values.push_back( count == 1 ? low : low + ( high - low ) * i / ( count - 1 ) );
+    }
+    ret.range = true;
+  }
+
+  if ( ret.values.empty() ) {
+    throw runtime_error( name + ": no values" );
+  }
+
+  return ret;
+}
+
+/* every combination of the values, the last parameter varying fastest */
+static vector<Controller::Parameters> grid( const vector<Dimension> & dimensions )
+{
+  vector<Controller::Parameters> ret( 1 );
+
+  for ( const auto & dimension : dimensions ) {
+    vector<Controller::Parameters> next;
+    for ( const auto & partial : ret ) {
+      for ( const double value : dimension.values ) {
+	next.push_back( partial );
+	next.back()[ dimension.name ] = value;
+      }
+    }
+    ret = move( next );
+  }
+
+  return ret;
+}
+
+static vector<Controller::Parameters> random_points( const vector<Dimension> & dimensions,
+						     const size_t count, const uint64_t seed )
+{
+  mt19937_64 generator( seed );
+  vector<Controller::Parameters> ret( count );
+
+  for ( auto & point : ret ) {
+    for ( const auto & dimension : dimensions ) {
+      if ( dimension.range ) {
+	uniform_real_distribution<double> draw( dimension.values.front(), dimension.values.back() );
+	point[ dimension.name ] = draw( generator );
+      } else {
+	uniform_int_distribution<size_t> draw( 0, dimension.values.size() - 1 );
+	point[ dimension.name ] = dimension.values.at( draw( generator ) );
+      }
+    }
+  }
+
+  return ret;
+}
+
+/* how one combination did on one trace */
+struct Result
+{
+  double throughput_mbps;
+  uint64_t delay_p95_ms;
+};
+
+/* how one combination did overall */
+struct Ranking
+{
+  size_t index; /* of the combination */
+  double throughput_mbps, delay_p95_ms; /* means over the traces */
+
+  /* geometric mean over the traces of the power (throughput over
+     95th-percentile delay, counting the delay as at least 1 ms), so a
+     trace with ten times the capacity doesn't count for ten times as much */
+  double score;
+};
+
+static string describe( const Controller::Parameters & parameters )
+{
+  ostringstream out;
+  for ( const auto & parameter : parameters ) {
+    out << ( out.tellp() > 0 ? " " : "" ) << parameter.first << "=" << parameter.second;
+  }
+  return out.str();
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  vector<string> trace_names;
+  string algorithm = Controller::default_algorithm, downlink_name;
+  uint64_t delay_ms = 20, duration_ms = 0;
+  size_t queue_limit = 0, threads = 0, random_count = 0, top = 20;
+  uint64_t seed = 0;
+  vector<Dimension> dimensions;
+
+  for ( int i = 1; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    const auto equals = option.find( '=' );
+    if ( equals == string::npos ) {
+      trace_names.push_back( option );
+    } else if ( option.substr( 0, 9 ) == "downlink=" ) {
+      downlink_name = option.substr( 9 );
+    } else if ( option.substr( 0, 3 ) == "cc=" ) {
+      algorithm = option.substr( 3 );
+    } else if ( option.substr( 0, 6 ) == "delay=" ) {
+      delay_ms = stoull( option.substr( 6 ) );
+    } else if ( option.substr( 0, 6 ) == "queue=" ) {
+      queue_limit = stoull( option.substr( 6 ) );
+    } else if ( option.substr( 0, 9 ) == "duration=" ) {
+      duration_ms = stoull( option.substr( 9 ) );
+    } else if ( option.substr( 0, 8 ) == "threads=" ) {
+      threads = stoull( option.substr( 8 ) );
+    } else if ( option.substr( 0, 7 ) == "random=" ) {
+      random_count = stoull( option.substr( 7 ) );
+    } else if ( option.substr( 0, 5 ) == "seed=" ) {
+      seed = stoull( option.substr( 5 ) );
+    } else if ( option.substr( 0, 4 ) == "top=" ) {
+      top = stoull( option.substr( 4 ) );
+    } else if ( option.substr( 0, 3 ) == "cc-" ) {
+      dimensions.push_back( parse_dimension( option.substr( 3, equals - 3 ),
+					     option.substr( equals + 1 ) ) );
+    } else {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( trace_names.empty() ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  /* each trace is loaded once, and shared by every simulation */
+  vector<shared_ptr<const PacketTrace>> traces;
+  for ( const auto & name : trace_names ) {
+    traces.push_back( make_shared<PacketTrace>( name ) );
+  }
+  const shared_ptr<const PacketTrace> downlink
+    = downlink_name.empty() ? nullptr : make_shared<PacketTrace>( downlink_name );
+
+  const vector<Controller::Parameters> points
+    = random_count ? random_points( dimensions, random_count, seed ) : grid( dimensions );
+
+  /* check the names and values before starting anything */
+  for ( const auto & point : points ) {
+    Controller::make( algorithm, false, point );
+  }
+
+  /* one task per simulation, each with a slot of its own for the result
+     (so the results don't depend on which worker ran what, or when) */
+  vector<Result> results( points.size() * traces.size() );
+
+  TaskPool pool( threads );
+  cerr << "Running " << results.size() << " simulations (" << points.size()
+       << " combinations, " << traces.size() << " traces) on "
+       << pool.size() << " threads..." << endl;
+
+  const auto start = chrono::steady_clock::now();
+
+  for ( size_t point = 0; point < points.size(); point++ ) {
+    for ( size_t trace = 0; trace < traces.size(); trace++ ) {
+      pool.submit( [&, point, trace] () {
+	  const Simulation::Config config { traces[ trace ],
+					    downlink ? downlink : traces[ trace ],
+					    delay_ms, queue_limit, duration_ms };
+	  Simulation simulation( config, Controller::make( algorithm, false, points[ point ] ) );
+	  simulation.run();
+
+	  results[ point * traces.size() + trace ]
+	    = { simulation.uplink_score().throughput_mbps(),
+		simulation.uplink_score().delay_percentile_ms( 0.95 ) };
+	} );
+    }
+  }
+
+  pool.wait();
+
+  const auto end = chrono::steady_clock::now();
+
+  vector<Ranking> rankings;
+  for ( size_t point = 0; point < points.size(); point++ ) {
+    Ranking ranking { point, 0, 0, 0 };
+    double log_power = 0;
+
+    for ( size_t trace = 0; trace < traces.size(); trace++ ) {
+      const Result & result = results[ point * traces.size() + trace ];
+      ranking.throughput_mbps += result.throughput_mbps / traces.size();
+      ranking.delay_p95_ms += double( result.delay_p95_ms ) / traces.size();
+      log_power += log( result.throughput_mbps
+			/ ( max( result.delay_p95_ms, uint64_t( 1 ) ) / 1000.0 ) );
+    }
+
+    ranking.score = exp( log_power / traces.size() );
+    rankings.push_back( ranking );
+  }
+
+  /* best first (and in the order tried, among equals) */
+  stable_sort( rankings.begin(), rankings.end(),
+	       [] ( const Ranking & a, const Ranking & b ) { return a.score > b.score; } );
+
+  cerr << "Finished in " << fixed << setprecision( 1 )
+       << chrono::duration_cast<chrono::milliseconds>( end - start ).count() / 1000.0
+       << " s" << endl;
+
+  cout << "rank  throughput (Mbits/s)  p95 delay (ms)     score  parameters" << "\n";
+  for ( size_t i = 0; i < min( top ? top : rankings.size(), rankings.size() ); i++ ) {
+    const Ranking & ranking = rankings[ i ];
+    cout << fixed << setw( 4 ) << i + 1
+	 << setprecision( 2 ) << setw( 22 ) << ranking.throughput_mbps
+	 << setprecision( 1 ) << setw( 16 ) << ranking.delay_p95_ms
+	 << setprecision( 2 ) << setw( 10 ) << ranking.score
+	 << "  " << describe( points[ ranking.index ] ) << "\n";
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "telemetry.hh"
+#include "util.hh"
+
+using namespace std;
+
+const char TelemetryLog::MAGIC[ 8 ] = { 'D', 'G', 'T', 'E', 'L', 'E', 'M', '\0' };
+const uint32_t TelemetryLog::VERSION;
+
+/* how often the flushing thread wakes up */
+static const chrono::milliseconds FLUSH_INTERVAL { 10 };
+
+/* how much of the file is mapped in at once (a multiple of the page size) */
+static const size_t WINDOW_SIZE = 4 << 20;
+
+static size_t round_up_to_power_of_two( const size_t n )
+{
+  size_t ret = 1;
+  while ( ret < n ) {
+    ret <<= 1;
+  }
+  return ret;
+}
+
+const char * TelemetryLog::type_name( const EventType type )
+{
+  switch ( type ) {
+  case EventType::None: return "none";
+  case EventType::Sent: return "sent";
+  case EventType::Ack: return "ack";
+  case EventType::Lost: return "lost";
+  case EventType::Window: return "window";
+  case EventType::Timeout: return "timeout";
+  case EventType::Flush: return "flush";
+  case EventType::TxQueueing: return "tx-queueing";
+  }
+
+  return "unknown";
+}
+
+TelemetryLog::TelemetryLog( const string & filename, const size_t ring_events )
+  : ring_( round_up_to_power_of_two( ring_events ) ),
+    mask_( ring_.size() - 1 ),
+    padding_before_(),
+    tail_( 0 ),
+    cached_head_( 0 ),
+    dropped_( 0 ),
+    padding_after_(),
+    head_( 0 ),
+    file_( SystemCall( "open " + filename,
+		       open( filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) ),
+    window_( nullptr ),
+    window_offset_( 0 ),
+    window_used_( 0 ),
+    written_( 0 ),
+    mutex_(),
+    wake_(),
+    stopping_( false ),
+    flusher_()
+{
+  static_assert( sizeof( Event ) == 32, "Event is not packed" );
+  static_assert( sizeof( FileHeader ) == 32, "FileHeader is not packed" );
+
+  map_window();
+
+  /* a header with no count yet, filled in when the log is closed */
+  FileHeader header;
+  zero( header );
+  memcpy( header.magic, MAGIC, sizeof( header.magic ) );
+  header.version = VERSION;
+  header.event_size = sizeof( Event );
+  append( reinterpret_cast<const char *>( &header ), sizeof( header ) );
+
+  flusher_ = thread( [&] () { flush_loop(); } );
+}
+
+TelemetryLog::~TelemetryLog()
+{
+  {
+    unique_lock<mutex> lock( mutex_ );
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  flusher_.join();
+
+  try {
+    munmap( window_, WINDOW_SIZE );
+
+    const uint64_t length = sizeof( FileHeader ) + written_ * sizeof( Event );
+    SystemCall( "ftruncate", ftruncate( file_.fd_num(), length ) );
+
+    FileHeader header;
+    zero( header );
+    memcpy( header.magic, MAGIC, sizeof( header.magic ) );
+    header.version = VERSION;
+    header.event_size = sizeof( Event );
+    header.events = written_;
+    header.dropped = dropped_;
+    SystemCall( "pwrite", pwrite( file_.fd_num(), &header, sizeof( header ), 0 ) );
+  } catch ( const exception & e ) { /* don't throw from destructor */
+    print_exception( e );
+  }
+}
+
+/* grow the file by a window's worth, and map that part in */
+void TelemetryLog::map_window( void )
+{
+  SystemCall( "ftruncate", ftruncate( file_.fd_num(), window_offset_ + WINDOW_SIZE ) );
+
+  void * const window = mmap( nullptr, WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+			      file_.fd_num(), window_offset_ );
+  if ( window == MAP_FAILED ) {
+    throw unix_error( "mmap" );
+  }
+
+  window_ = static_cast<char *>( window );
+  window_used_ = 0;
+}
+
+void TelemetryLog::append( const char * data, size_t length )
+{
+  while ( length > 0 ) {
+    if ( window_used_ == WINDOW_SIZE ) {
+      munmap( window_, WINDOW_SIZE );
+      window_offset_ += WINDOW_SIZE;
+      map_window();
+    }
+
+    const size_t amount = min( length, WINDOW_SIZE - window_used_ );
+    memcpy( window_ + window_used_, data, amount );
+    window_used_ += amount;
+    data += amount;
+    length -= amount;
+  }
+}
+
+/* copy everything recorded so far into the file */
+void TelemetryLog::drain( void )
+{
+  const uint64_t head = head_.load( memory_order_relaxed );
+  const uint64_t tail = tail_.load( memory_order_acquire );
+
+  /* the events may wrap around the end of the ring */
+  for ( uint64_t position = head; position < tail; ) {
+    const uint64_t index = position & mask_;
+    const uint64_t count = min( tail - position, ring_.size() - index );
+    append( reinterpret_cast<const char *>( &ring_[ index ] ), count * sizeof( Event ) );
+    position += count;
+  }
+
+  written_ += tail - head;
+  head_.store( tail, memory_order_release );
+}
+
+void TelemetryLog::flush_loop( void )
+{
+  /* leave signals to the recording thread (which may want to quit cleanly on one) */
+  sigset_t signals;
+  sigfillset( &signals );
+  pthread_sigmask( SIG_BLOCK, &signals, nullptr );
+
+  try {
+    unique_lock<mutex> lock( mutex_ );
+    while ( true ) {
+      wake_.wait_for( lock, FLUSH_INTERVAL, [&] () { return stopping_; } );
+      const bool stopping = stopping_;
+
+      lock.unlock();
+      drain();
+      lock.lock();
+
+      if ( stopping ) {
+	return;
+      }
+    }
+  } catch ( const exception & e ) {
+    /* (the ring fills up, and the sender carries on without the log) */
+    print_exception( e );
+  }
+}
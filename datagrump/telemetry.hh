@@ -0,0 +1,128 @@
+#ifndef TELEMETRY_HH
+#define TELEMETRY_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "file_descriptor.hh"
+
+/* A binary log of the sender's and controller's events (sends, acks,
+   losses, window changes, timeouts), cheap enough to leave on while
+   measuring: record() copies a fixed-size event into a preallocated
+   ring, with no locks, system calls or formatting, and a thread of the
+   log's own copies what has accumulated into a memory-mapped file every
+   few milliseconds. If that thread falls a whole ring behind, events
+   are dropped (and counted) rather than holding up the sender.
+
+   One thread records (the ring is single-producer, single-consumer).
+   The file is a FileHeader followed by the events; telemetry-decoder
+   turns it into CSV. */
+class TelemetryLog
+{
+public:
+  enum class EventType : uint16_t {
+    None = 0,   /* (never recorded: marks the end of a file cut short) */
+    Sent,       /* sequence number and send timestamp */
+    Ack,        /* the datagram acked and when it was sent; value is the RTT (us) */
+    Lost,       /* the datagram judged lost and when it was sent */
+    Window,     /* value is the new window (datagrams) */
+    Timeout,    /* value is how many datagrams in flight were given up on */
+    Flush,      /* value is how many datagrams one system call handed over */
+    TxQueueing, /* the kernel's transmit timestamp of a datagram, and when it
+		   was handed over; value is the difference (us) */
+  };
+
+  static const char * type_name( const EventType type );
+
+  struct Event
+  {
+    uint64_t time_us;           /* when it happened (sender's clock) */
+    uint64_t sequence_number;   /* of the datagram concerned, if any */
+    uint64_t send_timestamp_us; /* when that datagram was sent */
+    uint32_t value;             /* as for the type */
+    uint16_t type;
+    uint16_t reserved;
+  };
+
+  struct FileHeader
+  {
+    char magic[ 8 ];
+    uint32_t version;
+    uint32_t event_size;
+    uint64_t events;  /* in the file (0 if it was never closed) */
+    uint64_t dropped; /* for want of room in the ring */
+  };
+
+  static const char MAGIC[ 8 ];
+  static const uint32_t VERSION = 1;
+
+private:
+  std::vector<Event> ring_;
+  uint64_t mask_;
+
+  /* the recording thread's side (with a padding line each side, so the
+     two threads don't keep taking the cache line from each other) */
+  char padding_before_[ 64 ];
+  std::atomic<uint64_t> tail_;
+  uint64_t cached_head_; /* the head as last read, which is all most records need */
+  uint64_t dropped_;
+  char padding_after_[ 64 ];
+
+  /* the flushing thread's side */
+  std::atomic<uint64_t> head_;
+
+  FileDescriptor file_;
+  char * window_;         /* the part of the file mapped in */
+  uint64_t window_offset_;
+  size_t window_used_;
+  uint64_t written_;      /* events in the file */
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_;
+  std::thread flusher_;
+
+  void flush_loop( void );
+  void drain( void );
+  void append( const char * data, size_t length );
+  void map_window( void );
+
+public:
+  /* the ring holds ring_events events (rounded up to a power of two) */
+  TelemetryLog( const std::string & filename, const size_t ring_events = 1 << 16 );
+
+  /* flushes everything recorded, and finishes the file */
+  ~TelemetryLog();
+
+  void record( const EventType type, const uint64_t time_us,
+	       const uint64_t sequence_number = 0,
+	       const uint64_t send_timestamp_us = 0,
+	       const uint32_t value = 0 )
+  {
+    const uint64_t tail = tail_.load( std::memory_order_relaxed );
+    if ( tail - cached_head_ == ring_.size() ) {
+      cached_head_ = head_.load( std::memory_order_acquire );
+      if ( tail - cached_head_ == ring_.size() ) {
+	dropped_++;
+	return;
+      }
+    }
+
+    ring_[ tail & mask_ ] = { time_us, sequence_number, send_timestamp_us, value,
+			      static_cast<uint16_t>( type ), 0 };
+    tail_.store( tail + 1, std::memory_order_release );
+  }
+
+  uint64_t dropped( void ) const { return dropped_; }
+
+  /* forbid copying, since the flushing thread refers to this one */
+  TelemetryLog( const TelemetryLog & other ) = delete;
+  const TelemetryLog & operator=( const TelemetryLog & other ) = delete;
+};
+
+#endif /* TELEMETRY_HH */
@@ -0,0 +1,119 @@
+/* turns a sender's binary telemetry log (see telemetry.hh) into CSV,
+   one row per event, for plotting */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "telemetry.hh"
+
+using namespace std;
+
+/* events to read at a time */
+static const size_t READ_BATCH_SIZE = 4096;
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name << " LOG [csv=FILE|-]" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc < 2 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  string csv_name = "-";
+  for ( int i = 2; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option.substr( 0, 4 ) == "csv=" ) {
+      csv_name = option.substr( 4 );
+    } else {
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  const string log_name { argv[ 1 ] };
+  ifstream log( log_name, ios::binary );
+  if ( not log.good() ) {
+    throw runtime_error( log_name + ": error opening for reading" );
+  }
+
+  TelemetryLog::FileHeader header;
+  if ( not log.read( reinterpret_cast<char *>( &header ), sizeof( header ) )
+       or memcmp( header.magic, TelemetryLog::MAGIC, sizeof( header.magic ) ) ) {
+    throw runtime_error( log_name + ": not a telemetry log" );
+  }
+
+  if ( header.version != TelemetryLog::VERSION
+       or header.event_size != sizeof( TelemetryLog::Event ) ) {
+    throw runtime_error( log_name + ": unsupported version of the telemetry log" );
+  }
+
+  unique_ptr<ofstream> csv_file;
+  ostream * csv = &cout;
+  if ( csv_name != "-" ) {
+    csv_file.reset( new ofstream( csv_name ) );
+    if ( not csv_file->good() ) {
+      throw runtime_error( csv_name + ": error opening for writing" );
+    }
+    csv = csv_file.get();
+  }
+
+  *csv << "time_us,event,sequence_number,send_timestamp_us,value" << "\n";
+
+  /* a log that was never closed (the sender was killed) runs until the
+     first blank event, and may be missing its last few milliseconds */
+  vector<TelemetryLog::Event> events( READ_BATCH_SIZE );
+  uint64_t count = 0;
+  bool finished = false;
+  while ( not finished ) {
+    log.read( reinterpret_cast<char *>( events.data() ),
+	      events.size() * sizeof( TelemetryLog::Event ) );
+    const size_t batch = log.gcount() / sizeof( TelemetryLog::Event );
+    if ( batch < events.size() ) {
+      finished = true;
+    }
+
+    for ( size_t i = 0; i < batch; i++ ) {
+      const TelemetryLog::Event & event = events[ i ];
+      const auto type = static_cast<TelemetryLog::EventType>( event.type );
+      if ( type == TelemetryLog::EventType::None ) {
+	finished = true;
+	break;
+      }
+
+      *csv << event.time_us << ","
+	   << TelemetryLog::type_name( type ) << ","
+	   << event.sequence_number << ","
+	   << event.send_timestamp_us << ","
+	   << event.value << "\n";
+      count++;
+    }
+  }
+
+  if ( not csv->good() ) {
+    throw runtime_error( csv_name + ": error writing" );
+  }
+
+  cerr << count << " events";
+  if ( header.events == 0 and count > 0 ) {
+    cerr << " (the log was not closed, so it may be missing the last few)";
+  } else if ( header.events != count ) {
+    cerr << " (but the header says " << header.events << ")";
+  }
+  cerr << ", " << header.dropped << " dropped for want of room in the ring" << endl;
+
+  return EXIT_SUCCESS;
+}
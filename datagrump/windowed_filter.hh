@@ -0,0 +1,86 @@
+#ifndef WINDOWED_FILTER_HH
+#define WINDOWED_FILTER_HH
+
+#include <cstdint>
+#include <functional>
+
+/* Running minimum or maximum of a measurement over a sliding window
+   (of time, or of round trips), using Kathleen Nichols' algorithm:
+   keep the best, second-best and third-best samples from successive
+   quarters of the window, so each update takes constant time and space.
+
+   Compare is std::greater_equal for a windowed max,
+   std::less_equal for a windowed min. */
+
+template <typename T, typename Compare>
+class WindowedFilter
+{
+private:
+  struct Sample
+  {
+    uint64_t time;
+    T value;
+  };
+
+  uint64_t window_;
+  Sample estimates_[ 3 ];
+  bool empty_;
+  Compare at_least_as_good_;
+
+public:
+  WindowedFilter( const uint64_t window )
+    : window_( window ), estimates_(), empty_( true ), at_least_as_good_()
+  {}
+
+  /* forget every sample and start over from this one */
+  void reset( const uint64_t time, const T & value )
+  {
+    estimates_[ 0 ] = estimates_[ 1 ] = estimates_[ 2 ] = Sample { time, value };
+    empty_ = false;
+  }
+
+  void update( const uint64_t time, const T & value )
+  {
+    const Sample sample { time, value };
+
+    if ( empty_
+	 or at_least_as_good_( value, estimates_[ 0 ].value )
+	 or time - estimates_[ 2 ].time > window_ ) {
+      reset( time, value );
+      return;
+    }
+
+    if ( at_least_as_good_( value, estimates_[ 1 ].value ) ) {
+      estimates_[ 2 ] = estimates_[ 1 ] = sample;
+    } else if ( at_least_as_good_( value, estimates_[ 2 ].value ) ) {
+      estimates_[ 2 ] = sample;
+    }
+
+    /* age out the best sample once it falls out of the window,
+       and keep the runners-up spread across the window */
+    const uint64_t age = time - estimates_[ 0 ].time;
+    if ( age > window_ ) {
+      estimates_[ 0 ] = estimates_[ 1 ];
+      estimates_[ 1 ] = estimates_[ 2 ];
+      estimates_[ 2 ] = sample;
+      if ( time - estimates_[ 0 ].time > window_ ) {
+	estimates_[ 0 ] = estimates_[ 1 ];
+	estimates_[ 1 ] = estimates_[ 2 ];
+      }
+    } else if ( estimates_[ 1 ].time == estimates_[ 0 ].time and age > window_ / 4 ) {
+      estimates_[ 2 ] = estimates_[ 1 ] = sample;
+    } else if ( estimates_[ 2 ].time == estimates_[ 1 ].time and age > window_ / 2 ) {
+      estimates_[ 2 ] = sample;
+    }
+  }
+
+  bool empty( void ) const { return empty_; }
+
+  /* best value within the window */
+  const T & best( void ) const { return estimates_[ 0 ].value; }
+};
+
+template <typename T> using WindowedMaxFilter = WindowedFilter<T, std::greater_equal<T>>;
+template <typename T> using WindowedMinFilter = WindowedFilter<T, std::less_equal<T>>;
+
+#endif /* WINDOWED_FILTER_HH */
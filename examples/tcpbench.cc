@@ -0,0 +1,391 @@
+/* load generator for tcpserver: keeps many connections busy with
+   requests (lines), and reports connections and requests per second */
+
+/* Each thread runs an event loop with its share of the connections,
+   each of which keeps a given number of requests in flight (sending
+   another as each response comes back). With requests-per-connection=K,
+   a connection closes after K responses and a new one takes its place,
+   which measures how fast connections can be set up and torn down. */
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <signal.h>
+
+#include "socket.hh"
+#include "poller.hh"
+#include "stats.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+/* most to read from a connection at once */
+static const size_t READ_SIZE = 64 * 1024;
+
+struct BenchmarkConfig
+{
+  Address server;
+  unsigned int connections;  /* open at once, on this thread */
+  unsigned int pipeline;     /* requests in flight on each */
+  unsigned int requests_per_connection; /* before closing it (0 for never) */
+  uint64_t duration_us;
+  string request;
+};
+
+class Client
+{
+private:
+  unique_ptr<TCPSocket> socket_;
+  bool connected_;
+  string output_;
+  deque<uint64_t> sent_ns_; /* when each request in flight was sent */
+  unsigned int requests_sent_;
+
+public:
+  Client( const Address & server );
+
+  TCPSocket & socket( void ) { return *socket_; }
+  bool connected( void ) const { return connected_; }
+  bool sending( void ) const { return not output_.empty(); }
+  unsigned int requests_sent( void ) const { return requests_sent_; }
+  unsigned int in_flight( void ) const { return sent_ns_.size(); }
+
+  void set_connected( void ) { connected_ = true; }
+
+  /* queue a request, and write whatever the server will take */
+  void request( const string & request, const uint64_t now_ns );
+  void send( void );
+
+  /* read the server's responses, and return when each was sent */
+  void receive( vector<uint64_t> & answered_sent_ns );
+};
+
+Client::Client( const Address & server )
+  : socket_( new TCPSocket ),
+    connected_( false ),
+    output_(),
+    sent_ns_(),
+    requests_sent_( 0 )
+{
+  socket_->set_blocking( false );
+  socket_->set_nodelay();
+  socket_->connect( server );
+}
+
+void Client::request( const string & request, const uint64_t now_ns )
+{
+  output_.append( request );
+  sent_ns_.push_back( now_ns );
+  requests_sent_++;
+}
+
+void Client::send( void )
+{
+  if ( output_.empty() ) {
+    return;
+  }
+
+  const auto end = socket_->write( output_, false );
+  output_.erase( output_.cbegin(), end );
+}
+
+void Client::receive( vector<uint64_t> & answered_sent_ns )
+{
+  const string chunk = socket_->read( READ_SIZE );
+
+  /* each response is a line */
+  for ( size_t i = count( chunk.begin(), chunk.end(), '\n' ); i > 0 and not sent_ns_.empty(); i-- ) {
+    answered_sent_ns.push_back( sent_ns_.front() );
+    sent_ns_.pop_front();
+  }
+}
+
+class LoadGenerator
+{
+private:
+  const BenchmarkConfig & config_;
+  Poller poller_;
+
+  unordered_map<int, unique_ptr<Client>> clients_;
+  vector<unique_ptr<Client>> closed_; /* (see tcpserver) */
+  vector<uint64_t> answered_sent_ns_;
+
+  uint64_t connections_, requests_, errors_;
+  LatencyHistogram latency_;
+
+  void open_client( void );
+  void close_client( Client & client );
+  void answered( Client & client );
+
+public:
+  LoadGenerator( const BenchmarkConfig & config );
+
+  void run( void );
+
+  uint64_t connections( void ) const { return connections_; }
+  uint64_t requests( void ) const { return requests_; }
+  uint64_t errors( void ) const { return errors_; }
+  const LatencyHistogram & latency( void ) const { return latency_; }
+};
+
+LoadGenerator::LoadGenerator( const BenchmarkConfig & config )
+  : config_( config ),
+    poller_( Poller::Backend::Epoll ),
+    clients_(),
+    closed_(),
+    answered_sent_ns_(),
+    connections_( 0 ),
+    requests_( 0 ),
+    errors_( 0 ),
+    latency_()
+{}
+
+void LoadGenerator::open_client( void )
+{
+  Client * const client = new Client( config_.server );
+  clients_[ client->socket().fd_num() ].reset( client );
+
+  poller_.add_action( Action( client->socket(), Direction::In, [this, client] () {
+	try {
+	  client->receive( answered_sent_ns_ );
+	  if ( client->socket().eof() ) { /* the server hung up on us */
+	    errors_++;
+	    close_client( *client );
+	    open_client();
+	    return ResultType::Continue;
+	  }
+
+	  answered( *client );
+	} catch ( const unix_error & e ) {
+	  errors_++;
+	  close_client( *client );
+	  open_client();
+	}
+	return ResultType::Continue;
+      } ) );
+
+  /* writable for the first time once connected */
+  poller_.add_action( Action( client->socket(), Direction::Out, [this, client] () {
+	try {
+	  if ( not client->connected() ) {
+	    client->set_connected();
+	    const uint64_t now = Stats::now_ns();
+	    for ( unsigned int i = 0; i < config_.pipeline; i++ ) {
+	      client->request( config_.request, now );
+	    }
+	  }
+
+	  client->send();
+	} catch ( const unix_error & e ) {
+	  errors_++;
+	  close_client( *client );
+	  open_client();
+	}
+	return ResultType::Continue;
+      },
+      [client] () { return client->sending() or not client->connected(); } ) );
+
+  /* refused or reset */
+  poller_.set_hangup_callback( client->socket(), [this, client] () {
+      errors_++;
+      close_client( *client );
+      open_client();
+      return ResultType::Continue;
+    } );
+}
+
+void LoadGenerator::close_client( Client & client )
+{
+  poller_.remove_actions( client.socket() );
+
+  auto entry = clients_.find( client.socket().fd_num() );
+  closed_.push_back( move( entry->second ) );
+  clients_.erase( entry );
+}
+
+/* count the responses just received, and send the next requests */
+void LoadGenerator::answered( Client & client )
+{
+  const uint64_t now = Stats::now_ns();
+  for ( const uint64_t sent : answered_sent_ns_ ) {
+    latency_.record( now - sent );
+  }
+  requests_ += answered_sent_ns_.size();
+
+  const unsigned int limit = config_.requests_per_connection;
+  for ( size_t i = 0; i < answered_sent_ns_.size(); i++ ) {
+    if ( limit == 0 or client.requests_sent() < limit ) {
+      client.request( config_.request, now );
+    }
+  }
+  answered_sent_ns_.clear();
+
+  if ( client.sending() ) {
+    client.send();
+  }
+
+  if ( limit and client.requests_sent() == limit and client.in_flight() == 0 ) {
+    connections_++;
+    close_client( client );
+    open_client();
+  }
+}
+
+void LoadGenerator::run( void )
+{
+  for ( unsigned int i = 0; i < config_.connections; i++ ) {
+    open_client();
+  }
+
+  poller_.add_timer( config_.duration_us, [] () { return ResultType::Exit; } );
+
+  while ( true ) {
+    const auto ret = poller_.poll( -1 );
+    closed_.clear();
+
+    if ( ret.result == PollResult::Exit ) {
+      break;
+    }
+  }
+
+  /* connections still open count too (when kept open for the whole run) */
+  if ( config_.requests_per_connection == 0 ) {
+    connections_ += clients_.size();
+  }
+}
+
+void usage( const char * const program_name )
+{
+  cerr << "Usage: " << program_name << " HOST PORT [threads=N] [connections=N]"
+       << " [pipeline=N] [size=BYTES] [duration=SECONDS] [requests-per-connection=N]" << endl;
+}
+
+int main( int argc, char *argv[] )
+{
+  /* check the command-line arguments */
+  if ( argc < 1 ) { /* for sticklers */
+    abort();
+  }
+
+  if ( argc < 3 ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  unsigned int thread_count = 1, connections = 100, pipeline = 1;
+  unsigned int requests_per_connection = 0, size = 64;
+  double duration = 5;
+  bool usage_error = false;
+
+  for ( int i = 3; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option.substr( 0, 8 ) == "threads=" ) {
+      thread_count = stoul( option.substr( 8 ) );
+      usage_error |= thread_count == 0;
+    } else if ( option.substr( 0, 12 ) == "connections=" ) {
+      /* open at once, across all the threads */
+      connections = stoul( option.substr( 12 ) );
+    } else if ( option.substr( 0, 9 ) == "pipeline=" ) {
+      /* requests in flight on each connection */
+      pipeline = stoul( option.substr( 9 ) );
+      usage_error |= pipeline == 0;
+    } else if ( option.substr( 0, 5 ) == "size=" ) {
+      /* of each request, counting its newline */
+      size = stoul( option.substr( 5 ) );
+      usage_error |= size == 0;
+    } else if ( option.substr( 0, 9 ) == "duration=" ) {
+      duration = stod( option.substr( 9 ) );
+      usage_error |= duration <= 0;
+    } else if ( option.substr( 0, 24 ) == "requests-per-connection=" ) {
+      /* close each connection after this many, and open another */
+      requests_per_connection = stoul( option.substr( 24 ) );
+    } else {
+      usage_error = true;
+    }
+  }
+
+  usage_error |= connections < thread_count;
+  if ( usage_error ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  /* no more in flight than a connection will ask for */
+  if ( requests_per_connection ) {
+    pipeline = min( pipeline, requests_per_connection );
+  }
+
+  /* a server that goes away makes a write fail (EPIPE), not kill us */
+  signal( SIGPIPE, SIG_IGN );
+
+  const Address server( argv[ 1 ], argv[ 2 ] );
+  const string request = string( size - 1, 'x' ) + "\n";
+  const uint64_t duration_us = duration * 1000000;
+
+  /* deal the connections out to the threads */
+  vector<BenchmarkConfig> configs;
+  for ( unsigned int i = 0; i < thread_count; i++ ) {
+    configs.push_back( BenchmarkConfig { server,
+	  connections / thread_count + ( i < connections % thread_count ),
+	  pipeline, requests_per_connection, duration_us, request } );
+  }
+
+  vector<unique_ptr<LoadGenerator>> generators;
+  for ( const auto & config : configs ) {
+    generators.emplace_back( new LoadGenerator( config ) );
+  }
+
+  cerr << "Running " << connections << " connections to " << server.to_string()
+       << " on " << thread_count << " thread" << ( thread_count > 1 ? "s" : "" )
+       << " for " << duration << " s..." << endl;
+
+  /* the first generator runs on the main thread */
+  const uint64_t start_ns = Stats::now_ns();
+
+  vector<thread> threads;
+  for ( unsigned int i = 1; i < thread_count; i++ ) {
+    threads.emplace_back( [&generators, i] () { generators.at( i )->run(); } );
+  }
+
+  generators.front()->run();
+
+  for ( auto & thread : threads ) {
+    thread.join();
+  }
+
+  const double elapsed = ( Stats::now_ns() - start_ns ) / 1e9;
+
+  uint64_t total_connections = 0, total_requests = 0, total_errors = 0;
+  LatencyHistogram latency;
+  for ( const auto & generator : generators ) {
+    total_connections += generator->connections();
+    total_requests += generator->requests();
+    total_errors += generator->errors();
+    latency.merge( generator->latency() );
+  }
+
+  cout << fixed << setprecision( 1 );
+  if ( requests_per_connection ) {
+    cout << "Connections: " << total_connections << " in " << elapsed << " s ("
+	 << total_connections / elapsed << "/s)" << "\n";
+  }
+  cout << "Requests: " << total_requests << " in " << elapsed << " s ("
+       << total_requests / elapsed << "/s)" << "\n";
+  cout << "Latency (us): mean " << latency.mean_ns() / 1000
+       << ", p50 " << latency.percentile_ns( 0.5 ) / 1000.0
+       << ", p99 " << latency.percentile_ns( 0.99 ) / 1000.0
+       << ", p99.9 " << latency.percentile_ns( 0.999 ) / 1000.0
+       << ", max " << latency.max_ns() / 1000.0 << "\n";
+  cout << "Errors: " << total_errors << endl;
+
+  return EXIT_SUCCESS;
+}
@@ -1,13 +1,238 @@
-/* simple TCP listener/server to demonstrate sourdough starter classes */
+/* event-driven TCP server to demonstrate sourdough starter classes:
+   answers each line a client sends with how long it was */
 /* Keith Winstein <keithw@cs.stanford.edu>, January 2015 */
 
-#include <thread>
+/* Each of a few event loops (one per thread) has a listening socket of
+   its own on the same port, and the kernel spreads incoming connections
+   across them (SO_REUSEPORT). A loop watches its connections with one
+   epoll instance, and never waits on any one of them: the sockets are
+   non-blocking, and whatever a client isn't ready to take waits in that
+   connection's output buffer. A client that sends faster than it reads
+   gets no more of its requests read until it catches up. */
+
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <signal.h>
 
 #include "socket.hh"
+#include "poller.hh"
+#include "stats.hh"
 #include "util.hh"
 
 using namespace std;
+using namespace PollerShortNames;
+
+/* most to read from a connection at once */
+static const size_t READ_SIZE = 64 * 1024;
+
+/* stop reading a connection's requests while this much of its
+   responses is waiting for the client to take it */
+static const size_t MAX_PENDING_OUTPUT = 1024 * 1024;
+
+/* a longer line than this isn't a request */
+static const size_t MAX_LINE_LENGTH = 64 * 1024;
+
+/* most connections to accept at one go, so as not to starve the others */
+static const unsigned int ACCEPT_BATCH_SIZE = 64;
+
+class Connection
+{
+private:
+  unique_ptr<TCPSocket> socket_;
+  string input_, output_;
+
+public:
+  Connection( unique_ptr<TCPSocket> && socket ) : socket_( move( socket ) ), input_(), output_() {}
+
+  TCPSocket & socket( void ) { return *socket_; }
+
+  /* read what the client has sent, and answer every complete line;
+     returns false if the client broke the protocol */
+  bool receive( void );
+
+  /* write as much of the responses as the client will take */
+  void send( void );
+
+  bool backlogged( void ) const { return output_.size() >= MAX_PENDING_OUTPUT; }
+  bool sending( void ) const { return not output_.empty(); }
+
+  /* has the client finished, and had all its responses? */
+  bool done( void ) const { return socket_->eof() and output_.empty(); }
+};
+
+bool Connection::receive( void )
+{
+  input_.append( socket_->read( READ_SIZE ) );
+
+  size_t line_start = 0, newline;
+  while ( ( newline = input_.find( '\n', line_start ) ) != string::npos ) {
+    output_.append( "Received " );
+    output_.append( to_string( newline + 1 - line_start ) );
+    output_.append( " bytes from you.\n" );
+    line_start = newline + 1;
+  }
+  input_.erase( 0, line_start );
+
+  return input_.size() <= MAX_LINE_LENGTH;
+}
+
+void Connection::send( void )
+{
+  if ( output_.empty() ) {
+    return;
+  }
+
+  const auto end = socket_->write( output_, false );
+  output_.erase( output_.cbegin(), end );
+}
+
+class EventLoop
+{
+private:
+  TCPSocket & listener_;
+  bool verbose_;
+  Poller poller_;
+
+  unordered_map<int, unique_ptr<Connection>> connections_;
+
+  /* closed during this poll(), and destroyed (closing the socket)
+     once the Poller has let go of them */
+  vector<unique_ptr<Connection>> closed_;
+
+  void accept_connections( void );
+  void add_connection( unique_ptr<TCPSocket> && socket );
+  void close_connection( Connection & connection );
+
+public:
+  EventLoop( TCPSocket & listener, const bool verbose );
+
+  int loop( void );
+};
+
+EventLoop::EventLoop( TCPSocket & listener, const bool verbose )
+  : listener_( listener ),
+    verbose_( verbose ),
+    poller_( Poller::Backend::Epoll ),
+    connections_(),
+    closed_()
+{
+  poller_.add_action( Action( listener_, Direction::In, [&] () {
+	accept_connections();
+	return ResultType::Continue;
+      } ) );
+}
+
+void EventLoop::accept_connections( void )
+{
+  for ( unsigned int i = 0; i < ACCEPT_BATCH_SIZE; i++ ) {
+    unique_ptr<TCPSocket> socket = listener_.try_accept();
+    if ( not socket ) {
+      return;
+    }
+
+    try {
+      add_connection( move( socket ) );
+    } catch ( const unix_error & e ) { /* e.g. reset already */
+      if ( verbose_ ) {
+	print_exception( e );
+      }
+    }
+  }
+}
+
+void EventLoop::add_connection( unique_ptr<TCPSocket> && socket )
+{
+  socket->set_nodelay();
+
+  if ( verbose_ ) {
+    cerr << "New connection from " << socket->peer_address().to_string() << endl;
+  }
+
+  Connection * const connection = new Connection( move( socket ) );
+  connections_[ connection->socket().fd_num() ].reset( connection );
+
+  /* read requests unless the client has fallen too far behind on the responses */
+  poller_.add_action( Action( connection->socket(), Direction::In, [this, connection] () {
+	try {
+	  const bool ok = connection->receive();
+
+	  /* most of the time, the responses go out right away */
+	  if ( connection->sending() ) {
+	    connection->send();
+	  }
+
+	  if ( not ok or connection->done() ) {
+	    close_connection( *connection );
+	  }
+	} catch ( const unix_error & e ) { /* e.g. reset by the client */
+	  close_connection( *connection );
+	}
+	return ResultType::Continue;
+      },
+      [connection] () { return not connection->backlogged(); } ) );
+
+  /* ... and send the rest when the client will take them */
+  poller_.add_action( Action( connection->socket(), Direction::Out, [this, connection] () {
+	try {
+	  connection->send();
+
+	  if ( connection->done() ) {
+	    close_connection( *connection );
+	  }
+	} catch ( const unix_error & e ) {
+	  close_connection( *connection );
+	}
+	return ResultType::Continue;
+      },
+      [connection] () { return connection->sending(); } ) );
+
+  poller_.set_hangup_callback( connection->socket(), [this, connection] () {
+      close_connection( *connection );
+      return ResultType::Continue;
+    } );
+}
+
+void EventLoop::close_connection( Connection & connection )
+{
+  const int fd = connection.socket().fd_num();
+
+  if ( verbose_ ) {
+    cerr << "Closing connection on fd " << fd << " after "
+	 << connection.socket().bytes_read() << " bytes in, "
+	 << connection.socket().bytes_written() << " bytes out" << endl;
+  }
+
+  poller_.remove_actions( connection.socket() );
+
+  auto entry = connections_.find( fd );
+  closed_.push_back( move( entry->second ) );
+  connections_.erase( entry );
+}
+
+int EventLoop::loop( void )
+{
+  while ( true ) {
+    const auto ret = poller_.poll( -1 );
+    closed_.clear();
+
+    if ( ret.result == PollResult::Exit ) {
+      return ret.exit_status;
+    }
+  }
+}
+
+/* run an event loop on the calling thread */
+void run_loop( TCPSocket & listener, const bool verbose )
+{
+  EventLoop event_loop( listener, verbose );
+  event_loop.loop();
+}
 
 int main( int argc, char *argv[] )
 {
@@ -16,53 +241,77 @@ int main( int argc, char *argv[] )
     abort();
   }
 
-  if ( argc != 2 ) {
-    cerr << "Usage: " << argv[ 0 ] << " PORT" << endl;
+  unsigned int thread_count = 1;
+  bool verbose = false, stats = false;
+  bool usage_error = argc < 2;
+
+  for ( int i = 2; i < argc; i++ ) {
+    const string option { argv[ i ] };
+    if ( option.substr( 0, 8 ) == "threads=" ) {
+      thread_count = stoul( option.substr( 8 ) );
+      usage_error |= thread_count == 0;
+    } else if ( option == "verbose" ) {
+      /* print each connection as it opens and closes */
+      verbose = true;
+    } else if ( option == "stats" ) {
+      /* print each thread's event-loop statistics on SIGUSR1 and at exit */
+      stats = true;
+    } else {
+      usage_error = true;
+    }
+  }
+
+  if ( usage_error ) {
+    cerr << "Usage: " << argv[ 0 ] << " PORT [threads=N] [verbose] [stats]" << endl;
     return EXIT_FAILURE;
   }
 
-  /* create a TCP socket */
-  TCPSocket listening_socket;
+  if ( stats ) {
+    Stats::dump_on_signal();
+  }
 
-  /* it's ok to reuse the server's address as soon as the program quits
-     (this helps debugging, at the slight cost to robustness) */
-  listening_socket.set_reuseaddr();
+  /* a client that goes away makes a write fail (EPIPE), not kill the server */
+  signal( SIGPIPE, SIG_IGN );
 
-  /* "bind" the socket to the user-specified local port number */
-  listening_socket.bind( Address( "::0", argv[ 1 ] ) );
+  /* one listening socket per event loop, all on the same port */
+  vector<unique_ptr<TCPSocket>> listeners;
+  for ( unsigned int i = 0; i < thread_count; i++ ) {
+    listeners.emplace_back( new TCPSocket );
 
-  /* mark the socket as listening for incoming connections */
-  listening_socket.listen();
-  cerr << "Listening on local address: " << listening_socket.local_address().to_string() << endl;
+    /* it's ok to reuse the server's address as soon as the program quits
+       (this helps debugging, at the slight cost to robustness) */
+    listeners.back()->set_reuseaddr();
 
-  /* Wait for clients to connect */
-  while ( true ) {
+    if ( thread_count > 1 ) {
+      listeners.back()->set_reuseport();
+    }
 
-    /* This line does a lot. It waits for a client to connect
-       ("listening_socket.accept()"). When that returns a new socket,
-       it starts a thread to handle that client and passes in the
-       result of accept() as the "client" parameter to the handler. */
-
-    thread client_handler( [] ( TCPSocket client ) {
-	cerr << "New connection from " << client.peer_address().to_string() << endl;
-
-	/* Print every line that the client sends */
-	while ( true ) {
-	  const string chunk = client.read();
-	  if ( client.eof() ) { break; }
-	  cerr << "Got " << chunk.size() << " bytes from "
-	       << client.peer_address().to_string() << ": " << chunk;
-	  client.write( "Received " + to_string( chunk.size() ) + " bytes from you.\n" );
-	}
+    /* "bind" the socket to the user-specified local port number
+       (or, after the first, to whichever the first got) */
+    listeners.back()->bind( i == 0 ? Address( "::0", argv[ 1 ] )
+			    : listeners.front()->local_address() );
 
-	cerr << client.peer_address().to_string() << " closed the connection." << endl; 
-      }, listening_socket.accept() );
+    /* mark the socket as listening for incoming connections */
+    listeners.back()->listen( SOMAXCONN );
+    listeners.back()->set_blocking( false );
+  }
+
+  cerr << "Listening on local address: " << listeners.front()->local_address().to_string();
+  if ( thread_count > 1 ) {
+    cerr << " with " << thread_count << " threads";
+  }
+  cerr << endl;
+
+  /* the first loop runs on the main thread */
+  vector<thread> loops;
+  for ( unsigned int i = 1; i < thread_count; i++ ) {
+    loops.emplace_back( run_loop, ref( *listeners.at( i ) ), verbose );
+  }
 
-    /* Let the client handler continue to run without having
-       to keep track of it. The main thread can go back to accepting
-       new incoming connections. */
+  run_loop( *listeners.front(), verbose );
 
-    client_handler.detach();
+  for ( auto & loop : loops ) {
+    loop.join();
   }
 
   return EXIT_SUCCESS;
@@ -32,6 +32,17 @@ Address::Address( const sockaddr & addr, const size_t size )
   memcpy( &addr_, &addr, size );
 }
 
+/* IPv6 address and port from a key */
+Address::Address( const Key & key )
+  : size_( sizeof( sockaddr_in6 ) ),
+    addr_()
+{
+  sockaddr_in6 & addr = reinterpret_cast<sockaddr_in6 &>( addr_ );
+  addr.sin6_family = AF_INET6;
+  addr.sin6_port = key.port;
+  memcpy( &addr.sin6_addr, key.ip, sizeof( key.ip ) );
+}
+
 /* error category for getaddrinfo and getnameinfo */
 class gai_error_category : public error_category
 {
@@ -140,3 +151,40 @@ bool Address::operator==( const Address & other ) const
 {
   return 0 == memcmp( &addr_, &other.addr_, size_ );
 }
+
+/* compact key from an IPv4 or IPv6 sockaddr */
+Address::Key::Key( const sockaddr & addr )
+  : Key()
+{
+  switch ( addr.sa_family ) {
+  case AF_INET6:
+    {
+      const sockaddr_in6 & addr6 = reinterpret_cast<const sockaddr_in6 &>( addr );
+      memcpy( ip, &addr6.sin6_addr, sizeof( ip ) );
+      port = addr6.sin6_port;
+    }
+    break;
+  case AF_INET:
+    {
+      /* v4-mapped: ::ffff:a.b.c.d */
+      const sockaddr_in & addr4 = reinterpret_cast<const sockaddr_in &>( addr );
+      ip[ 2 ] = htonl( 0xffff );
+      ip[ 3 ] = addr4.sin_addr.s_addr;
+      port = addr4.sin_port;
+    }
+    break;
+  default:
+    throw runtime_error( "Address::Key: unsupported address family" );
+  }
+}
+
+/* multiply-xorshift mixing of the key's 20 bytes */
+uint64_t Address::Key::hash( void ) const
+{
+  static const uint64_t multiplier = 0x9e3779b97f4a7c15;
+
+  uint64_t h = ( uint64_t( ip[ 0 ] ) << 32 | ip[ 1 ] ) * multiplier;
+  h = ( h ^ ( h >> 29 ) ^ ( uint64_t( ip[ 2 ] ) << 32 | ip[ 3 ] ) ) * multiplier;
+  h = ( h ^ ( h >> 29 ) ^ port ) * multiplier;
+  return h ^ ( h >> 32 );
+}
@@ -1,6 +1,7 @@
 #ifndef ADDRESS_HH
 #define ADDRESS_HH
 
+#include <cstdint>
 #include <string>
 #include <utility>
 
@@ -16,6 +17,36 @@ public:
     sockaddr_storage as_sockaddr_storage;
   } raw;
 
+  /* compact, hashable form of an IP address and port, for use as a
+     table key (IPv4 addresses are stored v4-mapped, as on a v6 socket) */
+  struct Key
+  {
+    uint32_t ip[ 4 ];  /* network byte order */
+    uint16_t port;     /* network byte order */
+    uint16_t padding;  /* always zero */
+
+    Key() : ip(), port( 0 ), padding( 0 ) {}
+    explicit Key( const sockaddr & addr );
+
+    bool operator==( const Key & other ) const
+    {
+      return ip[ 0 ] == other.ip[ 0 ] and ip[ 1 ] == other.ip[ 1 ]
+	and ip[ 2 ] == other.ip[ 2 ] and ip[ 3 ] == other.ip[ 3 ]
+	and port == other.port;
+    }
+
+    bool operator!=( const Key & other ) const { return not operator==( other ); }
+
+    /* well-mixed 64-bit hash (every bit of the key affects every bit of the hash) */
+    uint64_t hash( void ) const;
+
+    /* for std::unordered_map and friends */
+    struct Hasher
+    {
+      size_t operator()( const Key & key ) const { return key.hash(); }
+    };
+  };
+
 private:
   socklen_t size_;
 
@@ -29,6 +60,7 @@ public:
   Address();
   Address( const raw & addr, const size_t size );
   Address( const sockaddr & addr, const size_t size );
+  explicit Address( const Key & key );
 
   /* construct by resolving host name and service name */
   Address( const std::string & hostname, const std::string & service );
@@ -44,6 +76,7 @@ public:
 
   socklen_t size( void ) const { return size_; }
   const sockaddr & to_sockaddr( void ) const;
+  Key key( void ) const { return Key( to_sockaddr() ); }
 
   /* equality */
   bool operator==( const Address & other ) const;
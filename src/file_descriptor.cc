@@ -1,6 +1,7 @@
 #include "file_descriptor.hh"
 #include "util.hh"
 
+#include <fcntl.h>
 #include <unistd.h>
 
 using namespace std;
@@ -10,7 +11,9 @@ FileDescriptor::FileDescriptor( const int fd )
   : fd_( fd ),
     eof_( false ),
     read_count_( 0 ),
-    write_count_( 0 )
+    write_count_( 0 ),
+    bytes_read_( 0 ),
+    bytes_written_( 0 )
 {}
 
 /* move constructor */
@@ -18,7 +21,9 @@ FileDescriptor::FileDescriptor( FileDescriptor && other )
   : fd_( other.fd_ ),
     eof_( other.eof_ ),
     read_count_( other.read_count_ ),
-    write_count_( other.write_count_ )
+    write_count_( other.write_count_ ),
+    bytes_read_( other.bytes_read_ ),
+    bytes_written_( other.bytes_written_ )
 {
   /* mark other file descriptor as inactive */
   other.fd_ = -1;
@@ -46,12 +51,18 @@ string::const_iterator FileDescriptor::write( const string::const_iterator & beg
     throw runtime_error( "nothing to write" );
   }
 
-  ssize_t bytes_written = SystemCall( "write", ::write( fd_, &*begin, end - begin ) );
+  const ssize_t result = ::write( fd_, &*begin, end - begin );
+  if ( result < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) { /* non-blocking, and full */
+    register_write();
+    return begin;
+  }
+
+  ssize_t bytes_written = SystemCall( "write", result );
   if ( bytes_written == 0 ) {
     throw runtime_error( "write returned 0" );
   }
 
-  register_write();
+  register_write( bytes_written );
 
   return begin + bytes_written;
 }
@@ -61,12 +72,18 @@ string FileDescriptor::read( const size_t limit )
 {
   char buffer[ BUFFER_SIZE ];
 
-  ssize_t bytes_read = SystemCall( "read", ::read( fd_, buffer, min( BUFFER_SIZE, limit ) ) );
+  const ssize_t result = ::read( fd_, buffer, min( BUFFER_SIZE, limit ) );
+  if ( result < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) { /* non-blocking, and empty */
+    register_read();
+    return string();
+  }
+
+  ssize_t bytes_read = SystemCall( "read", result );
   if ( bytes_read == 0 ) {
     set_eof();
   }
 
-  register_read();
+  register_read( bytes_read );
 
   return string( buffer, bytes_read );
 }
@@ -82,3 +99,11 @@ string::const_iterator FileDescriptor::write( const std::string & buffer, const
 
   return it;
 }
+
+/* make reads and writes wait (or not) */
+void FileDescriptor::set_blocking( const bool blocking )
+{
+  int flags = SystemCall( "fcntl", fcntl( fd_, F_GETFL ) );
+  flags = blocking ? ( flags & ~O_NONBLOCK ) : ( flags | O_NONBLOCK );
+  SystemCall( "fcntl", fcntl( fd_, F_SETFL, flags ) );
+}
@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include "stats.hh"
+
 /* Unix file descriptors (sockets, files, etc.) */
 class FileDescriptor
 {
@@ -11,6 +13,7 @@ private:
   bool eof_;
 
   unsigned int read_count_, write_count_;
+  uint64_t bytes_read_, bytes_written_;
 
   /* attempt to write a portion of a string */
   std::string::const_iterator write( const std::string::const_iterator & begin,
@@ -20,8 +23,25 @@ private:
   const static size_t BUFFER_SIZE = 1024 * 1024;
 
 protected:
-  void register_read( void ) { read_count_++; }
-  void register_write( void ) { write_count_++; }
+  /* each read or write (one system call, perhaps of a batch), which
+     also counts toward the thread's Stats */
+  void register_read( const uint64_t bytes = 0 )
+  {
+    read_count_++;
+    bytes_read_ += bytes;
+    Stats & stats = Stats::thread();
+    stats.count( Stats::Syscalls );
+    stats.count( Stats::BytesRead, bytes );
+  }
+
+  void register_write( const uint64_t bytes = 0 )
+  {
+    write_count_++;
+    bytes_written_ += bytes;
+    Stats & stats = Stats::thread();
+    stats.count( Stats::Syscalls );
+    stats.count( Stats::BytesWritten, bytes );
+  }
   void set_eof( void ) { eof_ = true; }
 
 public:
@@ -39,11 +59,18 @@ public:
   const bool & eof( void ) const { return eof_; }
   unsigned int read_count( void ) const { return read_count_; }
   unsigned int write_count( void ) const { return write_count_; }
+  uint64_t bytes_read( void ) const { return bytes_read_; }
+  uint64_t bytes_written( void ) const { return bytes_written_; }
 
-  /* read and write methods */
+  /* read and write methods (on a non-blocking fd, read returns an empty
+     string, without EOF, if there is nothing to read, and a write stops
+     at what the kernel would take, so write_all should be false) */
   std::string read( const size_t limit = BUFFER_SIZE );
   std::string::const_iterator write( const std::string & buffer, const bool write_all = true );
 
+  /* make reads and writes wait (the default), or not */
+  void set_blocking( const bool blocking );
+
   /* forbid copying FileDescriptor objects or assigning them */
   FileDescriptor( const FileDescriptor & other ) = delete;
   const FileDescriptor & operator=( const FileDescriptor & other ) = delete;
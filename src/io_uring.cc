@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "io_uring.hh"
+#include "util.hh"
+
+using namespace std;
+
+/* the fd of a new ring, with the parameters the kernel filled in */
+struct IOUring::Setup
+{
+  io_uring_params params;
+  int fd;
+
+  Setup( const unsigned int entries )
+    : params(), fd( -1 )
+  {
+    /* the ring is only ever used from one thread, so the kernel can put off
+       completion work until we ask for results; older kernels lack this */
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    fd = syscall( __NR_io_uring_setup, entries, &params );
+
+    if ( fd < 0 and errno == EINVAL ) {
+      zero( params );
+      fd = syscall( __NR_io_uring_setup, entries, &params );
+    }
+
+    SystemCall( "io_uring_setup", fd );
+  }
+};
+
+/* map part of the ring into memory */
+static void * map_ring( const int fd, const size_t size, const off_t offset )
+{
+  void * const ret = mmap( nullptr, size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, fd, offset );
+  if ( ret == MAP_FAILED ) {
+    throw unix_error( "mmap" );
+  }
+
+  return ret;
+}
+
+template <typename T>
+static T * ring_field( void * const ring, const unsigned int offset )
+{
+  return reinterpret_cast<T *>( static_cast<char *>( ring ) + offset );
+}
+
+IOUring::IOUring( const unsigned int entries )
+  : IOUring( Setup( entries ) )
+{}
+
+IOUring::IOUring( const Setup & setup )
+  : FileDescriptor( setup.fd ),
+    params_( setup.params ),
+    sq_ring_( nullptr ),
+    sq_ring_size_( params_.sq_off.array + params_.sq_entries * sizeof( unsigned int ) ),
+    cq_ring_( nullptr ),
+    cq_ring_size_( params_.cq_off.cqes + params_.cq_entries * sizeof( io_uring_cqe ) ),
+    sqes_( nullptr ),
+    sqes_size_( params_.sq_entries * sizeof( io_uring_sqe ) ),
+    sq_head_(), sq_tail_(), sq_mask_(), sq_array_(),
+    cq_head_(), cq_tail_(), cq_mask_(),
+    cqes_(),
+    sq_pending_( 0 )
+{
+  /* newer kernels let one mapping cover both rings */
+  if ( params_.features & IORING_FEAT_SINGLE_MMAP ) {
+    sq_ring_size_ = cq_ring_size_ = max( sq_ring_size_, cq_ring_size_ );
+    sq_ring_ = cq_ring_ = map_ring( fd_num(), sq_ring_size_, IORING_OFF_SQ_RING );
+  } else {
+    sq_ring_ = map_ring( fd_num(), sq_ring_size_, IORING_OFF_SQ_RING );
+    cq_ring_ = map_ring( fd_num(), cq_ring_size_, IORING_OFF_CQ_RING );
+  }
+
+  sqes_ = static_cast<io_uring_sqe *>( map_ring( fd_num(), sqes_size_, IORING_OFF_SQES ) );
+
+  sq_head_ = ring_field<unsigned int>( sq_ring_, params_.sq_off.head );
+  sq_tail_ = ring_field<unsigned int>( sq_ring_, params_.sq_off.tail );
+  sq_mask_ = ring_field<unsigned int>( sq_ring_, params_.sq_off.ring_mask );
+  sq_array_ = ring_field<unsigned int>( sq_ring_, params_.sq_off.array );
+
+  cq_head_ = ring_field<unsigned int>( cq_ring_, params_.cq_off.head );
+  cq_tail_ = ring_field<unsigned int>( cq_ring_, params_.cq_off.tail );
+  cq_mask_ = ring_field<unsigned int>( cq_ring_, params_.cq_off.ring_mask );
+  cqes_ = ring_field<io_uring_cqe>( cq_ring_, params_.cq_off.cqes );
+
+  /* each slot of the submission queue always names the same entry */
+  for ( unsigned int i = 0; i < params_.sq_entries; i++ ) {
+    sq_array_[ i ] = i;
+  }
+}
+
+IOUring::~IOUring()
+{
+  munmap( sqes_, sqes_size_ );
+  if ( cq_ring_ != sq_ring_ ) {
+    munmap( cq_ring_, cq_ring_size_ );
+  }
+  munmap( sq_ring_, sq_ring_size_ );
+}
+
+bool IOUring::available( void )
+{
+  try {
+    char buffer[ 256 ];
+    IOUring ring( 1 );
+    BufferRing buffers( ring, 0, 1 );
+    buffers.add( buffer, sizeof( buffer ), 0 );
+    buffers.publish();
+
+    /* a UDP socket that has sent itself a datagram */
+    FileDescriptor socket( SystemCall( "socket", ::socket( AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0 ) ) );
+    sockaddr_in address;
+    socklen_t address_length = sizeof( address );
+    zero( address );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    sockaddr * const raw_address = reinterpret_cast<sockaddr *>( &address );
+    SystemCall( "bind", bind( socket.fd_num(), raw_address, address_length ) );
+    SystemCall( "getsockname", getsockname( socket.fd_num(), raw_address, &address_length ) );
+    SystemCall( "sendto", sendto( socket.fd_num(), "x", 1, 0, raw_address, address_length ) );
+
+    /* receive it the way the Poller does: with a multishot recvmsg
+       (Linux 6.0) into a provided buffer (5.19), which older kernels
+       turn down with EINVAL */
+    msghdr layout;
+    zero( layout );
+    io_uring_sqe & sqe = ring.prepare();
+    sqe.opcode = IORING_OP_RECVMSG;
+    sqe.fd = socket.fd_num();
+    sqe.addr = reinterpret_cast<uint64_t>( &layout );
+    sqe.len = 1;
+    sqe.ioprio = IORING_RECV_MULTISHOT;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = buffers.group_id();
+
+    io_uring_cqe cqe;
+    return ring.wait( 1, 1000000 ) and ring.next_completion( cqe )
+      and cqe.res > 0 and ( cqe.flags & IORING_CQE_F_BUFFER );
+  } catch ( const exception & ) {
+    return false;
+  }
+}
+
+io_uring_sqe & IOUring::prepare( void )
+{
+  if ( sq_pending_ == params_.sq_entries ) {
+    submit();
+  }
+
+  io_uring_sqe & sqe = sqes_[ ( *sq_tail_ + sq_pending_ ) & *sq_mask_ ];
+  zero( sqe );
+  sq_pending_++;
+
+  return sqe;
+}
+
+int IOUring::enter( const unsigned int min_complete, const int64_t timeout_us )
+{
+  /* publish the pending requests */
+  __atomic_store_n( sq_tail_, *sq_tail_ + sq_pending_, __ATOMIC_RELEASE );
+
+  unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+
+  __kernel_timespec timeout;
+  io_uring_getevents_arg arg;
+  zero( timeout );
+  zero( arg );
+
+  if ( min_complete and timeout_us >= 0 ) {
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = ( timeout_us % 1000000 ) * 1000;
+    arg.ts = reinterpret_cast<uint64_t>( &timeout );
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+
+  const int ret = syscall( __NR_io_uring_enter, fd_num(), sq_pending_, min_complete, flags,
+			   flags & IORING_ENTER_EXT_ARG ? static_cast<void *>( &arg ) : nullptr,
+			   flags & IORING_ENTER_EXT_ARG ? sizeof( arg ) : 0 );
+
+  if ( ret < 0 and errno == ETIME ) {
+    /* the requests still went in */
+    sq_pending_ = 0;
+    return -1;
+  }
+
+  const unsigned int submitted = SystemCall( "io_uring_enter", ret );
+  if ( submitted != sq_pending_ ) {
+    throw runtime_error( "io_uring_enter: not every request was submitted" );
+  }
+  sq_pending_ = 0;
+
+  return submitted;
+}
+
+unsigned int IOUring::submit( void )
+{
+  return sq_pending_ ? enter( 0, -1 ) : 0;
+}
+
+bool IOUring::wait( const unsigned int min_complete, const int64_t timeout_us )
+{
+  if ( enter( min_complete, timeout_us ) < 0 ) {
+    return false;
+  }
+
+  /* a call that also submitted requests reports how many, not ETIME, when
+     it times out, so tell by whether the results it waited for are there */
+  const unsigned int ready = __atomic_load_n( cq_tail_, __ATOMIC_ACQUIRE ) - *cq_head_;
+  return ready >= min_complete;
+}
+
+bool IOUring::next_completion( io_uring_cqe & cqe )
+{
+  const unsigned int head = *cq_head_;
+  if ( head == __atomic_load_n( cq_tail_, __ATOMIC_ACQUIRE ) ) {
+    return false;
+  }
+
+  cqe = cqes_[ head & *cq_mask_ ];
+  __atomic_store_n( cq_head_, head + 1, __ATOMIC_RELEASE );
+
+  return true;
+}
+
+IOUring::BufferRing::BufferRing( IOUring & ring, const uint16_t group_id, const unsigned int entries )
+  : ring_( ring ),
+    group_id_( group_id ),
+    entries_( entries ),
+    bufs_( nullptr ),
+    size_( entries * sizeof( io_uring_buf ) ),
+    tail_( 0 )
+{
+  if ( entries == 0 or entries > 32768 or ( entries & ( entries - 1 ) ) ) {
+    throw runtime_error( "BufferRing: entries must be a power of two, up to 32768" );
+  }
+
+  /* the ring has to be page-aligned */
+  void * const bufs = mmap( nullptr, size_, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+  if ( bufs == MAP_FAILED ) {
+    throw unix_error( "mmap" );
+  }
+  bufs_ = static_cast<io_uring_buf *>( bufs );
+
+  io_uring_buf_reg reg;
+  zero( reg );
+  reg.ring_addr = reinterpret_cast<uint64_t>( bufs_ );
+  reg.ring_entries = entries_;
+  reg.bgid = group_id_;
+
+  const int ret = syscall( __NR_io_uring_register, ring_.fd_num(),
+			   IORING_REGISTER_PBUF_RING, &reg, 1 );
+  if ( ret < 0 ) {
+    const int saved_errno = errno;
+    munmap( bufs_, size_ );
+    throw unix_error( "io_uring_register(IORING_REGISTER_PBUF_RING)", saved_errno );
+  }
+}
+
+IOUring::BufferRing::~BufferRing()
+{
+  io_uring_buf_reg reg;
+  zero( reg );
+  reg.bgid = group_id_;
+
+  try {
+    SystemCall( "io_uring_register(IORING_UNREGISTER_PBUF_RING)",
+		syscall( __NR_io_uring_register, ring_.fd_num(),
+			 IORING_UNREGISTER_PBUF_RING, &reg, 1 ) );
+  } catch ( const exception & e ) { /* don't throw from destructor */
+    print_exception( e );
+  }
+
+  munmap( bufs_, size_ );
+}
+
+void IOUring::BufferRing::add( char * const data, const uint32_t length, const uint16_t buffer_id )
+{
+  io_uring_buf & buf = bufs_[ tail_ & ( entries_ - 1 ) ];
+  buf.addr = reinterpret_cast<uint64_t>( data );
+  buf.len = length;
+  buf.bid = buffer_id;
+  tail_++;
+}
+
+void IOUring::BufferRing::publish( void )
+{
+  __atomic_store_n( &bufs_[ 0 ].resv, tail_, __ATOMIC_RELEASE );
+}
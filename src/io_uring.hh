@@ -0,0 +1,113 @@
+#ifndef IO_URING_HH
+#define IO_URING_HH
+
+#include <cstdint>
+#include <cstddef>
+
+#include <linux/io_uring.h>
+
+#include "file_descriptor.hh"
+
+/* An io_uring instance, set up and driven with the raw system calls:
+   a submission queue of requests for the kernel to carry out, and a
+   completion queue of their results, both shared with the kernel in
+   memory so that one io_uring_enter() can hand over any number of
+   requests and wait for any number of results. */
+class IOUring : public FileDescriptor
+{
+private:
+  io_uring_params params_;
+
+  /* the mapped rings */
+  void * sq_ring_;
+  size_t sq_ring_size_;
+  void * cq_ring_;
+  size_t cq_ring_size_;
+  io_uring_sqe * sqes_;
+  size_t sqes_size_;
+
+  /* pointers into the rings */
+  unsigned int * sq_head_, * sq_tail_, * sq_mask_, * sq_array_;
+  unsigned int * cq_head_, * cq_tail_, * cq_mask_;
+  io_uring_cqe * cqes_;
+
+  /* requests filled in but not yet handed to the kernel */
+  unsigned int sq_pending_;
+
+  struct Setup;
+  IOUring( const Setup & setup );
+
+  /* submit what is pending, and wait for results if min_complete is
+     nonzero; returns how many were submitted, or -1 on timeout (which
+     the kernel only reports if there was nothing to submit) */
+  int enter( const unsigned int min_complete, const int64_t timeout_us );
+
+public:
+  /* the submission queue holds entries requests (rounded up to a power of two) */
+  IOUring( const unsigned int entries );
+  ~IOUring();
+
+  /* can this kernel (and its configuration) set up a ring, and receive
+     datagrams into provided buffers with a multishot recvmsg? */
+  static bool available( void );
+
+  /* a blank request to fill in, which goes to the kernel at the next
+     submit() or wait() (if the queue is full, what is there goes now) */
+  io_uring_sqe & prepare( void );
+
+  /* hand the pending requests to the kernel, returning how many */
+  unsigned int submit( void );
+
+  /* hand over the pending requests, then wait until there are at least
+     min_complete results, or until timeout_us passes (if nonnegative);
+     returns false on timeout */
+  bool wait( const unsigned int min_complete, const int64_t timeout_us = -1 );
+
+  /* take the oldest result, if there is one */
+  bool next_completion( io_uring_cqe & cqe );
+
+  unsigned int pending( void ) const { return sq_pending_; }
+
+  /* A ring of buffers that the kernel picks from for requests made with
+     IOSQE_BUFFER_SELECT (and this group id), reporting which it used in
+     the result; each has to be given back with add() once it has been
+     read. The IOUring must outlive it. */
+  class BufferRing
+  {
+  private:
+    IOUring & ring_;
+    uint16_t group_id_;
+    unsigned int entries_;
+
+    /* the ring is just an array of buffers (io_uring_buf_ring doesn't
+       lay out the same way in C++), with the tail in the first one */
+    io_uring_buf * bufs_;
+    size_t size_;
+
+    uint16_t tail_; /* including buffers added but not yet published */
+
+  public:
+    /* entries must be a power of two (at most 32768) */
+    BufferRing( IOUring & ring, const uint16_t group_id, const unsigned int entries );
+    ~BufferRing();
+
+    uint16_t group_id( void ) const { return group_id_; }
+    unsigned int entries( void ) const { return entries_; }
+
+    /* make a buffer available to the kernel (after publish()) under an id */
+    void add( char * const data, const uint32_t length, const uint16_t buffer_id );
+
+    /* let the kernel see everything added */
+    void publish( void );
+
+    /* forbid copying, since the kernel has our address */
+    BufferRing( const BufferRing & other ) = delete;
+    const BufferRing & operator=( const BufferRing & other ) = delete;
+  };
+
+  /* forbid copying, since the rings are mapped in */
+  IOUring( const IOUring & other ) = delete;
+  const IOUring & operator=( const IOUring & other ) = delete;
+};
+
+#endif /* IO_URING_HH */
@@ -0,0 +1,102 @@
+#include <cstdlib>
+#include <stdexcept>
+#include <utility>
+
+#include "packet_pool.hh"
+
+using namespace std;
+
+const size_t PacketPool::ALIGNMENT;
+
+PacketPool::Buffer::Buffer( Buffer && other )
+  : pool_( other.pool_ ),
+    data_( other.data_ ),
+    length_( other.length_ )
+{
+  other.pool_ = nullptr;
+  other.data_ = nullptr;
+  other.length_ = 0;
+}
+
+PacketPool::Buffer & PacketPool::Buffer::operator=( Buffer && other )
+{
+  if ( this != &other ) {
+    release();
+
+    swap( pool_, other.pool_ );
+    swap( data_, other.data_ );
+    swap( length_, other.length_ );
+  }
+
+  return *this;
+}
+
+void PacketPool::Buffer::release( void )
+{
+  if ( data_ ) {
+    /* can't allocate: room for every slot was reserved as the pool grew */
+    pool_->free_.push_back( data_ );
+  }
+
+  pool_ = nullptr;
+  data_ = nullptr;
+  length_ = 0;
+}
+
+void PacketPool::Buffer::set_length( const size_t length )
+{
+  if ( length > capacity() ) {
+    throw runtime_error( "PacketPool: length exceeds slot size" );
+  }
+
+  length_ = length;
+}
+
+PacketPool::PacketPool( const size_t slot_size, const size_t slots_per_chunk )
+  : slot_size_( ( slot_size + ALIGNMENT - 1 ) / ALIGNMENT * ALIGNMENT ),
+    slots_per_chunk_( slots_per_chunk ),
+    chunks_(),
+    free_()
+{
+  if ( slot_size == 0 or slots_per_chunk == 0 ) {
+    throw runtime_error( "PacketPool: slot size and chunk size must be nonzero" );
+  }
+
+  grow();
+}
+
+PacketPool::~PacketPool()
+{
+  for ( char * const chunk : chunks_ ) {
+    free( chunk );
+  }
+}
+
+void PacketPool::grow( void )
+{
+  void * chunk = nullptr;
+  const int err = posix_memalign( &chunk, ALIGNMENT, slot_size_ * slots_per_chunk_ );
+  if ( err ) {
+    throw bad_alloc();
+  }
+
+  chunks_.push_back( static_cast<char *>( chunk ) );
+  free_.reserve( slots() );
+
+  /* push in reverse, so slots are handed out in address order */
+  for ( size_t i = slots_per_chunk_; i > 0; i-- ) {
+    free_.push_back( static_cast<char *>( chunk ) + ( i - 1 ) * slot_size_ );
+  }
+}
+
+PacketPool::Buffer PacketPool::get( void )
+{
+  if ( free_.empty() ) {
+    grow();
+  }
+
+  char * const slot = free_.back();
+  free_.pop_back();
+
+  return Buffer( *this, slot );
+}
@@ -0,0 +1,86 @@
+#ifndef PACKET_POOL_HH
+#define PACKET_POOL_HH
+
+#include <cstddef>
+#include <vector>
+
+/* Fixed-size buffers for datagrams, carved out of large cache-aligned
+   chunks and recycled through a free list. A buffer goes back to the
+   pool when its handle is destroyed, and the most recently freed slot
+   is the next one handed out, so a steady flow of datagrams keeps
+   reusing the same few (warm) slots without calling malloc.
+
+   The pool only grows (a chunk at a time) when every slot is in use.
+   It is not thread-safe, and must outlive every buffer taken from it. */
+class PacketPool
+{
+public:
+  /* slots start on, and are a multiple of, a cache line */
+  static const size_t ALIGNMENT = 64;
+
+  /* owner of one slot, returned to the pool when destroyed */
+  class Buffer
+  {
+  private:
+    PacketPool * pool_;
+    char * data_;
+    size_t length_;
+
+    friend class PacketPool;
+
+    Buffer( PacketPool & pool, char * const data ) : pool_( &pool ), data_( data ), length_( 0 ) {}
+
+  public:
+    /* no slot */
+    Buffer() : pool_( nullptr ), data_( nullptr ), length_( 0 ) {}
+
+    ~Buffer() { release(); }
+
+    Buffer( Buffer && other );
+    Buffer & operator=( Buffer && other );
+
+    /* give the slot back now */
+    void release( void );
+
+    bool empty( void ) const { return data_ == nullptr; }
+
+    char * data( void ) { return data_; }
+    const char * data( void ) const { return data_; }
+    size_t capacity( void ) const { return pool_ ? pool_->slot_size() : 0; }
+
+    /* bytes of the slot in use (up to the caller to maintain) */
+    size_t length( void ) const { return length_; }
+    void set_length( const size_t length );
+
+    /* forbid copying, since each slot has one owner */
+    Buffer( const Buffer & other ) = delete;
+    Buffer & operator=( const Buffer & other ) = delete;
+  };
+
+private:
+  size_t slot_size_, slots_per_chunk_;
+
+  std::vector<char *> chunks_;
+  std::vector<char *> free_;
+
+  void grow( void );
+
+public:
+  /* slot_size is rounded up to a multiple of ALIGNMENT; the pool starts
+     with one chunk of slots_per_chunk slots */
+  PacketPool( const size_t slot_size, const size_t slots_per_chunk = 256 );
+  ~PacketPool();
+
+  /* take a free slot (growing the pool if there are none) */
+  Buffer get( void );
+
+  size_t slot_size( void ) const { return slot_size_; }
+  size_t slots( void ) const { return chunks_.size() * slots_per_chunk_; }
+  size_t available( void ) const { return free_.size(); }
+
+  /* forbid copying PacketPool objects or assigning them */
+  PacketPool( const PacketPool & other ) = delete;
+  const PacketPool & operator=( const PacketPool & other ) = delete;
+};
+
+#endif /* PACKET_POOL_HH */
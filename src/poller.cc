@@ -1,75 +1,782 @@
 #include <algorithm>
 #include <cassert>
+#include <numeric>
+
+#include <sys/timerfd.h>
 
 #include "poller.hh"
+#include "stats.hh"
 #include "util.hh"
 
 using namespace std;
 using namespace PollerShortNames;
 
+/* with the io_uring backend, what each result is for (in the top byte of
+   its user_data, with an index in the rest) */
+static const uint64_t ACTION_RESULT = 0;
+static const uint64_t DATAGRAM_RESULT = uint64_t( 1 ) << 56;
+static const uint64_t RESULT_INDEX_MASK = DATAGRAM_RESULT - 1;
+
+/* room in an io_uring for requests: one per action and datagram source */
+static const unsigned int RING_ENTRIES = 256;
+
+/* monotonic clock, in microseconds, in the same timebase as the timerfd */
+static uint64_t monotonic_us( void )
+{
+  timespec now;
+  SystemCall( "clock_gettime", clock_gettime( CLOCK_MONOTONIC, &now ) );
+  return uint64_t( now.tv_sec ) * 1000000 + now.tv_nsec / 1000;
+}
+
+Poller::Poller( const Backend & backend )
+  : backend_( backend ),
+    actions_(),
+    error_fds_(),
+    hangup_callbacks_(),
+    removed_fds_(),
+    pollfds_(),
+    epoll_fd_(),
+    registrations_(),
+    interest_(),
+    changed_fds_(),
+    interested_fds_( 0 ),
+    ready_(),
+    ring_(),
+    datagram_sources_(),
+    timers_(),
+    timer_queue_(),
+    next_timer_id_( 1 ),
+    timer_fd_(),
+    armed_deadline_us_( 0 )
+{
+  if ( backend_ == Backend::Epoll ) {
+    epoll_fd_.reset( new FileDescriptor( SystemCall( "epoll_create1",
+						     epoll_create1( EPOLL_CLOEXEC ) ) ) );
+    ready_.resize( 1 );
+  } else if ( backend_ == Backend::IOUring ) {
+    ring_.reset( new IOUring( RING_ENTRIES ) );
+  } else {
+    pollfds_.push_back( { -1, POLLIN, 0 } );
+  }
+}
+
+uint64_t Poller::add_timer( const uint64_t delay_us,
+			    const Action::CallbackType & callback,
+			    const uint64_t interval_us )
+{
+  /* make the timerfd the first time it is needed (io_uring waits
+     with a timeout instead) */
+  if ( not timer_fd_ and backend_ != Backend::IOUring ) {
+    timer_fd_.reset( new FileDescriptor( SystemCall( "timerfd_create",
+						     timerfd_create( CLOCK_MONOTONIC,
+								     TFD_NONBLOCK | TFD_CLOEXEC ) ) ) );
+
+    if ( backend_ == Backend::Epoll ) {
+      epoll_event event;
+      zero( event );
+      event.events = EPOLLIN;
+      event.data.fd = timer_fd_->fd_num();
+      SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_->fd_num(), EPOLL_CTL_ADD,
+					  timer_fd_->fd_num(), &event ) );
+    } else {
+      pollfds_.back().fd = timer_fd_->fd_num();
+    }
+  }
+
+  const uint64_t id = next_timer_id_++;
+  const uint64_t deadline = monotonic_us() + delay_us;
+
+  timers_.emplace( id, Timer { deadline, interval_us, callback } );
+  timer_queue_.emplace( deadline, id );
+
+  return id;
+}
+
+bool Poller::cancel_timer( const uint64_t id )
+{
+  return timers_.erase( id );
+}
+
+void Poller::remove_actions( const FileDescriptor & fd )
+{
+  if ( backend_ == Backend::IOUring ) {
+    /* (its outstanding poll requests refer to actions by index) */
+    throw runtime_error( "Poller: the io_uring backend cannot remove actions" );
+  }
+
+  removed_fds_.push_back( fd.fd_num() );
+}
+
+void Poller::interest_changed( const FileDescriptor & fd )
+{
+  if ( backend_ == Backend::Epoll ) {
+    mark_changed( fd.fd_num() );
+  }
+}
+
+void Poller::mark_changed( const int fd )
+{
+  const auto registration = registrations_.find( fd );
+  if ( registration != registrations_.end() and not registration->second.changed ) {
+    registration->second.changed = true;
+    changed_fds_.push_back( fd );
+  }
+}
+
+void Poller::set_hangup_callback( const FileDescriptor & fd, const Action::CallbackType & callback )
+{
+  hangup_callbacks_[ fd.fd_num() ] = callback;
+}
+
+bool Poller::removing( const int fd ) const
+{
+  return find( removed_fds_.begin(), removed_fds_.end(), fd ) != removed_fds_.end();
+}
+
+void Poller::forget_removed( void )
+{
+  if ( removed_fds_.empty() ) {
+    return;
+  }
+
+  sort( removed_fds_.begin(), removed_fds_.end() );
+  const auto removed = [&] ( const int fd ) {
+    return binary_search( removed_fds_.begin(), removed_fds_.end(), fd );
+  };
+
+  /* keep the other actions in order, along with what goes with each */
+  deque< Action > kept;
+  for ( size_t i = 0; i < actions_.size(); i++ ) {
+    if ( removed( actions_[ i ].fd.fd_num() ) ) {
+      continue;
+    }
+
+    if ( backend_ == Backend::Poll ) {
+      pollfds_[ kept.size() ] = pollfds_[ i ];
+    } else {
+      interest_[ kept.size() ] = interest_[ i ];
+    }
+    kept.push_back( move( actions_[ i ] ) );
+  }
+
+  if ( backend_ == Backend::Poll ) {
+    /* (the last pollfd, for the timerfd, stays) */
+    pollfds_.erase( pollfds_.begin() + kept.size(), pollfds_.end() - 1 );
+  } else {
+    interest_.resize( kept.size() );
+  }
+  actions_.swap( kept );
+
+  if ( backend_ == Backend::Epoll ) {
+    Stats & stats = Stats::thread();
+    for ( const int fd : removed_fds_ ) {
+      const auto registration = registrations_.find( fd );
+      if ( registration != registrations_.end() ) {
+	interested_fds_ -= registration->second.events != 0;
+	registrations_.erase( registration );
+	SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_->fd_num(), EPOLL_CTL_DEL, fd, nullptr ) );
+	stats.count( Stats::Syscalls );
+      }
+    }
+
+    /* the remaining actions have new indices */
+    for ( auto & registration : registrations_ ) {
+      registration.second.actions.clear();
+    }
+    for ( size_t i = 0; i < actions_.size(); i++ ) {
+      registrations_.at( actions_[ i ].fd.fd_num() ).actions.push_back( i );
+    }
+  }
+
+  error_fds_.erase( remove_if( error_fds_.begin(), error_fds_.end(), removed ), error_fds_.end() );
+  for ( const int fd : removed_fds_ ) {
+    hangup_callbacks_.erase( fd );
+  }
+
+  removed_fds_.clear();
+}
+
+void Poller::arm_timer_fd( void )
+{
+  /* drop cancelled timers from the front of the queue */
+  while ( not timer_queue_.empty()
+	  and not timers_.count( timer_queue_.top().second ) ) {
+    timer_queue_.pop();
+  }
+
+  const uint64_t deadline = timer_queue_.empty() ? 0 : timer_queue_.top().first;
+
+  if ( not timer_fd_ or deadline == armed_deadline_us_ ) {
+    return;
+  }
+
+  /* setting the timerfd also clears any expiration from the last deadline
+     (an all-zero value disarms it) */
+  itimerspec value;
+  zero( value );
+  value.it_value.tv_sec = deadline / 1000000;
+  value.it_value.tv_nsec = (deadline % 1000000) * 1000;
+
+  SystemCall( "timerfd_settime", timerfd_settime( timer_fd_->fd_num(), TFD_TIMER_ABSTIME,
+						  &value, nullptr ) );
+  Stats::thread().count( Stats::Syscalls );
+  armed_deadline_us_ = deadline;
+}
+
+Poller::Result Poller::run_timers( void )
+{
+  const uint64_t now = monotonic_us();
+  Stats & stats = Stats::thread();
+
+  while ( not timer_queue_.empty() and timer_queue_.top().first <= now ) {
+    const uint64_t id = timer_queue_.top().second;
+    timer_queue_.pop();
+
+    auto timer = timers_.find( id );
+    if ( timer == timers_.end() ) { /* cancelled */
+      continue;
+    }
+
+    /* the callback may add or cancel timers (including this one),
+       so hold on to it while it runs */
+    auto callback = move( timer->second.callback );
+    const uint64_t start_ns = Stats::now_ns();
+    const auto result = callback();
+    stats.record( Stats::Timer, Stats::now_ns() - start_ns );
+    stats.count( Stats::Callbacks );
+
+    timer = timers_.find( id );
+    if ( timer == timers_.end() ) {
+      continue;
+    }
+
+    if ( result.result == ResultType::Continue and timer->second.interval_us ) {
+      /* repeat on the same schedule, skipping (not bunching up) any missed intervals */
+      Timer & repeating = timer->second;
+      repeating.deadline_us += repeating.interval_us;
+      if ( repeating.deadline_us <= now ) {
+	repeating.deadline_us += ((now - repeating.deadline_us) / repeating.interval_us + 1)
+	  * repeating.interval_us;
+      }
+      repeating.callback = move( callback );
+      timer_queue_.emplace( repeating.deadline_us, id );
+    } else {
+      timers_.erase( timer );
+    }
+
+    if ( result.result == ResultType::Exit ) {
+      return Result( Result::Type::Exit, result.exit_status );
+    }
+  }
+
+  return Result::Type::Success;
+}
+
 void Poller::add_action( Poller::Action action )
 {
+  const int fd = action.fd.fd_num();
+
   actions_.push_back( action );
-  pollfds_.push_back( { action.fd.fd_num(), 0, 0 } );
+
+  if ( action.direction == Direction::Error ) {
+    error_fds_.push_back( fd );
+  }
+
+  if ( backend_ == Backend::Poll ) {
+    /* the last pollfd is reserved for the timerfd */
+    pollfds_.insert( pollfds_.end() - 1, { fd, 0, 0 } );
+    return;
+  }
+
+  interest_.push_back( 0 );
+
+  if ( backend_ == Backend::IOUring ) {
+    return;
+  }
+
+  /* register each fd once, with no interest until the next call to poll() */
+  auto registration = registrations_.find( fd );
+  if ( registration == registrations_.end() ) {
+    epoll_event event;
+    zero( event );
+    event.data.fd = fd;
+    SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_->fd_num(), EPOLL_CTL_ADD, fd, &event ) );
+
+    registration = registrations_.emplace( fd, Registration { 0, false, {} } ).first;
+    ready_.resize( registrations_.size() + 1 );
+  }
+
+  registration->second.actions.push_back( actions_.size() - 1 );
+  mark_changed( fd );
 }
 
 unsigned int Poller::Action::service_count( void ) const
 {
-  return direction == Direction::In ? fd.read_count() : fd.write_count();
+  /* (reading the error queue counts as a read) */
+  return direction == Direction::Out ? fd.write_count() : fd.read_count();
+}
+
+bool Poller::fatal( const int fd, const short revents ) const
+{
+  if ( revents & (POLLHUP | POLLNVAL) ) {
+    return true;
+  }
+
+  return ( revents & POLLERR )
+    and find( error_fds_.begin(), error_fds_.end(), fd ) == error_fds_.end();
+}
+
+Poller::Result Poller::hang_up( const int fd )
+{
+  const auto hangup = hangup_callbacks_.find( fd );
+  if ( hangup == hangup_callbacks_.end() ) {
+    return Result::Type::Exit;
+  }
+
+  Stats & stats = Stats::thread();
+  const uint64_t start_ns = Stats::now_ns();
+  const auto result = hangup->second();
+  stats.record( Stats::Callback, Stats::now_ns() - start_ns );
+  stats.count( Stats::Callbacks );
+
+  if ( result.result == ResultType::Exit ) {
+    return Result( Result::Type::Exit, result.exit_status );
+  }
+
+  return Result::Type::Success;
+}
+
+short Poller::wanted_events( const Action & action )
+{
+  /* don't poll in on fds that have had EOF */
+  if ( action.direction == Direction::In and action.fd.eof() ) {
+    return 0;
+  }
+
+  return (action.active and action.when_interested()) ? action.direction : 0;
+}
+
+Poller::Action::Result Poller::run_action( Action & action )
+{
+  Stats & stats = Stats::thread();
+  const auto count_before = action.service_count();
+
+  const uint64_t start_ns = Stats::now_ns();
+  auto result = action.callback();
+  stats.record( Stats::Callback, Stats::now_ns() - start_ns );
+  stats.count( Stats::Callbacks );
+
+  /* (a callback that gave up on its fd, e.g. because reading it failed,
+     has no need to read or write it) */
+  if ( count_before == action.service_count() and not removing( action.fd.fd_num() ) ) {
+    throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
+  }
+
+  if ( result.result == ResultType::Cancel ) {
+    action.active = false;
+  }
+
+  return result;
 }
 
 Poller::Result Poller::poll( const int & timeout_ms )
 {
-  assert( pollfds_.size() == actions_.size() );
+  arm_timer_fd();
+
+  Result result = backend_ == Backend::IOUring ? poll_with_io_uring( timeout_ms )
+    : backend_ == Backend::Epoll ? poll_with_epoll( timeout_ms )
+    : poll_with_poll( timeout_ms );
+
+  if ( result.result == Result::Type::Success ) {
+    result = run_timers();
+  }
+
+  forget_removed();
+
+  return result;
+}
+
+Poller::Result Poller::poll_with_poll( const int & timeout_ms )
+{
+  assert( pollfds_.size() == actions_.size() + 1 );
+  Stats & stats = Stats::thread();
 
   /* tell poll whether we care about each fd */
+  uint64_t start_ns = Stats::now_ns();
   for ( unsigned int i = 0; i < actions_.size(); i++ ) {
     assert( pollfds_.at( i ).fd == actions_.at( i ).fd.fd_num() );
-    pollfds_.at( i ).events = (actions_.at( i ).active and actions_.at( i ).when_interested())
-      ? actions_.at( i ).direction : 0;
+    pollfds_.at( i ).events = wanted_events( actions_.at( i ) );
+  }
+  stats.record( Stats::Interest, Stats::now_ns() - start_ns );
+
+  /* Quit if no member in pollfds_ has a non-zero direction and no timer is pending */
+  if ( not accumulate( pollfds_.begin(), pollfds_.end() - 1, false,
+		       [] ( bool acc, pollfd x ) { return acc or x.events; } )
+       and timers_.empty() ) {
+    return Result::Type::Exit;
+  }
 
-    /* don't poll in on fds that have had EOF */
-    if ( actions_.at( i ).direction == Direction::In
-	 and actions_.at( i ).fd.eof() ) {
-      pollfds_.at( i ).events = 0;
+  start_ns = Stats::now_ns();
+  const int ready_count = SystemCall( "poll", ::poll( &pollfds_[ 0 ], pollfds_.size(), timeout_ms ) );
+  stats.record( Stats::PollWait, Stats::now_ns() - start_ns );
+  stats.count( Stats::Syscalls );
+  stats.count( Stats::Wakeups );
+
+  if ( ready_count == 0 ) {
+    return Result::Type::Timeout;
+  }
+
+  for ( unsigned int i = 0; i < actions_.size(); i++ ) {
+    if ( removing( pollfds_[ i ].fd ) ) {
+      continue;
+    }
+
+    if ( fatal( pollfds_[ i ].fd, pollfds_[ i ].revents ) ) {
+      const auto result = hang_up( pollfds_[ i ].fd );
+      if ( result.result == Result::Type::Exit ) {
+	return result;
+      }
+      continue;
+    }
+
+    /* we only want to call callback if revents includes the event
+       we asked for, and the action still wants it (an earlier callback
+       may have changed its mind) */
+    if ( pollfds_[ i ].revents & pollfds_[ i ].events & wanted_events( actions_.at( i ) ) ) {
+      const auto result = run_action( actions_.at( i ) );
+
+      if ( result.result == ResultType::Exit ) {
+	return Result( Result::Type::Exit, result.exit_status );
+      }
     }
   }
 
-  /* Quit if no member in pollfds_ has a non-zero direction */
-  if ( not accumulate( pollfds_.begin(), pollfds_.end(), false,
-		       [] ( bool acc, pollfd x ) { return acc or x.events; } ) ) {
+  return Result::Type::Success;
+}
+
+Poller::Result Poller::poll_with_epoll( const int & timeout_ms )
+{
+  assert( interest_.size() == actions_.size() );
+  Stats & stats = Stats::thread();
+
+  /* ask again only the actions whose interest may have changed (those
+     just added, those on fds serviced by the last call, and those
+     interest_changed() was called for), and tell the kernel about the
+     fds whose combined interest has */
+  uint64_t start_ns = Stats::now_ns();
+  for ( const int fd : changed_fds_ ) {
+    const auto found = registrations_.find( fd );
+    if ( found == registrations_.end() or not found->second.changed ) { /* (removed since) */
+      continue;
+    }
+
+    Registration & registration = found->second;
+    registration.changed = false;
+
+    short events = 0;
+    for ( const size_t i : registration.actions ) {
+      interest_[ i ] = wanted_events( actions_[ i ] );
+      events |= interest_[ i ];
+    }
+
+    if ( events != registration.events ) {
+      epoll_event event;
+      zero( event );
+      event.events = events;
+      event.data.fd = fd;
+      SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_->fd_num(), EPOLL_CTL_MOD, fd, &event ) );
+      stats.count( Stats::Syscalls );
+      interested_fds_ += ( events != 0 ) - ( registration.events != 0 );
+      registration.events = events;
+    }
+  }
+  changed_fds_.clear();
+  stats.record( Stats::Interest, Stats::now_ns() - start_ns );
+
+  /* Quit if no action wants any events and no timer is pending */
+  if ( interested_fds_ == 0 and timers_.empty() ) {
     return Result::Type::Exit;
   }
 
-  if ( 0 == SystemCall( "poll", ::poll( &pollfds_[ 0 ], pollfds_.size(), timeout_ms ) ) ) {
+  start_ns = Stats::now_ns();
+  const int ready_count = SystemCall( "epoll_wait", epoll_wait( epoll_fd_->fd_num(),
+								&ready_[ 0 ], ready_.size(),
+								timeout_ms ) );
+  stats.record( Stats::PollWait, Stats::now_ns() - start_ns );
+  stats.count( Stats::Syscalls );
+  stats.count( Stats::Wakeups );
+  if ( ready_count == 0 ) {
     return Result::Type::Timeout;
   }
 
-  for ( unsigned int i = 0; i < pollfds_.size(); i++ ) {
-    if ( pollfds_[ i ].revents & (POLLERR | POLLHUP | POLLNVAL) ) {
-      return Result::Type::Exit;
+  for ( int j = 0; j < ready_count; j++ ) {
+    /* expired timers are run after the fds are serviced */
+    if ( timer_fd_ and ready_[ j ].data.fd == timer_fd_->fd_num() ) {
+      continue;
+    }
+
+    const int fd = ready_[ j ].data.fd;
+    if ( removing( fd ) ) {
+      continue;
     }
 
-    if ( pollfds_[ i ].revents & pollfds_[ i ].events ) {
-      /* we only want to call callback if revents includes
-	 the event we asked for */
-      const auto count_before = actions_.at( i ).service_count();
-      auto result = actions_.at( i ).callback();
+    /* whatever runs for the fd may change what its actions want */
+    mark_changed( fd );
 
-      if ( count_before == actions_.at( i ).service_count() ) {
-	throw runtime_error( "Poller: busy wait detected: callback did not read/write fd" );
+    if ( fatal( fd, ready_[ j ].events ) ) {
+      const auto result = hang_up( fd );
+      if ( result.result == Result::Type::Exit ) {
+	return result;
       }
+      continue;
+    }
 
-      switch ( result.result ) {
-      case ResultType::Exit:
-	return Result( Result::Type::Exit, result.exit_status );
-      case ResultType::Cancel:
-	actions_.at( i ).active = false;
-      case ResultType::Continue:
+    for ( const size_t i : registrations_.at( fd ).actions ) {
+      /* (an earlier callback may have removed the fd) */
+      if ( removing( fd ) ) {
 	break;
       }
+
+      /* we only want to call callback if the fd is ready for the event
+	 this action asked for, and it still wants it (an earlier callback
+	 on the same fd may have changed its mind) */
+      if ( ready_[ j ].events & interest_[ i ] & wanted_events( actions_[ i ] ) ) {
+	const auto result = run_action( actions_[ i ] );
+
+	if ( result.result == ResultType::Exit ) {
+	  return Result( Result::Type::Exit, result.exit_status );
+	}
+      }
+    }
+  }
+
+  return Result::Type::Success;
+}
+
+Poller::DatagramSource::DatagramSource( IOUring & ring, const uint16_t group_id,
+					const unsigned int entries,
+					UDPSocket & socket, UDPSocket::RecvBatch & s_batch,
+					const Action::CallbackType & s_callback )
+  : batch( s_batch ),
+    callback( s_callback ),
+    fd( socket.fd_num() ),
+    layout( s_batch.multishot_layout() ),
+    buffers(),
+    buffer_ring( ring, group_id, entries ),
+    armed( false ),
+    active( true )
+{
+  /* fill the ring with buffers from the batch's pool */
+  buffers.reserve( entries );
+  for ( unsigned int i = 0; i < entries; i++ ) {
+    buffers.push_back( batch.pool().get() );
+    buffer_ring.add( buffers.back().data(), buffers.back().capacity(), i );
+  }
+  buffer_ring.publish();
+}
+
+void Poller::add_datagram_action( UDPSocket & socket,
+				  UDPSocket::RecvBatch & batch,
+				  const Action::CallbackType & callback )
+{
+  if ( backend_ != Backend::IOUring ) {
+    add_action( Action( socket, Direction::In, [&socket, &batch, callback] () {
+	  socket.recv_batch( batch );
+	  return callback();
+	} ) );
+    return;
+  }
+
+  /* enough buffers for two full batches to be on their way */
+  unsigned int entries = 16;
+  while ( entries < 2 * batch.capacity() ) {
+    entries *= 2;
+  }
+
+  datagram_sources_.emplace_back( new DatagramSource( *ring_, datagram_sources_.size(), entries,
+						      socket, batch, callback ) );
+  batch.clear();
+}
+
+void Poller::arm( DatagramSource & source )
+{
+  io_uring_sqe & sqe = ring_->prepare();
+  sqe.opcode = IORING_OP_RECVMSG;
+  sqe.fd = source.fd;
+  sqe.addr = reinterpret_cast<uint64_t>( &source.layout );
+  sqe.len = 1;
+  sqe.ioprio = IORING_RECV_MULTISHOT;
+  sqe.flags = IOSQE_BUFFER_SELECT;
+  sqe.buf_group = source.buffer_ring.group_id();
+  sqe.user_data = DATAGRAM_RESULT | source.buffer_ring.group_id(); /* its index */
+
+  source.armed = true;
+}
+
+Poller::Action::Result Poller::deliver( DatagramSource & source )
+{
+  /* the slots the batch gave up in exchange are back in the ring by now */
+  source.buffer_ring.publish();
+
+  /* (the kernel received these without a system call of ours to count them) */
+  Stats & stats = Stats::thread();
+  uint64_t bytes = 0;
+  for ( size_t i = 0; i < source.batch.size(); i++ ) {
+    bytes += source.batch.payload_length( i );
+  }
+  stats.count( Stats::DatagramsReceived, source.batch.size() );
+  stats.count( Stats::BytesRead, bytes );
+
+  const uint64_t start_ns = Stats::now_ns();
+  const auto result = source.callback();
+  stats.record( Stats::Callback, Stats::now_ns() - start_ns );
+  stats.count( Stats::Callbacks );
+  source.batch.clear();
+
+  if ( result.result == ResultType::Cancel ) {
+    source.active = false;
+  }
+
+  return result;
+}
+
+Poller::Result Poller::poll_with_io_uring( const int & timeout_ms )
+{
+  assert( interest_.size() == actions_.size() );
+  Stats & stats = Stats::thread();
+
+  /* ask for a poll of each fd an action wants, unless one is already outstanding */
+  uint64_t start_ns = Stats::now_ns();
+  bool any_interest = false;
+  for ( unsigned int i = 0; i < actions_.size(); i++ ) {
+    const short events = wanted_events( actions_[ i ] );
+    any_interest = any_interest or events;
+
+    if ( events and not interest_[ i ] ) {
+      io_uring_sqe & sqe = ring_->prepare();
+      sqe.opcode = IORING_OP_POLL_ADD;
+      sqe.fd = actions_[ i ].fd.fd_num();
+      sqe.poll32_events = events;
+      sqe.user_data = ACTION_RESULT | i;
+      interest_[ i ] = events;
+    }
+  }
+
+  for ( unsigned int j = 0; j < datagram_sources_.size(); j++ ) {
+    DatagramSource & source = *datagram_sources_[ j ];
+    if ( source.active ) {
+      any_interest = true;
+      if ( not source.armed ) {
+	arm( source );
+      }
     }
   }
+  stats.record( Stats::Interest, Stats::now_ns() - start_ns );
+
+  /* Quit if no action wants any events and no timer is pending */
+  if ( not any_interest and timers_.empty() ) {
+    return Result::Type::Exit;
+  }
+
+  /* wait no later than the next timer is due */
+  int64_t timeout_us = timeout_ms < 0 ? -1 : int64_t( timeout_ms ) * 1000;
+  if ( not timer_queue_.empty() ) {
+    const uint64_t now = monotonic_us(), deadline = timer_queue_.top().first;
+    const int64_t until_deadline = deadline > now ? deadline - now : 0;
+    timeout_us = timeout_us < 0 ? until_deadline : min( timeout_us, until_deadline );
+  }
+
+  start_ns = Stats::now_ns();
+  ring_->wait( 1, timeout_us );
+  stats.record( Stats::PollWait, Stats::now_ns() - start_ns );
+  stats.count( Stats::Syscalls );
+  stats.count( Stats::Wakeups );
+
+  bool any_result = false;
+  io_uring_cqe cqe;
+  while ( ring_->next_completion( cqe ) ) {
+    any_result = true;
+    const size_t index = cqe.user_data & RESULT_INDEX_MASK;
+
+    if ( ( cqe.user_data & ~RESULT_INDEX_MASK ) == ACTION_RESULT ) {
+      interest_[ index ] = 0;
+      if ( cqe.res < 0 ) {
+	throw unix_error( "poll (io_uring)", -cqe.res );
+      }
+
+      if ( fatal( actions_[ index ].fd.fd_num(), cqe.res ) ) {
+	const auto result = hang_up( actions_[ index ].fd.fd_num() );
+	if ( result.result == Result::Type::Exit ) {
+	  return result;
+	}
+	continue;
+      }
+
+      /* we only want to call callback if the fd is ready
+	 for the event this action (still) asks for */
+      if ( cqe.res & wanted_events( actions_[ index ] ) ) {
+	const auto result = run_action( actions_[ index ] );
+
+	if ( result.result == ResultType::Exit ) {
+	  return Result( Result::Type::Exit, result.exit_status );
+	}
+      }
+
+      continue;
+    }
+
+    DatagramSource & source = *datagram_sources_.at( index );
+
+    /* the multishot request has ended (e.g. for want of buffers),
+       so it will have to be made again */
+    if ( not ( cqe.flags & IORING_CQE_F_MORE ) ) {
+      source.armed = false;
+    }
+
+    if ( cqe.res == -ENOBUFS ) {
+      continue;
+    } else if ( cqe.res < 0 ) {
+      throw unix_error( "recvmsg (io_uring)", -cqe.res );
+    }
+
+    if ( not ( cqe.flags & IORING_CQE_F_BUFFER ) ) {
+      throw runtime_error( "recvmsg (io_uring): no buffer" );
+    }
+
+    if ( not source.active ) {
+      continue;
+    }
+
+    if ( source.batch.full() ) {
+      const auto result = deliver( source );
+      if ( result.result == ResultType::Exit ) {
+	return Result( Result::Type::Exit, result.exit_status );
+      }
+    }
+
+    /* the batch takes the filled buffer, and the ring gets a free one back */
+    const uint16_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+    PacketPool::Buffer & buffer = source.buffers.at( buffer_id );
+    buffer = source.batch.add_multishot( move( buffer ), cqe.res );
+    source.buffer_ring.add( buffer.data(), buffer.capacity(), buffer_id );
+  }
+
+  /* hand over whatever arrived */
+  for ( const auto & source : datagram_sources_ ) {
+    if ( source->active and source->batch.size() ) {
+      const auto result = deliver( *source );
+      if ( result.result == ResultType::Exit ) {
+	return Result( Result::Type::Exit, result.exit_status );
+      }
+    } else {
+      source->buffer_ring.publish();
+    }
+  }
+
+  if ( not any_result
+       and ( timer_queue_.empty() or timer_queue_.top().first > monotonic_us() ) ) {
+    return Result::Type::Timeout;
+  }
 
   return Result::Type::Success;
 }
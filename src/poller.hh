@@ -1,12 +1,19 @@
 #ifndef POLLER_HH
 #define POLLER_HH
 
+#include <deque>
 #include <functional>
+#include <memory>
+#include <queue>
+#include <unordered_map>
 #include <vector>
 
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include "file_descriptor.hh"
+#include "io_uring.hh"
+#include "socket.hh"
 
 class Poller
 {
@@ -24,7 +31,10 @@ public:
     typedef std::function<Result(void)> CallbackType;
 
     FileDescriptor & fd;
-    enum PollDirection : short { In = POLLIN, Out = POLLOUT } direction;
+
+    /* (Error is for sockets with something on their error queue,
+       such as transmit timestamps; see UDPSocket::set_tx_timestamps) */
+    enum PollDirection : short { In = POLLIN, Out = POLLOUT, Error = POLLERR } direction;
     CallbackType callback;
     std::function<bool(void)> when_interested;
     bool active;
@@ -39,11 +49,6 @@ public:
     unsigned int service_count( void ) const;
   };
 
-private:
-  std::vector< Action > actions_;
-  std::vector< pollfd > pollfds_;
-
-public:
   struct Result
   {
     enum class Type { Success, Timeout, Exit } result;
@@ -52,9 +57,171 @@ public:
       : result( s_result ), exit_status( s_status ) {}
   };
 
-  Poller() : actions_(), pollfds_() {}
+  /* how the Poller asks the kernel which fds are ready */
+  enum class Backend {
+    Poll,   /* rebuild a pollfd array on every call */
+    Epoll,  /* keep registrations, and update them only when interest changes
+	       (which it is assumed to do only when a callback on the same fd
+	       runs, unless interest_changed() says otherwise) */
+    IOUring /* wait in io_uring_enter, which also submits a poll request for
+	       each fd, and receives datagrams without any further system calls */
+  };
+
+private:
+  Backend backend_;
+  std::deque< Action > actions_; /* (so a callback may add actions while its own runs) */
+
+  /* fds with an Error action, for which POLLERR is no reason to quit */
+  std::vector< int > error_fds_;
+
+  /* fds with a callback to run if they hang up or fail, rather than quitting */
+  std::unordered_map< int, Action::CallbackType > hangup_callbacks_;
+
+  /* fds whose actions are to be forgotten by the end of this poll() */
+  std::vector< int > removed_fds_;
+
+  /* poll backend */
+  std::vector< pollfd > pollfds_;
+
+  /* epoll backend: the events registered for each fd, and the actions that share it */
+  struct Registration
+  {
+    short events;
+    bool changed; /* (listed in changed_fds_) */
+    std::vector< size_t > actions;
+  };
+
+  std::unique_ptr< FileDescriptor > epoll_fd_;
+  std::unordered_map< int, Registration > registrations_;
+  std::vector< short > interest_; /* events each action wanted when last asked */
+  std::vector< int > changed_fds_; /* fds whose actions to ask again on the next call */
+  size_t interested_fds_;          /* registered with some events */
+  std::vector< epoll_event > ready_;
+
+  /* io_uring backend (interest_ holds the events each action has a poll
+     request outstanding for) */
+  std::unique_ptr< IOUring > ring_;
+
+  /* a socket whose datagrams a multishot recvmsg gathers into a batch */
+  struct DatagramSource
+  {
+    UDPSocket::RecvBatch & batch;
+    Action::CallbackType callback;
+    int fd;
+    msghdr layout;
+    std::vector< PacketPool::Buffer > buffers; /* by buffer id */
+    IOUring::BufferRing buffer_ring;
+    bool armed, active;
+
+    DatagramSource( IOUring & ring, const uint16_t group_id, const unsigned int entries,
+		    UDPSocket & socket, UDPSocket::RecvBatch & s_batch,
+		    const Action::CallbackType & s_callback );
+  };
+
+  std::vector< std::unique_ptr< DatagramSource > > datagram_sources_;
+
+  /* timers: pending callbacks by id, and their (deadline, id) pairs earliest-first
+     (cancelled timers are left in the queue and skipped when they come up) */
+  struct Timer
+  {
+    uint64_t deadline_us;
+    uint64_t interval_us;
+    Action::CallbackType callback;
+  };
+
+  typedef std::pair< uint64_t, uint64_t > TimerQueueEntry;
+
+  std::unordered_map< uint64_t, Timer > timers_;
+  std::priority_queue< TimerQueueEntry, std::vector< TimerQueueEntry >,
+		       std::greater< TimerQueueEntry > > timer_queue_;
+  uint64_t next_timer_id_;
+
+  /* timerfd that wakes the kernel wait at the earliest deadline */
+  std::unique_ptr< FileDescriptor > timer_fd_;
+  uint64_t armed_deadline_us_;
+
+  /* point the timerfd at the earliest pending deadline (or disarm it) */
+  void arm_timer_fd( void );
+
+  /* run the callbacks of every timer whose deadline has passed */
+  Result run_timers( void );
+
+  /* do the events reported for an fd mean there's no more to do with it? */
+  bool fatal( const int fd, const short revents ) const;
+
+  /* deal with an fd for which fatal() is true: run its hangup callback
+     if it has one (Success), or else give up (Exit) */
+  Result hang_up( const int fd );
+
+  /* ask an fd's actions what they want on the next call (epoll backend) */
+  void mark_changed( const int fd );
+
+  /* has remove_actions() been called on an fd during this poll()? */
+  bool removing( const int fd ) const;
+
+  /* drop the actions of the fds given to remove_actions() */
+  void forget_removed( void );
+
+  /* which events (if any) an action wants now */
+  static short wanted_events( const Action & action );
+
+  /* run the callback of an action whose fd is ready */
+  Action::Result run_action( Action & action );
+
+  Result poll_with_poll( const int & timeout_ms );
+  Result poll_with_epoll( const int & timeout_ms );
+  Result poll_with_io_uring( const int & timeout_ms );
+
+  /* (re)start the multishot recvmsg of a datagram source */
+  void arm( DatagramSource & source );
+
+  /* hand a datagram source's batch to its callback, and start a new one */
+  Action::Result deliver( DatagramSource & source );
+
+public:
+  Poller( const Backend & backend = Backend::Poll );
   void add_action( Action action );
   Result poll( const int & timeout_ms );
+
+  /* when datagrams arrive on a socket, receive them into the batch and run
+     the callback (which reads them from the batch); with the io_uring
+     backend, the kernel receives them into buffers taken from the batch's
+     pool (which must outlive the Poller) as they arrive */
+  void add_datagram_action( UDPSocket & socket,
+			    UDPSocket::RecvBatch & batch,
+			    const Action::CallbackType & callback );
+
+  /* run a callback delay_us microseconds from now, and then every interval_us
+     (if nonzero) until it returns Cancel; returns an id for cancel_timer()
+     (never 0, so that can stand for no timer) */
+  uint64_t add_timer( const uint64_t delay_us,
+		      const Action::CallbackType & callback,
+		      const uint64_t interval_us = 0 );
+
+  /* cancel a pending timer (returns false if it had already finished) */
+  bool cancel_timer( const uint64_t id );
+
+  /* stop watching an fd: its actions run no more, and are forgotten by
+     the time poll() returns, after which the fd may be closed (not
+     before, since the kernel may still be watching it). May be called
+     from a callback. Not supported by the io_uring backend. */
+  void remove_actions( const FileDescriptor & fd );
+
+  /* something other than a callback on an fd's own actions may have
+     changed what they want (e.g. a timer made a socket worth writing
+     to): ask them again on the next call. Only the epoll backend needs
+     telling; the others ask every action on every call. */
+  void interest_changed( const FileDescriptor & fd );
+
+  /* if an fd hangs up or has an error (e.g. a peer resets a connection),
+     run this callback instead of its actions, rather than having poll()
+     return Exit; it should remove the fd's actions, or it will be run
+     again on the next call */
+  void set_hangup_callback( const FileDescriptor & fd, const Action::CallbackType & callback );
+
+  /* forbid copying, since actions and timers may refer back to the Poller */
+  Poller( const Poller & other ) = delete;
+  const Poller & operator=( const Poller & other ) = delete;
 };
 
 namespace PollerShortNames {
@@ -0,0 +1,99 @@
+/* checks that a Poller survives a connection reset between a wakeup and
+   the write it was for: the action gives up on the fd and removes it
+   (as tcpserver's and tcpbench's do), which is not a busy wait */
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include "poller.hh"
+#include "socket.hh"
+#include "util.hh"
+
+using namespace std;
+using namespace PollerShortNames;
+
+static void check( const bool condition, const string & what )
+{
+  if ( not condition ) {
+    throw runtime_error( "check failed: " + what );
+  }
+}
+
+static void check_reset_mid_wakeup( void )
+{
+  TCPSocket listener;
+  listener.bind( Address( "::1", uint16_t( 0 ) ) );
+  listener.listen();
+
+  unique_ptr<TCPSocket> client( new TCPSocket );
+  client->connect( listener.local_address() );
+  TCPSocket server = listener.accept();
+  server.set_blocking( false );
+
+  int pipe_fds[ 2 ];
+  SystemCall( "pipe", pipe( pipe_fds ) );
+  FileDescriptor pipe_read( pipe_fds[ 0 ] ), pipe_write( pipe_fds[ 1 ] );
+  pipe_write.write( "x" );
+
+  Poller poller( Poller::Backend::Epoll );
+  unsigned int failed_writes = 0;
+
+  /* ready first: the client resets the connection (closing with a
+     zero linger time sends a RST, which loopback delivers at once) */
+  poller.add_action( Action( pipe_read, Direction::In, [&] () {
+	pipe_read.read();
+	if ( client ) {
+	  linger reset;
+	  zero( reset );
+	  reset.l_onoff = 1;
+	  SystemCall( "setsockopt", setsockopt( client->fd_num(), SOL_SOCKET, SO_LINGER,
+						&reset, sizeof( reset ) ) );
+	  client.reset();
+	}
+	return ResultType::Continue;
+      } ) );
+
+  /* ready too, in the same wakeup: by the time this runs, writing fails */
+  poller.add_action( Action( server, Direction::Out, [&] () {
+	try {
+	  server.write( "hello", false );
+	} catch ( const unix_error & ) {
+	  failed_writes++;
+	  poller.remove_actions( server );
+	}
+	return ResultType::Continue;
+      } ) );
+
+  const auto result = poller.poll( 1000 );
+  check( result.result == PollResult::Success, "the wakeup succeeded" );
+  check( failed_writes == 1, "the write after the reset failed" );
+
+  /* and the loop carries on without the connection */
+  pipe_write.write( "x" );
+  check( poller.poll( 1000 ).result == PollResult::Success, "the next wakeup succeeded" );
+  check( failed_writes == 1, "the removed action ran no more" );
+}
+
+int main()
+{
+  /* a write to a reset connection fails (EPIPE), rather than killing us */
+  signal( SIGPIPE, SIG_IGN );
+
+  try {
+    for ( unsigned int i = 0; i < 100; i++ ) {
+      check_reset_mid_wakeup();
+    }
+  } catch ( const exception & e ) {
+    cerr << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  cerr << "Poller checks passed." << endl;
+  return EXIT_SUCCESS;
+}
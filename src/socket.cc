@@ -1,11 +1,76 @@
+#include <algorithm>
+#include <deque>
+
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #include "socket.hh"
+#include "stats.hh"
 #include "util.hh"
 #include "timestamp.hh"
 
 using namespace std;
 
+/* room for the control messages (e.g. the timestamp) of one datagram */
+static const size_t RECEIVE_CONTROL_SIZE = 256;
+static const size_t SEND_CONTROL_SIZE = 64;
+
+/* the same, for a datagram received by a multishot recvmsg: the
+   timestamp, the GRO segment size, and with transmit timestamps on,
+   the SCM_TIMESTAMPING the kernel then adds to received datagrams too */
+static const size_t MULTISHOT_CONTROL_SIZE = 128;
+
+/* send requests to have in an io_uring submission queue at once */
+static const unsigned int SEND_RING_ENTRIES = 1024;
+
+/* the most datagrams (and bytes, for a UDP datagram over IPv4) the
+   kernel will take as one with GSO */
+static const size_t MAX_GSO_SEGMENTS = 64;
+static const size_t MAX_GSO_BYTES = 65507;
+
+/* room for the control message giving a GSO segment size */
+static const size_t GSO_CONTROL_SIZE = 32;
+
+/* make sure we got the whole datagram (unless the caller drops the ones
+   too big for their slots) */
+static void check_received_flags( const msghdr & header, const bool truncation_ok = false )
+{
+  if ( ( header.msg_flags & MSG_TRUNC ) and not truncation_ok ) {
+    throw runtime_error( "recvfrom (oversized datagram)" );
+  } else if ( header.msg_flags & ~MSG_TRUNC ) {
+    throw runtime_error( "recvfrom (unhandled flag)" );
+  }
+}
+
+/* find the timestamp header (if there is one), and with GRO, the size
+   of the datagrams the kernel coalesced (or 0 if it didn't) */
+static uint64_t received_timestamp( msghdr & header, size_t & segment_size )
+{
+  uint64_t timestamp = -1;
+  segment_size = 0;
+
+  cmsghdr *ts_hdr = CMSG_FIRSTHDR( &header );
+  while ( ts_hdr ) {
+    if ( ts_hdr->cmsg_level == SOL_SOCKET
+	 and ts_hdr->cmsg_type == SO_TIMESTAMPNS ) {
+      const timespec * const kernel_time = reinterpret_cast<timespec *>( CMSG_DATA( ts_hdr ) );
+      timestamp = timestamp_us( *kernel_time );
+    } else if ( ts_hdr->cmsg_level == SOL_UDP
+		and ts_hdr->cmsg_type == UDP_GRO ) {
+      int gso_size;
+      memcpy( &gso_size, CMSG_DATA( ts_hdr ), sizeof( gso_size ) );
+      segment_size = gso_size;
+    }
+    ts_hdr = CMSG_NXTHDR( &header, ts_hdr );
+  }
+
+  return timestamp;
+}
+
 /* default constructor for socket of (subclassed) domain and type */
 Socket::Socket( const int domain, const int type )
   : FileDescriptor( SystemCall( "socket", socket( domain, type, 0 ) ) )
@@ -70,31 +135,114 @@ void Socket::bind( const Address & address )
 /* connect socket to a specified peer address */
 void Socket::connect( const Address & address )
 {
-  SystemCall( "connect", ::connect( fd_num(),
-				    &address.to_sockaddr(),
-				    address.size() ) );
+  const int result = ::connect( fd_num(), &address.to_sockaddr(), address.size() );
+  if ( result < 0 and errno == EINPROGRESS ) { /* non-blocking, and under way */
+    return;
+  }
+
+  SystemCall( "connect", result );
 }
 
-/* receive datagram and where it came from */
-UDPSocket::received_datagram UDPSocket::recv( void )
+/* The kernel numbers each message sent (once per sendmsg, however
+   many datagrams GSO makes of it) and tags its timestamp with that
+   number; this remembers which datagrams each number stands for. */
+struct UDPSocket::TxTimestamps
+{
+  /* timestamps read from the error queue per system call */
+  static const size_t BATCH_SIZE = 64;
+  static const size_t CONTROL_SIZE = 256;
+
+  /* how many datagrams went out in each message whose timestamp hasn't
+     come back yet, oldest first, with the kernel's number for the
+     oldest and the number of its first datagram */
+  deque<uint32_t> messages;
+  uint32_t first_key;
+  uint64_t first_datagram;
+
+  vector<mmsghdr> headers;
+  vector<char> control;
+
+  TxTimestamps()
+    : messages(), first_key( 0 ), first_datagram( 0 ),
+      headers( BATCH_SIZE ), control( BATCH_SIZE * CONTROL_SIZE )
+  {}
+
+  /* match one message from the error queue to what was sent */
+  void received( msghdr & header, const TxTimestampCallback & callback );
+};
+
+void UDPSocket::TxTimestamps::received( msghdr & header, const TxTimestampCallback & callback )
 {
-  static const ssize_t RECEIVE_MTU = 65536;
+  const scm_timestamping * timestamps = nullptr;
+  const sock_extended_err * error = nullptr;
+
+  for ( cmsghdr * hdr = CMSG_FIRSTHDR( &header ); hdr; hdr = CMSG_NXTHDR( &header, hdr ) ) {
+    if ( hdr->cmsg_level == SOL_SOCKET and hdr->cmsg_type == SCM_TIMESTAMPING ) {
+      timestamps = reinterpret_cast<const scm_timestamping *>( CMSG_DATA( hdr ) );
+    } else if ( ( hdr->cmsg_level == SOL_IP and hdr->cmsg_type == IP_RECVERR )
+		or ( hdr->cmsg_level == SOL_IPV6 and hdr->cmsg_type == IPV6_RECVERR ) ) {
+      error = reinterpret_cast<const sock_extended_err *>( CMSG_DATA( hdr ) );
+    }
+  }
+
+  if ( not timestamps or not error
+       or error->ee_errno != ENOMSG
+       or error->ee_origin != SO_EE_ORIGIN_TIMESTAMPING
+       or error->ee_info != SCM_TSTAMP_SND ) {
+    return;
+  }
 
+  /* forget messages whose timestamps were dropped (e.g. when the error queue was full) */
+  const uint32_t key = error->ee_data;
+  while ( not messages.empty() and int32_t( key - first_key ) > 0 ) {
+    first_datagram += messages.front();
+    messages.pop_front();
+    first_key++;
+  }
+
+  /* ... and ignore one that's already been seen */
+  if ( messages.empty() or key != first_key ) {
+    return;
+  }
+
+  const uint64_t timestamp = timestamp_us( timestamps->ts[ 0 ] );
+  for ( uint32_t i = 0; i < messages.front(); i++ ) {
+    callback( first_datagram + i, timestamp );
+  }
+
+  first_datagram += messages.front();
+  messages.pop_front();
+  first_key++;
+}
+
+UDPSocket::UDPSocket()
+  : Socket( AF_INET6, SOCK_DGRAM ),
+    send_ring_(),
+    gso_( false ),
+    tx_timestamps_()
+{}
+
+UDPSocket::~UDPSocket()
+{}
+
+/* receive datagram and where it came from */
+UDPSocket::received_datagram UDPSocket::recv( PacketPool & pool )
+{
   /* receive source address, timestamp and payload */
   Address::raw datagram_source_address;
   msghdr header; zero( header );
   iovec msg_iovec; zero( msg_iovec );
 
-  char msg_payload[ RECEIVE_MTU ];
-  char msg_control[ RECEIVE_MTU ];
+  PacketPool::Buffer msg_payload = pool.get();
+  char msg_control[ RECEIVE_CONTROL_SIZE ];
 
   /* prepare to get the source address */
   header.msg_name = &datagram_source_address;
   header.msg_namelen = sizeof( datagram_source_address );
 
   /* prepare to get the payload */
-  msg_iovec.iov_base = msg_payload;
-  msg_iovec.iov_len = sizeof( msg_payload );
+  msg_iovec.iov_base = msg_payload.data();
+  msg_iovec.iov_len = msg_payload.capacity();
   header.msg_iov = &msg_iovec;
   header.msg_iovlen = 1;
 
@@ -106,34 +254,243 @@ UDPSocket::received_datagram UDPSocket::recv( void )
   ssize_t recv_len = SystemCall( "recvmsg",
 				 recvmsg( fd_num(), &header, 0 ) );
 
-  register_read();
+  register_read( recv_len );
 
-  /* make sure we got the whole datagram */
-  if ( header.msg_flags & MSG_TRUNC ) {
-    throw runtime_error( "recvfrom (oversized datagram)" );
-  } else if ( header.msg_flags ) {
-    throw runtime_error( "recvfrom (unhandled flag)" );
+  check_received_flags( header );
+
+  msg_payload.set_length( recv_len );
+
+  /* (with GRO, the payload may be several datagrams that were coalesced) */
+  size_t segment_size;
+  const uint64_t timestamp = received_timestamp( header, segment_size );
+  Stats::thread().count( Stats::DatagramsReceived,
+			 segment_size ? ( recv_len + segment_size - 1 ) / segment_size : 1 );
+
+  return { Address( datagram_source_address, header.msg_namelen ),
+	   timestamp,
+	   move( msg_payload ) };
+}
+
+UDPSocket::RecvBatch::RecvBatch( const size_t capacity, const size_t mtu )
+  : RecvBatch( capacity, unique_ptr<PacketPool>( new PacketPool( mtu, capacity ) ), nullptr )
+{}
+
+UDPSocket::RecvBatch::RecvBatch( const size_t capacity, PacketPool & pool )
+  : RecvBatch( capacity, nullptr, &pool )
+{}
+
+/* storage for a batch of datagrams, with each header pointing at its own slot */
+UDPSocket::RecvBatch::RecvBatch( const size_t capacity,
+				 unique_ptr<PacketPool> own_pool,
+				 PacketPool * const pool )
+  : own_pool_( move( own_pool ) ),
+    pool_( pool ? *pool : *own_pool_ ),
+    headers_( capacity ),
+    iovecs_( capacity ),
+    source_addresses_( capacity ),
+    payloads_(),
+    payload_offsets_( capacity ),
+    control_( capacity * RECEIVE_CONTROL_SIZE ),
+    timestamps_( capacity ),
+    segment_sizes_( capacity ),
+    size_( 0 ),
+    segments_(),
+    scanned_( 0 ),
+    oversized_( 0 )
+{
+  if ( capacity == 0 ) {
+    throw runtime_error( "RecvBatch: capacity must be nonzero" );
   }
 
-  uint64_t timestamp = -1;
+  segments_.reserve( capacity );
 
-  /* find the timestamp header (if there is one) */
-  cmsghdr *ts_hdr = CMSG_FIRSTHDR( &header );
-  while ( ts_hdr ) {
-    if ( ts_hdr->cmsg_level == SOL_SOCKET
-	 and ts_hdr->cmsg_type == SO_TIMESTAMPNS ) {
-      const timespec * const kernel_time = reinterpret_cast<timespec *>( CMSG_DATA( ts_hdr ) );
-      timestamp = timestamp_ms( *kernel_time );
+  payloads_.reserve( capacity );
+
+  for ( size_t i = 0; i < capacity; i++ ) {
+    zero( headers_[ i ] );
+    zero( iovecs_[ i ] );
+
+    payloads_.push_back( pool_.get() );
+    iovecs_[ i ].iov_base = payloads_[ i ].data();
+    iovecs_[ i ].iov_len = payloads_[ i ].capacity();
+
+    msghdr & header = headers_[ i ].msg_hdr;
+    header.msg_name = &source_addresses_[ i ];
+    header.msg_iov = &iovecs_[ i ];
+    header.msg_iovlen = 1;
+    header.msg_control = &control_[ i * RECEIVE_CONTROL_SIZE ];
+  }
+
+  prepare();
+}
+
+void UDPSocket::RecvBatch::prepare( void )
+{
+  for ( auto & entry : headers_ ) {
+    entry.msg_hdr.msg_namelen = sizeof( Address::raw );
+    entry.msg_hdr.msg_controllen = RECEIVE_CONTROL_SIZE;
+    entry.msg_hdr.msg_flags = 0;
+    entry.msg_len = 0;
+  }
+
+  fill( payload_offsets_.begin(), payload_offsets_.end(), 0 );
+
+  size_ = 0;
+  segments_.clear();
+  scanned_ = 0;
+}
+
+void UDPSocket::RecvBatch::split( void )
+{
+  /* (with io_uring, this runs as each datagram is added, so only look
+     at the new ones, or a dropped one would be counted again and again) */
+  for ( uint32_t i = scanned_; i < size_; i++ ) {
+    /* a datagram too big for its slot arrived cut short, so drop it */
+    if ( headers_[ i ].msg_hdr.msg_flags & MSG_TRUNC ) {
+      oversized_++;
+      continue;
+    }
+
+    const uint32_t length = headers_[ i ].msg_len;
+    const uint32_t segment_size = segment_sizes_[ i ];
+
+    if ( segment_size == 0 or segment_size >= length ) {
+      segments_.push_back( { i, 0, length } );
+      continue;
+    }
+
+    /* each coalesced datagram was segment_size bytes, except perhaps the last */
+    for ( uint32_t offset = 0; offset < length; offset += segment_size ) {
+      segments_.push_back( { i, offset, min( segment_size, length - offset ) } );
     }
-    ts_hdr = CMSG_NXTHDR( &header, ts_hdr );
   }
 
-  received_datagram ret = { Address( datagram_source_address,
-				     header.msg_namelen ),
-			    timestamp,
-			    string( msg_payload, recv_len ) };
+  scanned_ = size_;
+}
 
-  return ret;
+Address UDPSocket::RecvBatch::source_address( const size_t i ) const
+{
+  const uint32_t entry = segments_.at( i ).entry;
+  return Address( source_addresses_[ entry ], headers_[ entry ].msg_hdr.msg_namelen );
+}
+
+PacketPool::Buffer UDPSocket::RecvBatch::take( const size_t index )
+{
+  const Segment & segment = segments_.at( index );
+
+  /* a datagram that was coalesced with others gets a copy of its own */
+  if ( segment.length != headers_[ segment.entry ].msg_len ) {
+    PacketPool::Buffer payload = pool_.get();
+    memcpy( payload.data(), this->payload( index ), segment.length );
+    payload.set_length( segment.length );
+    return payload;
+  }
+
+  const uint32_t i = segment.entry;
+  PacketPool::Buffer payload = move( payloads_[ i ] );
+
+  /* a payload received through io_uring comes after its metadata */
+  if ( payload_offsets_[ i ] ) {
+    memmove( payload.data(), payload.data() + payload_offsets_[ i ], headers_[ i ].msg_len );
+    payload_offsets_[ i ] = 0;
+  }
+  payload.set_length( headers_[ i ].msg_len );
+
+  payloads_[ i ] = pool_.get();
+  iovecs_[ i ].iov_base = payloads_[ i ].data();
+  iovecs_[ i ].iov_len = payloads_[ i ].capacity();
+
+  return payload;
+}
+
+msghdr UDPSocket::RecvBatch::multishot_layout( void ) const
+{
+  msghdr layout;
+  zero( layout );
+  layout.msg_namelen = sizeof( Address::raw );
+  layout.msg_controllen = MULTISHOT_CONTROL_SIZE;
+  return layout;
+}
+
+PacketPool::Buffer UDPSocket::RecvBatch::add_multishot( PacketPool::Buffer && buffer,
+							const size_t length )
+{
+  if ( full() ) {
+    throw runtime_error( "RecvBatch: batch is full" );
+  }
+
+  const size_t metadata_size = sizeof( io_uring_recvmsg_out )
+    + sizeof( Address::raw ) + MULTISHOT_CONTROL_SIZE;
+  if ( length < metadata_size ) {
+    throw runtime_error( "recvmsg (io_uring result too short)" );
+  }
+
+  io_uring_recvmsg_out out;
+  memcpy( &out, buffer.data(), sizeof( out ) );
+
+  /* the parts of the buffer, as the kernel laid them out */
+  const size_t i = size_++;
+  msghdr & header = headers_[ i ].msg_hdr;
+
+  header.msg_namelen = min<size_t>( out.namelen, sizeof( Address::raw ) );
+  memcpy( &source_addresses_[ i ], buffer.data() + sizeof( out ), header.msg_namelen );
+
+  msghdr control;
+  zero( control );
+  control.msg_control = buffer.data() + sizeof( out ) + sizeof( Address::raw );
+  control.msg_controllen = out.controllen;
+  control.msg_flags = out.flags;
+  check_received_flags( control, true );
+  header.msg_flags = out.flags;
+  timestamps_[ i ] = received_timestamp( control, segment_sizes_[ i ] );
+
+  headers_[ i ].msg_len = out.payloadlen;
+  payload_offsets_[ i ] = metadata_size;
+
+  /* swap the buffer in */
+  PacketPool::Buffer exchange = move( payloads_[ i ] );
+  payloads_[ i ] = move( buffer );
+  iovecs_[ i ].iov_base = payloads_[ i ].data();
+  iovecs_[ i ].iov_len = payloads_[ i ].capacity();
+
+  split();
+
+  return exchange;
+}
+
+/* receive as many datagrams as are ready (up to the batch capacity),
+   blocking only until the first one arrives */
+size_t UDPSocket::recv_batch( RecvBatch & batch )
+{
+  batch.prepare();
+
+  /* call recvmmsg */
+  Stats & stats = Stats::thread();
+  const uint64_t start_ns = Stats::now_ns();
+  const int count = SystemCall( "recvmmsg",
+				recvmmsg( fd_num(),
+					  &batch.headers_[ 0 ], batch.headers_.size(),
+					  MSG_WAITFORONE, nullptr ) );
+  stats.record( Stats::Receive, Stats::now_ns() - start_ns );
+
+  uint64_t bytes = 0;
+  for ( int i = 0; i < count; i++ ) {
+    bytes += batch.headers_[ i ].msg_len;
+  }
+  register_read( bytes );
+
+  for ( int i = 0; i < count; i++ ) {
+    check_received_flags( batch.headers_[ i ].msg_hdr, true );
+    batch.timestamps_[ i ] = received_timestamp( batch.headers_[ i ].msg_hdr,
+						 batch.segment_sizes_[ i ] );
+  }
+
+  batch.size_ = count;
+  batch.split();
+
+  stats.count( Stats::DatagramsReceived, batch.size() );
+
+  return batch.size();
 }
 
 /* send datagram to specified address */
@@ -147,11 +504,16 @@ void UDPSocket::sendto( const Address & destination, const string & payload )
 				    &destination.to_sockaddr(),
 				    destination.size() ) );
 
-  register_write();
+  register_write( bytes_sent );
+  Stats::thread().count( Stats::DatagramsSent );
 
   if ( size_t( bytes_sent ) != payload.size() ) {
     throw runtime_error( "datagram payload too big for sendto()" );
   }
+
+  if ( tx_timestamps_ ) {
+    tx_timestamps_->messages.push_back( 1 );
+  }
 }
 
 /* send datagram to connected address */
@@ -163,10 +525,319 @@ void UDPSocket::send( const string & payload )
 				payload.size(),
 				0 ) );
 
-  register_write();
+  register_write( bytes_sent );
+  Stats::thread().count( Stats::DatagramsSent );
   if ( size_t( bytes_sent ) != payload.size() ) {
     throw runtime_error( "datagram payload too big for send()" );
   }
+
+  if ( tx_timestamps_ ) {
+    tx_timestamps_->messages.push_back( 1 );
+  }
+}
+
+UDPSocket::SendBatch::SendBatch( const size_t capacity, const size_t mtu )
+  : SendBatch( capacity, unique_ptr<PacketPool>( new PacketPool( mtu, capacity ) ), nullptr )
+{}
+
+UDPSocket::SendBatch::SendBatch( const size_t capacity, PacketPool & pool )
+  : SendBatch( capacity, nullptr, &pool )
+{}
+
+/* storage for a batch of outgoing datagrams, with each header pointing at its own slot */
+UDPSocket::SendBatch::SendBatch( const size_t capacity,
+				 unique_ptr<PacketPool> own_pool,
+				 PacketPool * const pool )
+  : own_pool_( move( own_pool ) ),
+    pool_( pool ? *pool : *own_pool_ ),
+    headers_( capacity ),
+    iovecs_( capacity ),
+    destinations_( capacity ),
+    payloads_(),
+    control_( capacity * SEND_CONTROL_SIZE ),
+    size_( 0 ),
+    merged_( capacity ),
+    merged_control_( capacity * GSO_CONTROL_SIZE )
+{
+  if ( capacity == 0 ) {
+    throw runtime_error( "SendBatch: capacity must be nonzero" );
+  }
+
+  payloads_.reserve( capacity );
+
+  for ( size_t i = 0; i < capacity; i++ ) {
+    zero( headers_[ i ] );
+    zero( iovecs_[ i ] );
+
+    payloads_.push_back( pool_.get() );
+
+    headers_[ i ].msg_hdr.msg_iov = &iovecs_[ i ];
+    headers_[ i ].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+/* add a datagram for the connected address, returning where to write its payload */
+char * UDPSocket::SendBatch::append( const size_t length )
+{
+  if ( full() ) {
+    throw runtime_error( "SendBatch: batch is full" );
+  } else if ( length > payloads_[ size_ ].capacity() ) {
+    throw runtime_error( "SendBatch: datagram payload too big for batch" );
+  }
+
+  msghdr & header = headers_[ size_ ].msg_hdr;
+  header.msg_name = nullptr;
+  header.msg_namelen = 0;
+  header.msg_control = nullptr;
+  header.msg_controllen = 0;
+  iovecs_[ size_ ].iov_base = payloads_[ size_ ].data();
+  iovecs_[ size_ ].iov_len = length;
+
+  return payloads_[ size_++ ].data();
+}
+
+/* add a datagram for the specified address, returning where to write its payload */
+char * UDPSocket::SendBatch::append( const Address & destination, const size_t length )
+{
+  const size_t i = size_;
+  char * const payload = append( length );
+
+  destinations_[ i ] = destination;
+
+  msghdr & header = headers_[ i ].msg_hdr;
+  header.msg_name = const_cast<sockaddr *>( &destinations_[ i ].to_sockaddr() );
+  header.msg_namelen = destinations_[ i ].size();
+
+  return payload;
+}
+
+/* add a datagram already in a buffer, swapping it for the batch's own slot */
+void UDPSocket::SendBatch::append( PacketPool::Buffer && payload )
+{
+  if ( payload.empty() ) {
+    throw runtime_error( "SendBatch: no payload buffer" );
+  } else if ( full() ) {
+    throw runtime_error( "SendBatch: batch is full" );
+  }
+
+  /* the displaced slot goes back to its pool along with the handle */
+  PacketPool::Buffer displaced = move( payloads_[ size_ ] );
+  payloads_[ size_ ] = move( payload );
+
+  append( payloads_[ size_ ].length() );
+}
+
+void UDPSocket::SendBatch::append( const Address & destination, PacketPool::Buffer && payload )
+{
+  const size_t i = size_;
+  append( move( payload ) );
+
+  destinations_[ i ] = destination;
+
+  msghdr & header = headers_[ i ].msg_hdr;
+  header.msg_name = const_cast<sockaddr *>( &destinations_[ i ].to_sockaddr() );
+  header.msg_namelen = destinations_[ i ].size();
+}
+
+/* have the kernel hold the last added datagram until a CLOCK_MONOTONIC time */
+void UDPSocket::SendBatch::set_departure_time( const uint64_t txtime_ns )
+{
+  if ( empty() ) {
+    throw runtime_error( "SendBatch: no datagram to schedule" );
+  }
+
+  msghdr & header = headers_[ size_ - 1 ].msg_hdr;
+  header.msg_control = &control_[ (size_ - 1) * SEND_CONTROL_SIZE ];
+  header.msg_controllen = CMSG_SPACE( sizeof( txtime_ns ) );
+
+  cmsghdr * const txtime_hdr = CMSG_FIRSTHDR( &header );
+  txtime_hdr->cmsg_level = SOL_SOCKET;
+  txtime_hdr->cmsg_type = SCM_TXTIME;
+  txtime_hdr->cmsg_len = CMSG_LEN( sizeof( txtime_ns ) );
+  memcpy( CMSG_DATA( txtime_hdr ), &txtime_ns, sizeof( txtime_ns ) );
+}
+
+/* do two datagrams go to the same place? */
+static bool same_destination( const msghdr & a, const msghdr & b )
+{
+  return a.msg_namelen == b.msg_namelen
+    and ( a.msg_namelen == 0 or 0 == memcmp( a.msg_name, b.msg_name, a.msg_namelen ) );
+}
+
+/* total length of a message's payload */
+static size_t payload_length( const msghdr & header )
+{
+  size_t length = 0;
+  for ( size_t i = 0; i < header.msg_iovlen; i++ ) {
+    length += header.msg_iov[ i ].iov_len;
+  }
+  return length;
+}
+
+size_t UDPSocket::SendBatch::merge( void )
+{
+  size_t count = 0;
+
+  for ( size_t i = 0, end; i < size_; i = end ) {
+    const msghdr & first = headers_[ i ].msg_hdr;
+    const size_t segment_size = iovecs_[ i ].iov_len;
+    size_t bytes = segment_size;
+
+    /* only the last datagram of a run may be shorter than the rest; and
+       a departure time would apply to the whole run, so those go alone */
+    end = i + 1;
+    if ( first.msg_controllen == 0 and segment_size > 0 ) {
+      while ( end < size_
+	      and end - i < MAX_GSO_SEGMENTS
+	      and iovecs_[ end - 1 ].iov_len == segment_size
+	      and iovecs_[ end ].iov_len > 0
+	      and iovecs_[ end ].iov_len <= segment_size
+	      and bytes + iovecs_[ end ].iov_len <= MAX_GSO_BYTES
+	      and headers_[ end ].msg_hdr.msg_controllen == 0
+	      and same_destination( first, headers_[ end ].msg_hdr ) ) {
+	bytes += iovecs_[ end ].iov_len;
+	end++;
+      }
+    }
+
+    /* the run's iovecs are consecutive, so one message can point at them all */
+    msghdr & merged = merged_[ count ].msg_hdr;
+    merged = first;
+    merged.msg_iovlen = end - i;
+
+    if ( end - i > 1 ) {
+      merged.msg_control = &merged_control_[ count * GSO_CONTROL_SIZE ];
+      merged.msg_controllen = CMSG_SPACE( sizeof( uint16_t ) );
+
+      const uint16_t gso_size = segment_size;
+      cmsghdr * const gso_hdr = CMSG_FIRSTHDR( &merged );
+      gso_hdr->cmsg_level = SOL_UDP;
+      gso_hdr->cmsg_type = UDP_SEGMENT;
+      gso_hdr->cmsg_len = CMSG_LEN( sizeof( gso_size ) );
+      memcpy( CMSG_DATA( gso_hdr ), &gso_size, sizeof( gso_size ) );
+    }
+
+    count++;
+  }
+
+  return count;
+}
+
+/* send every datagram of the batch with as few system calls as possible, then clear it */
+void UDPSocket::send_batch( SendBatch & batch )
+{
+  if ( batch.size_ == 0 ) {
+    return;
+  }
+
+  StageTimer timer( Stats::Send );
+  Stats::thread().count( Stats::DatagramsSent, batch.size_ );
+
+  mmsghdr * messages = &batch.headers_[ 0 ];
+  size_t count = batch.size_;
+
+  if ( gso_ ) {
+    messages = &batch.merged_[ 0 ];
+    count = batch.merge();
+  }
+
+  if ( send_ring_ ) {
+    send_with_io_uring( messages, count );
+    sent_messages( messages, count );
+    batch.clear();
+    return;
+  }
+
+  size_t sent = 0;
+
+  /* sendmmsg may stop early, so keep going until the whole batch is out */
+  while ( sent < count ) {
+    const int sent_now = SystemCall( "sendmmsg",
+				     sendmmsg( fd_num(), messages + sent, count - sent, 0 ) );
+
+    uint64_t bytes = 0;
+    for ( int i = 0; i < sent_now; i++ ) {
+      const mmsghdr & message = messages[ sent + i ];
+      if ( message.msg_len != payload_length( message.msg_hdr ) ) {
+	throw runtime_error( "datagram payload too big for sendmmsg()" );
+      }
+      bytes += message.msg_len;
+    }
+
+    register_write( bytes );
+
+    sent += sent_now;
+  }
+
+  sent_messages( messages, count );
+  batch.clear();
+}
+
+void UDPSocket::sent_messages( const mmsghdr * const messages, const size_t count )
+{
+  if ( tx_timestamps_ ) {
+    for ( size_t i = 0; i < count; i++ ) {
+      tx_timestamps_->messages.push_back( messages[ i ].msg_hdr.msg_iovlen );
+    }
+  }
+}
+
+void UDPSocket::set_io_uring_sends( void )
+{
+  send_ring_.reset( new IOUring( SEND_RING_ENTRIES ) );
+}
+
+/* one sendmsg request per message, linked so the kernel sends them in
+   order, all submitted and waited for together (in chains no longer than
+   the submission queue, which a chain can't outgrow and stay in order) */
+void UDPSocket::send_with_io_uring( mmsghdr * const messages, const size_t count )
+{
+  uint64_t bytes = 0;
+
+  for ( size_t first = 0; first < count; first += SEND_RING_ENTRIES ) {
+    const size_t last = min( count, first + SEND_RING_ENTRIES ) - 1;
+
+    for ( size_t i = first; i <= last; i++ ) {
+      io_uring_sqe & sqe = send_ring_->prepare();
+      sqe.opcode = IORING_OP_SENDMSG;
+      sqe.fd = fd_num();
+      sqe.addr = reinterpret_cast<uint64_t>( &messages[ i ].msg_hdr );
+      sqe.flags = i < last ? IOSQE_IO_LINK : 0;
+      sqe.user_data = i;
+    }
+
+    /* a failure cancels the rest of the chain, so wait for all of it,
+       then report the failure rather than the cancellations */
+    int error = 0;
+    size_t completed = first;
+    while ( completed <= last ) {
+      send_ring_->wait( last + 1 - completed );
+
+      io_uring_cqe cqe;
+      while ( send_ring_->next_completion( cqe ) ) {
+	completed++;
+
+	if ( cqe.res < 0 ) {
+	  if ( not error or error == ECANCELED ) {
+	    error = -cqe.res;
+	  }
+	  continue;
+	}
+
+	if ( size_t( cqe.res ) != payload_length( messages[ cqe.user_data ].msg_hdr ) ) {
+	  throw runtime_error( "datagram payload too big for sendmsg (io_uring)" );
+	}
+
+	bytes += cqe.res;
+      }
+    }
+
+    if ( error ) {
+      throw unix_error( "sendmsg (io_uring)", error );
+    }
+  }
+
+  register_write( bytes );
 }
 
 /* mark the socket as listening for incoming connections */
@@ -182,6 +853,21 @@ TCPSocket TCPSocket::accept( void )
   return TCPSocket( FileDescriptor( SystemCall( "accept", ::accept( fd_num(), nullptr, nullptr ) ) ) );
 }
 
+/* accept a connection if one is waiting */
+unique_ptr<TCPSocket> TCPSocket::try_accept( void )
+{
+  register_read();
+
+  /* (made non-blocking as it is accepted, saving a system call) */
+  const int fd = ::accept4( fd_num(), nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC );
+  if ( fd < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK or errno == ECONNABORTED ) ) {
+    return nullptr;
+  }
+
+  return unique_ptr<TCPSocket>( new TCPSocket( FileDescriptor( SystemCall( "accept4", fd ) ),
+					       Accepted() ) );
+}
+
 /* set socket option */
 template <typename option_type>
 void Socket::setsockopt( const int level, const int option, const option_type & option_value )
@@ -196,8 +882,97 @@ void Socket::set_reuseaddr( void )
   setsockopt( SOL_SOCKET, SO_REUSEADDR, int( true ) );
 }
 
+/* allow several sockets to share a local address, with the kernel spreading flows across them */
+void Socket::set_reuseport( void )
+{
+  setsockopt( SOL_SOCKET, SO_REUSEPORT, int( true ) );
+}
+
+/* send small writes at once */
+void TCPSocket::set_nodelay( void )
+{
+  setsockopt( IPPROTO_TCP, TCP_NODELAY, int( true ) );
+}
+
 /* turn on timestamps on receipt */
 void UDPSocket::set_timestamps( void )
 {
   setsockopt( SOL_SOCKET, SO_TIMESTAMPNS, int( true ) );
 }
+
+/* let outgoing datagrams carry a departure time (SO_TXTIME) */
+void UDPSocket::set_txtime( void )
+{
+  sock_txtime config;
+  zero( config );
+  config.clockid = CLOCK_MONOTONIC;
+  setsockopt( SOL_SOCKET, SO_TXTIME, config );
+}
+
+void UDPSocket::set_gso( void )
+{
+  /* make sure the kernel knows UDP_SEGMENT (a size of 0 sets no default) */
+  setsockopt( SOL_UDP, UDP_SEGMENT, int( 0 ) );
+  gso_ = true;
+}
+
+void UDPSocket::set_gro( void )
+{
+  setsockopt( SOL_UDP, UDP_GRO, int( true ) );
+}
+
+void UDPSocket::set_tx_timestamps( void )
+{
+  /* number each message (OPT_ID), and don't bother echoing its payload (OPT_TSONLY) */
+  const int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+    | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+  setsockopt( SOL_SOCKET, SO_TIMESTAMPING, flags );
+
+  tx_timestamps_.reset( new TxTimestamps );
+}
+
+bool UDPSocket::recv_tx_timestamps( const TxTimestampCallback & callback )
+{
+  if ( not tx_timestamps_ ) {
+    throw runtime_error( "recv_tx_timestamps: transmit timestamps are off" );
+  }
+
+  TxTimestamps & tx = *tx_timestamps_;
+
+  register_read();
+
+  while ( true ) {
+    for ( size_t i = 0; i < tx.headers.size(); i++ ) {
+      msghdr & header = tx.headers[ i ].msg_hdr;
+      zero( header );
+      header.msg_control = &tx.control[ i * TxTimestamps::CONTROL_SIZE ];
+      header.msg_controllen = TxTimestamps::CONTROL_SIZE;
+    }
+
+    const int count = recvmmsg( fd_num(), &tx.headers[ 0 ], tx.headers.size(),
+				MSG_ERRQUEUE | MSG_DONTWAIT, nullptr );
+
+    if ( count < 0 and ( errno == EAGAIN or errno == EWOULDBLOCK ) ) {
+      break;
+    }
+
+    SystemCall( "recvmmsg (error queue)", count );
+
+    for ( int i = 0; i < count; i++ ) {
+      tx.received( tx.headers[ i ].msg_hdr, callback );
+    }
+
+    if ( size_t( count ) < tx.headers.size() ) {
+      break;
+    }
+  }
+
+  /* with the error queue drained, any POLLERR left is for an error on
+     the socket itself, which reading clears (and which has to be read
+     every time, or the POLLERR it raises would never go away) */
+  int error = 0;
+  socklen_t error_length = sizeof( error );
+  SystemCall( "getsockopt", getsockopt( fd_num(), SOL_SOCKET, SO_ERROR, &error, &error_length ) );
+
+  return error == 0;
+}
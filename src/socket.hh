@@ -2,9 +2,15 @@
 #define SOCKET_HH
 
 #include <functional>
+#include <memory>
+#include <vector>
+
+#include <sys/socket.h>
 
 #include "address.hh"
 #include "file_descriptor.hh"
+#include "packet_pool.hh"
+#include "io_uring.hh"
 
 /* class for network sockets (UDP, TCP, etc.) */
 class Socket : public FileDescriptor
@@ -21,6 +27,10 @@ protected:
   /* construct from file descriptor */
   Socket( FileDescriptor && s_fd, const int domain, const int type );
 
+  /* construct from a file descriptor known to be of the right domain and
+     type (e.g. just accepted from a listening socket of the same class) */
+  explicit Socket( FileDescriptor && s_fd ) : FileDescriptor( std::move( s_fd ) ) {}
+
   /* set socket option */
   template <typename option_type>
   void setsockopt( const int level, const int option, const option_type & option_value );
@@ -29,7 +39,8 @@ public:
   /* bind socket to a specified local address (usually to listen/accept) */
   void bind( const Address & address );
 
-  /* connect socket to a specified peer address */
+  /* connect socket to a specified peer address (a non-blocking socket
+     returns at once, and becomes writable when connected or refused) */
   void connect( const Address & address );
 
   /* accessors */
@@ -38,22 +49,207 @@ public:
 
   /* allow local address to be reused sooner, at the cost of some robustness */
   void set_reuseaddr( void );
+
+  /* allow several sockets to bind the same address and port, with the
+     kernel spreading incoming flows (or connections) across them */
+  void set_reuseport( void );
 };
 
 /* UDP socket */
 class UDPSocket : public Socket
 {
+private:
+  /* if set, send_batch() goes through io_uring */
+  std::unique_ptr<IOUring> send_ring_;
+
+  /* have send_batch() hand runs of equal-size datagrams to the kernel as one */
+  bool gso_;
+
+  /* what was sent, to match transmit timestamps to (if turned on) */
+  struct TxTimestamps;
+  std::unique_ptr<TxTimestamps> tx_timestamps_;
+
+  /* note how many datagrams went out in each of a run of messages */
+  void sent_messages( const mmsghdr * const messages, const size_t count );
+
 public:
-  UDPSocket() : Socket( AF_INET6, SOCK_DGRAM ) {}
+  UDPSocket();
+  ~UDPSocket();
 
   struct received_datagram {
     Address source_address;
-    uint64_t timestamp;
-    std::string payload;
+    uint64_t timestamp; /* kernel receive time, in microseconds (see timestamp_us) */
+    PacketPool::Buffer payload;
+  };
+
+  /* caller-owned storage for a batch of received datagrams */
+  class RecvBatch
+  {
+  private:
+    std::unique_ptr<PacketPool> own_pool_; /* unless sharing someone else's */
+    PacketPool & pool_;
+
+    std::vector<mmsghdr> headers_;
+    std::vector<iovec> iovecs_;
+    std::vector<Address::raw> source_addresses_;
+    std::vector<PacketPool::Buffer> payloads_;
+    std::vector<size_t> payload_offsets_; /* where in its slot each payload starts */
+    std::vector<char> control_;
+    std::vector<uint64_t> timestamps_;
+    std::vector<size_t> segment_sizes_; /* with GRO, how the kernel coalesced each */
+
+    size_t size_; /* datagrams as received (a coalesced one counts once) */
+
+    /* the datagrams as sent: a part of one of the received ones */
+    struct Segment
+    {
+      uint32_t entry, offset, length;
+    };
+
+    std::vector<Segment> segments_;
+    uint32_t scanned_; /* received ones split() has been through */
+
+    uint64_t oversized_;
+
+    /* find the datagrams within each of the received ones (leaving out
+       any too big for their slots) */
+    void split( void );
+
+    RecvBatch( const size_t capacity, std::unique_ptr<PacketPool> own_pool, PacketPool * const pool );
+
+    /* reset the lengths that the kernel overwrote on the last receive */
+    void prepare( void );
+
+    friend class UDPSocket;
+
+  public:
+    /* with payload slots of its own */
+    RecvBatch( const size_t capacity, const size_t mtu = 65536 );
+
+    /* with payload slots taken from a pool (whose slot size is the largest
+       datagram that fits), so a payload can be kept with take() */
+    RecvBatch( const size_t capacity, PacketPool & pool );
+
+    size_t capacity( void ) const { return headers_.size(); }
+    bool full( void ) const { return size_ == headers_.size(); }
+
+    /* how many datagrams there are, with any that the kernel coalesced
+       (see set_gro()) split back into the datagrams that were sent */
+    size_t size( void ) const { return segments_.size(); }
+
+    PacketPool & pool( void ) { return pool_; }
+
+    /* datagrams dropped so far for being too big for a slot (the
+       kernel cut them short) */
+    uint64_t oversized( void ) const { return oversized_; }
+
+    /* accessors for the ith datagram of the last receive (datagrams that
+       were coalesced share the kernel's timestamp for their arrival) */
+    Address source_address( const size_t i ) const;
+    Address::Key source_key( const size_t i ) const
+    {
+      return Address::Key( source_addresses_[ segments_.at( i ).entry ].as_sockaddr );
+    }
+    uint64_t timestamp( const size_t i ) const { return timestamps_[ segments_.at( i ).entry ]; } /* microseconds */
+    const char * payload( const size_t i ) const
+    {
+      const Segment & segment = segments_.at( i );
+      return payloads_[ segment.entry ].data() + payload_offsets_[ segment.entry ] + segment.offset;
+    }
+    size_t payload_length( const size_t i ) const { return segments_.at( i ).length; }
+
+    /* keep the ith payload, leaving a fresh slot in its place (without
+       copying, unless it was coalesced with others) */
+    PacketPool::Buffer take( const size_t i );
+
+    /* Receiving through io_uring instead: a multishot recvmsg, made with
+       this layout, writes each datagram into a buffer from a ring as an
+       io_uring_recvmsg_out, the name and control areas the layout
+       reserves, and then the payload. */
+    msghdr multishot_layout( void ) const;
+
+    /* start a new batch (recv_batch() does this itself) */
+    void clear( void ) { prepare(); }
+
+    /* add a datagram that took up length bytes of a buffer, keeping the
+       buffer and handing back a free slot of our own in exchange */
+    PacketPool::Buffer add_multishot( PacketPool::Buffer && buffer, const size_t length );
+
+    /* forbid copying, since the headers point into our own storage */
+    RecvBatch( const RecvBatch & other ) = delete;
+    const RecvBatch & operator=( const RecvBatch & other ) = delete;
   };
 
-  /* receive datagram, timestamp, and where it came from */
-  received_datagram recv( void );
+  /* caller-owned storage for a batch of outgoing datagrams */
+  class SendBatch
+  {
+  private:
+    std::unique_ptr<PacketPool> own_pool_; /* unless sharing someone else's */
+    PacketPool & pool_;
+
+    std::vector<mmsghdr> headers_;
+    std::vector<iovec> iovecs_;
+    std::vector<Address> destinations_;
+    std::vector<PacketPool::Buffer> payloads_;
+    std::vector<char> control_;
+
+    size_t size_;
+
+    /* for GSO: the datagrams as handed to the kernel, each run of
+       equal-size ones merged into one message that points at all of their
+       payloads, with a control message giving the size to split it into */
+    std::vector<mmsghdr> merged_;
+    std::vector<char> merged_control_;
+
+    /* merge the datagrams into runs, returning how many messages that made */
+    size_t merge( void );
+
+    SendBatch( const size_t capacity, std::unique_ptr<PacketPool> own_pool, PacketPool * const pool );
+
+    friend class UDPSocket;
+
+  public:
+    /* with payload slots of its own */
+    SendBatch( const size_t capacity, const size_t mtu = 65536 );
+
+    /* with payload slots taken from a pool */
+    SendBatch( const size_t capacity, PacketPool & pool );
+
+    size_t capacity( void ) const { return headers_.size(); }
+    size_t size( void ) const { return size_; }
+    bool empty( void ) const { return size_ == 0; }
+    bool full( void ) const { return size_ == headers_.size(); }
+
+    /* add a datagram for the connected address, returning where to write its payload */
+    char * append( const size_t length );
+
+    /* add a datagram for the specified address, returning where to write its payload */
+    char * append( const Address & destination, const size_t length );
+
+    /* add a datagram whose payload (of payload.length() bytes) is already
+       in a buffer, which the batch keeps in place of one of its own slots */
+    void append( PacketPool::Buffer && payload );
+    void append( const Address & destination, PacketPool::Buffer && payload );
+
+    /* have the kernel hold the last added datagram until a CLOCK_MONOTONIC time,
+       in nanoseconds (needs set_txtime() on the socket, and the fq qdisc to take effect) */
+    void set_departure_time( const uint64_t txtime_ns );
+
+    /* forget the queued datagrams */
+    void clear( void ) { size_ = 0; }
+
+    /* forbid copying, since the headers point into our own storage */
+    SendBatch( const SendBatch & other ) = delete;
+    const SendBatch & operator=( const SendBatch & other ) = delete;
+  };
+
+  /* receive datagram, timestamp, and where it came from, into a slot
+     from the pool (which must be big enough for the datagram) */
+  received_datagram recv( PacketPool & pool );
+
+  /* receive as many datagrams as are ready (up to the batch capacity),
+     blocking only until the first one arrives */
+  size_t recv_batch( RecvBatch & batch );
 
   /* send datagram to specified address */
   void sendto( const Address & peer, const std::string & payload );
@@ -61,8 +257,46 @@ public:
   /* send datagram to connected address */
   void send( const std::string & payload );
 
+  /* send every datagram of the batch with as few system calls as possible, then clear it */
+  void send_batch( SendBatch & batch );
+
+private:
+  void send_with_io_uring( mmsghdr * const messages, const size_t count );
+
+public:
+  /* from now on, have send_batch() submit one request per datagram to an
+     io_uring of the socket's own, and wait for them all, in one system call */
+  void set_io_uring_sends( void );
+
   /* turn on timestamps on receipt */
   void set_timestamps( void );
+
+  /* Segmentation offload: with GSO, send_batch() hands each run of
+     datagrams of the same size (for the same address, up to 64 KiB) to
+     the kernel as one, to be split up as late as possible. With GRO, the
+     kernel may coalesce datagrams of a flow as they arrive, for
+     recv_batch() to split up again (the batch's slots need to be big
+     enough for 64 KiB). Both work on loopback. */
+  void set_gso( void );
+  void set_gro( void );
+
+  /* let outgoing datagrams carry a departure time (SO_TXTIME) */
+  void set_txtime( void );
+
+  /* Turn on the kernel's (software) timestamps of when each datagram
+     actually leaves, as opposed to when it was handed over, for
+     recv_tx_timestamps() to read back from the socket's error queue
+     (which polls as POLLERR). Datagrams are numbered from 0, in the
+     order they are sent from then on. */
+  void set_tx_timestamps( void );
+
+  /* hand each transmit timestamp the kernel has ready to the callback,
+     with the number of the datagram it is for (datagrams sent as one
+     with GSO share a timestamp), in microseconds (see timestamp_us);
+     returns false if the socket has had an error (e.g. ICMP port unreachable) */
+  typedef std::function<void( const uint64_t datagram,
+			      const uint64_t timestamp )> TxTimestampCallback;
+  bool recv_tx_timestamps( const TxTimestampCallback & callback );
 };
 
 /* TCP socket */
@@ -72,6 +306,10 @@ private:
   /* private constructor used by accept() */
   TCPSocket( FileDescriptor && fd ) : Socket( std::move( fd ), AF_INET6, SOCK_STREAM ) {}
 
+  /* used by try_accept(), which needs no check */
+  struct Accepted {};
+  TCPSocket( FileDescriptor && fd, Accepted ) : Socket( std::move( fd ) ) {}
+
 public:
   TCPSocket() : Socket( AF_INET6, SOCK_STREAM ) {}
 
@@ -80,6 +318,14 @@ public:
 
   /* accept a new incoming connection */
   TCPSocket accept( void );
+
+  /* on a non-blocking listening socket, accept a connection if one is
+     waiting (itself non-blocking), or return nullptr if none is */
+  std::unique_ptr<TCPSocket> try_accept( void );
+
+  /* send small writes at once, rather than holding them back to coalesce
+     while earlier data is unacknowledged (Nagle's algorithm) */
+  void set_nodelay( void );
 };
 
 #endif /* SOCKET_HH */
@@ -0,0 +1,228 @@
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <signal.h>
+
+#include "stats.hh"
+#include "util.hh"
+
+using namespace std;
+
+const uint64_t LatencyHistogram::MAX_NS;
+
+LatencyHistogram::LatencyHistogram()
+  : counts_(),
+    count_( 0 ),
+    total_ns_( 0 ),
+    max_ns_( 0 )
+{
+  for ( auto & count : counts_ ) {
+    count.store( 0, memory_order_relaxed );
+  }
+}
+
+uint64_t LatencyHistogram::bucket_top( const size_t index )
+{
+  if ( index < 2 * SUB_BUCKETS ) {
+    return index;
+  }
+
+  /* (the inverse of bucket()) */
+  const unsigned int exponent = ( index >> SUB_BUCKET_BITS ) - 1;
+  const uint64_t bits = index - ( uint64_t( exponent ) << SUB_BUCKET_BITS );
+  return ( ( bits + 1 ) << exponent ) - 1;
+}
+
+double LatencyHistogram::mean_ns( void ) const
+{
+  const uint64_t n = count();
+  return n ? double( total_ns_.load( memory_order_relaxed ) ) / n : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile_ns( const double fraction ) const
+{
+  const uint64_t n = count();
+  if ( n == 0 ) {
+    return 0;
+  }
+
+  const uint64_t rank = max( uint64_t( 1 ), uint64_t( fraction * n + 0.5 ) );
+
+  uint64_t seen = 0;
+  for ( size_t i = 0; i < BUCKETS; i++ ) {
+    seen += counts_[ i ].load( memory_order_relaxed );
+    if ( seen >= rank ) {
+      return min( bucket_top( i ), max_ns() );
+    }
+  }
+
+  return max_ns();
+}
+
+void LatencyHistogram::merge( const LatencyHistogram & other )
+{
+  for ( size_t i = 0; i < BUCKETS; i++ ) {
+    add( counts_[ i ], other.counts_[ i ].load( memory_order_relaxed ) );
+  }
+
+  add( count_, other.count() );
+  add( total_ns_, other.total_ns_.load( memory_order_relaxed ) );
+  if ( other.max_ns() > max_ns() ) {
+    max_ns_.store( other.max_ns(), memory_order_relaxed );
+  }
+}
+
+/* every thread's Stats (never freed, so they can still be dumped
+   at exit, whatever order static objects are destroyed in) */
+struct Registry
+{
+  mutex lock;
+  vector<unique_ptr<Stats>> threads;
+
+  Registry() : lock(), threads() {}
+};
+
+static Registry & registry( void )
+{
+  static Registry * const ret = new Registry;
+  return *ret;
+}
+
+thread_local Stats * Stats::thread_stats_ = nullptr;
+
+Stats::Stats( const unsigned int thread_number )
+  : thread_number_( thread_number ),
+    counters_(),
+    stages_()
+{
+  for ( auto & counter : counters_ ) {
+    counter.store( 0, memory_order_relaxed );
+  }
+}
+
+Stats & Stats::register_thread( void )
+{
+  Registry & all = registry();
+  unique_lock<mutex> lock( all.lock );
+
+  all.threads.emplace_back( new Stats( all.threads.size() + 1 ) );
+  thread_stats_ = all.threads.back().get();
+
+  return *thread_stats_;
+}
+
+const char * Stats::counter_name( const Counter counter )
+{
+  switch ( counter ) {
+  case Syscalls: return "syscalls";
+  case BytesRead: return "bytes read";
+  case BytesWritten: return "bytes written";
+  case DatagramsReceived: return "datagrams received";
+  case DatagramsSent: return "datagrams sent";
+  case Wakeups: return "wakeups";
+  case Callbacks: return "callbacks";
+  case COUNTERS: break;
+  }
+
+  return "unknown";
+}
+
+const char * Stats::stage_name( const Stage stage )
+{
+  switch ( stage ) {
+  case PollWait: return "poll-wait";
+  case Interest: return "interest";
+  case Callback: return "callback";
+  case Timer: return "timer";
+  case Receive: return "receive";
+  case Send: return "send";
+  case Parse: return "parse";
+  case STAGES: break;
+  }
+
+  return "unknown";
+}
+
+void Stats::dump( ostream & out )
+{
+  Registry & all = registry();
+  unique_lock<mutex> lock( all.lock );
+
+  const auto flags = out.flags();
+  const auto precision = out.precision();
+
+  for ( const auto & stats : all.threads ) {
+    out << "Thread " << stats->thread_number_ << ":";
+    for ( unsigned int i = 0; i < COUNTERS; i++ ) {
+      out << ( i ? ", " : " " ) << stats->counter( Counter( i ) )
+	  << " " << counter_name( Counter( i ) );
+    }
+    out << "\n";
+
+    bool header = false;
+    for ( unsigned int i = 0; i < STAGES; i++ ) {
+      const LatencyHistogram & stage = stats->stage( Stage( i ) );
+      if ( stage.count() == 0 ) {
+	continue;
+      }
+
+      if ( not header ) {
+	out << "  stage (us)      count      mean       p50       p99     p99.9       max" << "\n";
+	header = true;
+      }
+
+      out << "  " << left << setw( 10 ) << stage_name( Stage( i ) ) << right
+	  << setw( 11 ) << stage.count()
+	  << fixed << setprecision( 1 )
+	  << setw( 10 ) << stage.mean_ns() / 1000
+	  << setw( 10 ) << stage.percentile_ns( 0.5 ) / 1000.0
+	  << setw( 10 ) << stage.percentile_ns( 0.99 ) / 1000.0
+	  << setw( 10 ) << stage.percentile_ns( 0.999 ) / 1000.0
+	  << setw( 10 ) << stage.max_ns() / 1000.0 << "\n";
+    }
+  }
+
+  out.flags( flags );
+  out.precision( precision );
+  out << flush;
+}
+
+static void dump_to_stderr( void )
+{
+  Stats::dump( cerr );
+}
+
+void Stats::dump_on_signal( void )
+{
+  /* SIGUSR1 is taken only by sigwait() in the thread below, so that the
+     dump happens at a safe point rather than inside a signal handler */
+  sigset_t usr1;
+  SystemCall( "sigemptyset", sigemptyset( &usr1 ) );
+  SystemCall( "sigaddset", sigaddset( &usr1, SIGUSR1 ) );
+  const int error = pthread_sigmask( SIG_BLOCK, &usr1, nullptr );
+  if ( error ) {
+    throw unix_error( "pthread_sigmask", error );
+  }
+
+  std::thread( [usr1] () {
+      /* and no other signal should come here */
+      sigset_t all;
+      sigfillset( &all );
+      pthread_sigmask( SIG_BLOCK, &all, nullptr );
+
+      while ( true ) {
+	int signal_number;
+	if ( sigwait( &usr1, &signal_number ) == 0 ) {
+	  dump_to_stderr();
+	}
+      }
+    } ).detach();
+
+  atexit( dump_to_stderr );
+}
@@ -0,0 +1,193 @@
+#ifndef STATS_HH
+#define STATS_HH
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <ostream>
+
+/* Counts of latencies in nanoseconds, in the manner of an HDR histogram:
+   exact below 64 ns, and above that in 32 buckets per power of two, so
+   any percentile is within about 3% whatever the range of values, in a
+   fixed 9 KB. Recording is a few shifts and an increment.
+
+   One thread records, and any thread may read (getting a recent, if not
+   quite consistent, picture). */
+class LatencyHistogram
+{
+private:
+  static const unsigned int MAX_BITS = 40;
+  static const unsigned int SUB_BUCKET_BITS = 5;
+  static const uint64_t SUB_BUCKETS = uint64_t( 1 ) << SUB_BUCKET_BITS;
+
+  /* the exact ones, then SUB_BUCKETS for each power of two beyond */
+  static const size_t BUCKETS = 2 * SUB_BUCKETS + ( MAX_BITS - SUB_BUCKET_BITS - 1 ) * SUB_BUCKETS;
+
+public:
+  /* latencies beyond this (about 18 minutes) are counted as this */
+  static const uint64_t MAX_NS = ( uint64_t( 1 ) << MAX_BITS ) - 1;
+
+private:
+  std::atomic<uint64_t> counts_[ BUCKETS ];
+  std::atomic<uint64_t> count_, total_ns_, max_ns_;
+
+  /* which bucket counts a latency: past the exact ones, the power of two
+     (as exponent, the shift that leaves SUB_BUCKET_BITS + 1 bits) picks
+     a run of buckets, and the remaining bits pick one of them */
+  static size_t bucket( const uint64_t ns )
+  {
+    const uint64_t value = ns < MAX_NS ? ns : MAX_NS;
+    if ( value < 2 * SUB_BUCKETS ) {
+      return value;
+    }
+
+    const unsigned int exponent = 63 - __builtin_clzll( value ) - SUB_BUCKET_BITS;
+    return ( exponent << SUB_BUCKET_BITS ) + ( value >> exponent );
+  }
+
+  /* the largest latency a bucket counts */
+  static uint64_t bucket_top( const size_t index );
+
+  /* (only ever incremented by the one recording thread) */
+  static void add( std::atomic<uint64_t> & counter, const uint64_t amount )
+  {
+    counter.store( counter.load( std::memory_order_relaxed ) + amount,
+		   std::memory_order_relaxed );
+  }
+
+public:
+  LatencyHistogram();
+
+  void record( const uint64_t ns )
+  {
+    add( counts_[ bucket( ns ) ], 1 );
+    add( count_, 1 );
+    add( total_ns_, ns );
+    if ( ns > max_ns_.load( std::memory_order_relaxed ) ) {
+      max_ns_.store( ns, std::memory_order_relaxed );
+    }
+  }
+
+  uint64_t count( void ) const { return count_.load( std::memory_order_relaxed ); }
+  uint64_t max_ns( void ) const { return max_ns_.load( std::memory_order_relaxed ); }
+  double mean_ns( void ) const;
+
+  /* smallest latency at or below which the given fraction fall (to within
+     the bucket's width, and never more than the largest recorded) */
+  uint64_t percentile_ns( const double fraction ) const;
+
+  /* count another's latencies too (by this one's recording thread,
+     once the other's has finished) */
+  void merge( const LatencyHistogram & other );
+
+  /* forbid copying, since the counts are live */
+  LatencyHistogram( const LatencyHistogram & other ) = delete;
+  const LatencyHistogram & operator=( const LatencyHistogram & other ) = delete;
+};
+
+/* Each thread's counters, and histograms of how long each stage of the
+   event loop takes, kept all the time (the Poller and the sockets fill
+   them in). A thread's are made the first time it uses them, and kept
+   until the program exits, even after the thread is gone.
+
+   Stats::dump() prints every thread's; dump_on_signal() arranges for
+   that to happen on SIGUSR1 and at exit. */
+class Stats
+{
+public:
+  enum Counter {
+    Syscalls,          /* on sockets and files, and waits for events */
+    BytesRead, BytesWritten,
+    DatagramsReceived, DatagramsSent,
+    Wakeups,           /* returns from the wait for events */
+    Callbacks,         /* actions and timers run */
+    COUNTERS
+  };
+
+  enum Stage {
+    PollWait,   /* in the kernel, waiting for events */
+    Interest,   /* asking each action whether it wants its fd (when_interested) */
+    Callback,   /* an action's callback */
+    Timer,      /* a timer's callback */
+    Receive,    /* a system call receiving a batch of datagrams */
+    Send,       /* handing a batch of datagrams to the kernel */
+    Parse,      /* parsing one message (e.g. a ContestMessage) */
+    STAGES
+  };
+
+private:
+  unsigned int thread_number_; /* in order of first use */
+
+  std::atomic<uint64_t> counters_[ COUNTERS ];
+  LatencyHistogram stages_[ STAGES ];
+
+  Stats( const unsigned int thread_number );
+
+  static Stats & register_thread( void );
+
+  /* this thread's (or nullptr before its first use) */
+  static thread_local Stats * thread_stats_;
+
+public:
+  /* the calling thread's */
+  static Stats & thread( void ) { return thread_stats_ ? *thread_stats_ : register_thread(); }
+
+  /* monotonic clock, in nanoseconds, for timing stages */
+  static uint64_t now_ns( void )
+  {
+    timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return uint64_t( now.tv_sec ) * 1000000000 + now.tv_nsec;
+  }
+
+  void count( const Counter counter, const uint64_t amount = 1 )
+  {
+    counters_[ counter ].store( counters_[ counter ].load( std::memory_order_relaxed ) + amount,
+				std::memory_order_relaxed );
+  }
+
+  void record( const Stage stage, const uint64_t ns ) { stages_[ stage ].record( ns ); }
+
+  uint64_t counter( const Counter counter ) const
+  {
+    return counters_[ counter ].load( std::memory_order_relaxed );
+  }
+
+  const LatencyHistogram & stage( const Stage stage ) const { return stages_[ stage ]; }
+
+  static const char * counter_name( const Counter counter );
+  static const char * stage_name( const Stage stage );
+
+  /* print every thread's counters and stage latencies */
+  static void dump( std::ostream & out );
+
+  /* dump to standard error on SIGUSR1 and at exit (call before starting
+     any threads, which must leave SIGUSR1 blocked) */
+  static void dump_on_signal( void );
+
+  /* forbid copying, since each belongs to a thread */
+  Stats( const Stats & other ) = delete;
+  const Stats & operator=( const Stats & other ) = delete;
+};
+
+/* Records the time from its construction to its destruction as one
+   instance of a stage, in the calling thread's Stats */
+class StageTimer
+{
+private:
+  Stats & stats_;
+  Stats::Stage stage_;
+  uint64_t start_ns_;
+
+public:
+  StageTimer( const Stats::Stage stage )
+    : stats_( Stats::thread() ), stage_( stage ), start_ns_( Stats::now_ns() ) {}
+
+  ~StageTimer() { stats_.record( stage_, Stats::now_ns() - start_ns_ ); }
+
+  /* forbid copying, so each times one thing */
+  StageTimer( const StageTimer & other ) = delete;
+  const StageTimer & operator=( const StageTimer & other ) = delete;
+};
+
+#endif /* STATS_HH */
@@ -0,0 +1,150 @@
+#include <utility>
+
+#include "task_pool.hh"
+
+using namespace std;
+
+/* the pool (if any) whose worker this thread is, and which worker */
+static thread_local const TaskPool * current_pool = nullptr;
+static thread_local size_t current_index = 0;
+
+TaskPool::TaskPool( const size_t threads )
+  : queues_(),
+    threads_(),
+    queued_( 0 ),
+    unfinished_( 0 ),
+    next_queue_( 0 ),
+    sleeping_( 0 ),
+    mutex_(),
+    work_available_(),
+    all_done_(),
+    stopping_( false ),
+    error_()
+{
+  /* hardware_concurrency() is 0 if it can't tell */
+  const size_t count = threads ? threads : max( thread::hardware_concurrency(), 1u );
+
+  for ( size_t i = 0; i < count; i++ ) {
+    queues_.emplace_back( new Queue );
+  }
+
+  for ( size_t i = 0; i < count; i++ ) {
+    threads_.emplace_back( [this, i] () { work( i ); } );
+  }
+}
+
+TaskPool::~TaskPool()
+{
+  {
+    unique_lock<mutex> lock( mutex_ );
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+
+  for ( auto & thread : threads_ ) {
+    thread.join();
+  }
+}
+
+void TaskPool::submit( Task && task )
+{
+  const size_t index = current_pool == this ? current_index
+    : next_queue_++ % queues_.size();
+
+  /* count it first, so it can't be taken (and finished) before it is counted */
+  unfinished_++;
+  queued_++;
+
+  {
+    unique_lock<mutex> lock( queues_[ index ]->mutex );
+    queues_[ index ]->tasks.push_back( move( task ) );
+  }
+
+  /* A worker going to sleep counts itself in sleeping_ before it looks
+     at queued_, and we counted the task in queued_ before looking at
+     sleeping_, so either it sees the task or we see it. Taking the mutex
+     means it is either still to look or already waiting to be woken. */
+  if ( sleeping_ ) {
+    { unique_lock<mutex> lock( mutex_ ); }
+    work_available_.notify_one();
+  }
+}
+
+void TaskPool::wait( void )
+{
+  unique_lock<mutex> lock( mutex_ );
+  all_done_.wait( lock, [&] () { return unfinished_ == 0; } );
+
+  if ( error_ ) {
+    exception_ptr error;
+    swap( error, error_ );
+    rethrow_exception( error );
+  }
+}
+
+bool TaskPool::take( const size_t index, Task & task )
+{
+  /* the newest of our own, which is likeliest to find the cache warm */
+  {
+    Queue & own = *queues_[ index ];
+    unique_lock<mutex> lock( own.mutex );
+    if ( not own.tasks.empty() ) {
+      task = move( own.tasks.back() );
+      own.tasks.pop_back();
+      return true;
+    }
+  }
+
+  /* or the oldest of someone else's */
+  for ( size_t i = 1; i < queues_.size(); i++ ) {
+    Queue & victim = *queues_[ ( index + i ) % queues_.size() ];
+    unique_lock<mutex> lock( victim.mutex );
+    if ( not victim.tasks.empty() ) {
+      task = move( victim.tasks.front() );
+      victim.tasks.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void TaskPool::work( const size_t index )
+{
+  current_pool = this;
+  current_index = index;
+
+  while ( true ) {
+    /* sleep until there is something to take (which another worker may
+       get to first, or which may still be on its way into a queue, in
+       which case look again) */
+    Task task;
+    if ( not take( index, task ) ) {
+      unique_lock<mutex> lock( mutex_ );
+      sleeping_++;
+      work_available_.wait( lock, [&] () { return queued_ > 0 or stopping_; } );
+      sleeping_--;
+      if ( queued_ == 0 ) {
+	return; /* stopping, with nothing left to do */
+      }
+      continue;
+    }
+
+    queued_--;
+
+    try {
+      task();
+    } catch ( ... ) {
+      unique_lock<mutex> lock( mutex_ );
+      if ( not error_ ) {
+	error_ = current_exception();
+      }
+    }
+
+    /* (taking the mutex so wait() can't miss the news; see submit()) */
+    if ( --unfinished_ == 0 ) {
+      { unique_lock<mutex> lock( mutex_ ); }
+      all_done_.notify_all();
+    }
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef TASK_POOL_HH
+#define TASK_POOL_HH
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A fixed set of worker threads that run tasks handed to them. Each
+   worker has a queue of its own: tasks submitted from outside are dealt
+   out to the queues in turn, and tasks submitted by a task go on the
+   back of its worker's queue. A worker runs its own tasks newest first,
+   and when it has none left it steals the oldest from another worker's
+   queue, so the load evens out however long the tasks take.
+
+   Taking and finishing a task only lock the queues involved; the
+   counts are atomic, and the pool-wide mutex is only for workers
+   going to sleep (and being woken) and for wait().
+
+   submit() and wait() may be called from any thread (wait() from
+   outside the pool only). Destroying the pool finishes every task
+   already submitted. */
+class TaskPool
+{
+public:
+  typedef std::function<void( void )> Task;
+
+private:
+  struct Queue
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+
+    Queue() : mutex(), tasks() {}
+  };
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+
+  std::atomic<size_t> queued_;     /* submitted, and not yet taken by a worker */
+  std::atomic<size_t> unfinished_; /* submitted, and not yet finished */
+  std::atomic<size_t> next_queue_; /* where the next task from outside goes */
+  std::atomic<size_t> sleeping_;   /* workers asleep (or about to be) */
+
+  /* where idle workers sleep and wait() waits; guards what is below */
+  std::mutex mutex_;
+  std::condition_variable work_available_, all_done_;
+
+  bool stopping_;
+
+  /* the first exception a task threw, for wait() to pass on */
+  std::exception_ptr error_;
+
+  /* a worker's loop */
+  void work( const size_t index );
+
+  /* take a task from the worker's own queue, or steal one from another */
+  bool take( const size_t index, Task & task );
+
+public:
+  /* threads = 0 for one per processor */
+  TaskPool( const size_t threads = 0 );
+  ~TaskPool();
+
+  size_t size( void ) const { return threads_.size(); }
+
+  void submit( Task && task );
+
+  /* wait until every task submitted has finished, then rethrow the
+     first exception any of them threw (the others still ran) */
+  void wait( void );
+
+  /* forbid copying, since the workers refer to this one */
+  TaskPool( const TaskPool & other ) = delete;
+  const TaskPool & operator=( const TaskPool & other ) = delete;
+};
+
+#endif /* TASK_POOL_HH */
@@ -1,36 +1,96 @@
 #include <ctime>
+#include <stdexcept>
 
 #include "timestamp.hh"
 #include "util.hh"
 
+/* nanoseconds per microsecond */
+static const uint64_t THOUSAND = 1000;
+
 /* nanoseconds per millisecond */
-static const uint64_t MILLION = 1000000;
+static const uint64_t MILLION = 1000 * THOUSAND;
 
 /* nanoseconds per second */
 static const uint64_t BILLION = 1000 * MILLION;
 
 /* helper functions */
-static timespec current_time( void )
+static timespec current_time( const clockid_t clock )
 {
   timespec ret;
-  SystemCall( "clock_gettime", clock_gettime( CLOCK_REALTIME, &ret ) );
+  SystemCall( "clock_gettime", clock_gettime( clock, &ret ) );
   return ret;
 }
 
-static uint64_t timestamp_ms_raw( const timespec & ts )
+static uint64_t nanos( const timespec & ts )
+{
+  return ts.tv_sec * BILLION + ts.tv_nsec;
+}
+
+/* start of the program (taken at startup, so that kernel timestamps
+   of datagrams received before the first call are still in range) */
+static const uint64_t EPOCH = nanos( current_time( CLOCK_MONOTONIC ) );
+
+/* the innermost virtual clock on this thread, if any */
+static thread_local VirtualClock * virtual_clock = nullptr;
+
+/* Monotonic clock in nanoseconds since the start of the program */
+static uint64_t timestamp_ns( const uint64_t monotonic_nanos )
+{
+  return monotonic_nanos - EPOCH;
+}
+
+/* Current time in microseconds since the start of the program */
+uint64_t timestamp_us( void )
 {
-  const uint64_t nanos = ts.tv_sec * BILLION + ts.tv_nsec;
-  return nanos / MILLION;
+  if ( virtual_clock ) {
+    return virtual_clock->now();
+  }
+
+  return timestamp_ns( nanos( current_time( CLOCK_MONOTONIC ) ) ) / THOUSAND;
+}
+
+uint64_t timestamp_us( const timespec & ts )
+{
+  /* translate from the wall clock to the monotonic clock using their current offset */
+  const uint64_t monotonic_now = nanos( current_time( CLOCK_MONOTONIC ) );
+  const uint64_t realtime_now = nanos( current_time( CLOCK_REALTIME ) );
+
+  return timestamp_ns( nanos( ts ) - (realtime_now - monotonic_now) ) / THOUSAND;
+}
+
+uint64_t monotonic_ns( const uint64_t timestamp_us )
+{
+  return timestamp_us * THOUSAND + EPOCH;
 }
 
 /* Current time in milliseconds since the start of the program */
 uint64_t timestamp_ms( void )
 {
-  return timestamp_ms( current_time() );
+  return timestamp_us() / THOUSAND;
 }
 
 uint64_t timestamp_ms( const timespec & ts )
 {
-  const static uint64_t EPOCH = timestamp_ms_raw( current_time() );
-  return timestamp_ms_raw( ts ) - EPOCH;
+  return timestamp_us( ts ) / THOUSAND;
+}
+
+VirtualClock::VirtualClock( const uint64_t start_us )
+  : now_us_( start_us ),
+    outer_( virtual_clock )
+{
+  virtual_clock = this;
+}
+
+VirtualClock::~VirtualClock()
+{
+  virtual_clock = outer_;
+}
+
+void VirtualClock::set( const uint64_t now_us )
+{
+  if ( now_us < now_us_ ) {
+    throw std::runtime_error( "VirtualClock: time can't go backwards" );
+  }
+
+  now_us_ = now_us;
 }
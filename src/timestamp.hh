@@ -4,8 +4,44 @@
 #include <ctime>
 #include <cstdint>
 
+/* Current time in microseconds since the start of the program,
+   from the monotonic clock (never jumps when the wall clock is adjusted) */
+uint64_t timestamp_us( void );
+
+/* Kernel timestamp (e.g. from SO_TIMESTAMPNS, which uses the wall clock)
+   in microseconds, in the same timebase as timestamp_us() */
+uint64_t timestamp_us( const timespec & ts );
+
+/* Absolute CLOCK_MONOTONIC time, in nanoseconds, of a timestamp_us() value
+   (e.g. for a departure time given to the kernel) */
+uint64_t monotonic_ns( const uint64_t timestamp_us );
+
 /* Current time in milliseconds since the start of the program */
 uint64_t timestamp_ms( void );
 uint64_t timestamp_ms( const timespec & ts );
 
+/* While one of these exists, timestamp_us() and timestamp_ms() on the
+   thread that made it tell its time instead of the system clock's, so
+   that code run in a simulation sees simulated time (kernel timestamps
+   and monotonic_ns() are unaffected). They may be nested. */
+class VirtualClock
+{
+private:
+  uint64_t now_us_;
+  VirtualClock * outer_;
+
+public:
+  VirtualClock( const uint64_t start_us = 0 );
+  ~VirtualClock();
+
+  uint64_t now( void ) const { return now_us_; }
+
+  /* move the clock forward (never back) */
+  void set( const uint64_t now_us );
+
+  /* forbid copying, since the thread refers to this one */
+  VirtualClock( const VirtualClock & other ) = delete;
+  const VirtualClock & operator=( const VirtualClock & other ) = delete;
+};
+
 #endif /* TIMESTAMP_HH */